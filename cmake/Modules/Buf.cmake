@@ -58,10 +58,17 @@ function(buf_generate_sources)
 
       get_property(grpc_cpp_plugin TARGET gRPC::grpc_cpp_plugin PROPERTY LOCATION)
 
+      # Regenerate when protos in a local directory change
+      set(proto_deps "")
+      if(IS_DIRECTORY "${_repo}")
+        file(GLOB_RECURSE proto_deps "${_repo}/*.proto")
+      endif()
+
       add_custom_command(
         OUTPUT ${proto_generated}
         COMMAND ${BUF} generate "${_repo}" -o ${CMAKE_CURRENT_BINARY_DIR} ${include_imports_arg}
                 --template=${CMAKE_SOURCE_DIR}/buf.gen.yaml
+        DEPENDS ${proto_deps}
         COMMENT "[Buf] Generating gRPC code from ${_repo}"
         VERBATIM
       )
@@ -0,0 +1,409 @@
+#include "src/axy/admission.h"
+
+#include <fmt/chrono.h>
+#include <fmt/core.h>
+#include <google/protobuf/duration.pb.h>
+#include <google/rpc/code.pb.h>
+#include <google/rpc/error_details.pb.h>
+#include <google/rpc/status.pb.h>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <stop_token>
+#include <utility>
+#include <vector>
+
+#include "src/axy/logging.h"
+#include "src/axy/metrics.h"
+
+namespace axy {
+
+class AdmissionController::Pending {
+ public:
+  Pending(Callback callback, std::size_t class_index)
+      : callback{std::move(callback)},
+        class_index{class_index},
+        enqueued_at{Clock::now()} {}
+
+  Callback callback;
+  const std::size_t class_index;
+  const Clock::time_point enqueued_at;
+
+  /// Whoever sets this first gets to resolve the request.
+  std::atomic<bool> claimed = false;
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool resolved = false;
+};
+
+AdmissionController::Ticket& AdmissionController::Ticket::operator=(
+    Ticket&& other) noexcept {
+  if (this != &other) {
+    if (owner_) {
+      owner_->Release();
+    }
+    owner_ = std::move(other.owner_);
+  }
+  return *this;
+}
+
+AdmissionController::Ticket::~Ticket() {
+  if (owner_) {
+    owner_->Release();
+  }
+}
+
+std::shared_ptr<AdmissionController> AdmissionController::Create(
+    Options opts) {
+  return std::shared_ptr<AdmissionController>{
+      new AdmissionController{std::move(opts)}};
+}
+
+AdmissionController::AdmissionController(Options opts)
+    : opts_{std::move(opts)},
+      limit_{opts_.max_active},
+      queues_(opts_.classes.size()),
+      pass_(opts_.classes.size(), 0.0),
+      class_metrics_(opts_.classes.size()) {
+  if (opts_.classes.empty()) {
+    throw std::invalid_argument{"admission controller needs a class"};
+  }
+  for (const auto& cls : opts_.classes) {
+    if (cls.weight == 0) {
+      throw std::invalid_argument{
+          fmt::format("weight of class '{}' has to be positive", cls.name)};
+    }
+  }
+
+  if (!opts_.metrics_name.empty()) {
+    auto& registry = MetricsRegistry::Global();
+    const MetricLabels labels{{"controller", opts_.metrics_name}};
+    active_gauge_ = &registry.GetGauge("axy_admission_active",
+                                       "Currently admitted calls.", labels);
+    limit_gauge_ = &registry.GetGauge(
+        "axy_admission_limit", "Current limit, 0 means unlimited.", labels);
+    queued_gauge_ = &registry.GetGauge(
+        "axy_admission_queued", "Calls waiting for admission.", labels);
+    for (std::size_t i = 0; i < opts_.classes.size(); ++i) {
+      const MetricLabels class_labels{{"controller", opts_.metrics_name},
+                                      {"class", opts_.classes[i].name}};
+      class_metrics_[i].rejected = &registry.GetCounter(
+          "axy_admission_rejected_total", "Rejected calls.", class_labels);
+      class_metrics_[i].wait = &registry.GetHistogram(
+          "axy_admission_wait_seconds", "Time spent waiting for admission.",
+          class_labels);
+    }
+    limit_gauge_->Set(static_cast<double>(limit_));
+  }
+
+  if (opts_.max_queued > 0 && opts_.max_queue_wait.count() > 0) {
+    expiry_thread_ =
+        std::jthread{[this](std::stop_token stop) { ExpireQueued(stop); }};
+  }
+}
+
+AdmissionController::~AdmissionController() = default;
+
+std::shared_ptr<AdmissionController::Pending> AdmissionController::Acquire(
+    Callback callback, std::size_t class_index) {
+  std::unique_lock<std::mutex> lock{mtx_};
+  if (limit_ == 0 || active_ < limit_) {
+    ++active_;
+    UpdateGaugesLocked();
+    lock.unlock();
+    if (auto* wait = class_metrics_[class_index].wait) {
+      wait->Observe(0.0);
+    }
+    callback(Ticket{shared_from_this()});
+    return nullptr;
+  }
+
+  if (num_queued_ >= opts_.max_queued) {
+    lock.unlock();
+    if (auto* rejected = class_metrics_[class_index].rejected) {
+      rejected->Increment();
+    }
+    AXY_LOG_DEBUG("Rejecting new {}: limit of {} reached.", opts_.name,
+                  limit());
+    callback(std::nullopt);
+    return nullptr;
+  }
+
+  auto pending = std::make_shared<Pending>(std::move(callback), class_index);
+  auto& queue = queues_[class_index];
+  if (queue.empty()) {
+    // Don't let a class bank credit while it had nothing queued.
+    pass_[class_index] = std::max(pass_[class_index], virtual_time_);
+  }
+  queue.push_back(pending);
+  ++num_queued_;
+  UpdateGaugesLocked();
+  lock.unlock();
+  queue_cv_.notify_one();
+  return pending;
+}
+
+void AdmissionController::Cancel(const std::shared_ptr<Pending>& pending) {
+  if (pending == nullptr) {
+    return;
+  }
+
+  if (!pending->claimed.exchange(true)) {
+    // Nobody will resolve it now, so it mustn't hold a place in the queue.
+    // It's gone already if it was popped in the meantime.
+    std::lock_guard<std::mutex> lock{mtx_};
+    auto& queue = queues_[pending->class_index];
+    if (const auto it = std::find(queue.begin(), queue.end(), pending);
+        it != queue.end()) {
+      queue.erase(it);
+      --num_queued_;
+      UpdateGaugesLocked();
+    }
+    return;
+  }
+
+  // Someone else got to it first, wait until they're done with the callback.
+  std::unique_lock<std::mutex> lock{pending->mtx};
+  pending->cv.wait(lock, [&pending]() { return pending->resolved; });
+}
+
+grpc::Status AdmissionController::RejectionStatus() const {
+  const auto message =
+      fmt::format("Too many concurrent {}, retry after {}.", opts_.name,
+                  opts_.retry_after);
+
+  google::rpc::RetryInfo retry_info;
+  const auto retry_after_s =
+      std::chrono::duration_cast<std::chrono::seconds>(opts_.retry_after);
+  const auto retry_after_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(opts_.retry_after -
+                                                           retry_after_s);
+  retry_info.mutable_retry_delay()->set_seconds(retry_after_s.count());
+  retry_info.mutable_retry_delay()->set_nanos(
+      static_cast<std::int32_t>(retry_after_ns.count()));
+
+  google::rpc::Status details;
+  details.set_code(google::rpc::RESOURCE_EXHAUSTED);
+  details.set_message(message);
+  details.add_details()->PackFrom(retry_info);
+
+  return {grpc::StatusCode::RESOURCE_EXHAUSTED, message,
+          details.SerializeAsString()};
+}
+
+void AdmissionController::ObserveLatency(Clock::duration latency) {
+  if (opts_.target_latency.count() <= 0 || opts_.max_active == 0) {
+    return;
+  }
+
+  constexpr double kAlpha = 0.1;
+  const double sample_ms =
+      std::chrono::duration<double, std::milli>(latency).count();
+  const auto now = Clock::now();
+
+  std::unique_lock<std::mutex> lock{mtx_};
+  if (limit_ == 0) {
+    return;
+  }
+  latency_ewma_ms_ = kAlpha * sample_ms + (1.0 - kAlpha) * latency_ewma_ms_;
+  if (now - last_adjust_ < opts_.adjust_interval) {
+    return;
+  }
+  last_adjust_ = now;
+
+  const auto old_limit = limit_;
+  if (latency_ewma_ms_ > static_cast<double>(opts_.target_latency.count())) {
+    // Never down to 0, which would lift the limit for good.
+    limit_ = std::max({std::size_t{1}, opts_.min_active,
+                       limit_ - limit_ / 10 - 1});
+  } else if (active_ >= limit_) {
+    limit_ = std::min(opts_.max_active, limit_ + 1);
+  }
+
+  if (limit_ != old_limit) {
+    AXY_LOG_INFO("Limit for {} {} from {} to {} (backend latency {:.1f} ms).",
+                 opts_.name, limit_ < old_limit ? "lowered" : "raised",
+                 old_limit, limit_, latency_ewma_ms_);
+    UpdateGaugesLocked();
+    AdmitQueuedLocked(lock);
+  }
+}
+
+void AdmissionController::SetLimit(std::size_t limit) {
+  std::unique_lock<std::mutex> lock{mtx_};
+  AXY_LOG_INFO("Limit for {} set to {}.", opts_.name, limit);
+  limit_ = limit;
+  UpdateGaugesLocked();
+  AdmitQueuedLocked(lock);
+}
+
+std::size_t AdmissionController::limit() const {
+  std::lock_guard<std::mutex> lock{mtx_};
+  return limit_;
+}
+
+std::size_t AdmissionController::active() const {
+  std::lock_guard<std::mutex> lock{mtx_};
+  return active_;
+}
+
+std::size_t AdmissionController::queued() const {
+  std::lock_guard<std::mutex> lock{mtx_};
+  return num_queued_;
+}
+
+void AdmissionController::Release() {
+  std::shared_ptr<Pending> next;
+  {
+    std::lock_guard<std::mutex> lock{mtx_};
+    if (limit_ == 0 || active_ <= limit_) {
+      // Hand the slot straight over to the next request in line.
+      next = PopNextLocked();
+    }
+    if (next == nullptr) {
+      --active_;
+    }
+    UpdateGaugesLocked();
+  }
+
+  if (next != nullptr) {
+    Resolve(next, true);
+  }
+}
+
+void AdmissionController::Resolve(const std::shared_ptr<Pending>& pending,
+                                  bool admitted) {
+  const auto& metrics = class_metrics_[pending->class_index];
+  std::unique_lock<std::mutex> lock{pending->mtx};
+  if (admitted) {
+    if (metrics.wait != nullptr) {
+      metrics.wait->Observe(Clock::now() - pending->enqueued_at);
+    }
+    pending->callback(Ticket{shared_from_this()});
+  } else {
+    if (metrics.rejected != nullptr) {
+      metrics.rejected->Increment();
+    }
+    pending->callback(std::nullopt);
+  }
+  pending->callback = nullptr;
+  pending->resolved = true;
+  lock.unlock();
+  pending->cv.notify_all();
+}
+
+std::shared_ptr<AdmissionController::Pending>
+AdmissionController::PopNextLocked() {
+  DropClaimedLocked();
+
+  std::size_t next_class = queues_.size();
+  for (std::size_t i = 0; i < queues_.size(); ++i) {
+    if (!queues_[i].empty() &&
+        (next_class == queues_.size() || pass_[i] < pass_[next_class])) {
+      next_class = i;
+    }
+  }
+  if (next_class == queues_.size()) {
+    return nullptr;
+  }
+
+  auto next = std::move(queues_[next_class].front());
+  queues_[next_class].pop_front();
+  --num_queued_;
+  // DropClaimedLocked() left only unclaimed requests at the front, but a
+  // Cancel() might have raced us since.
+  if (next->claimed.exchange(true)) {
+    return PopNextLocked();
+  }
+
+  virtual_time_ = pass_[next_class];
+  pass_[next_class] += 1.0 / opts_.classes[next_class].weight;
+  return next;
+}
+
+void AdmissionController::DropClaimedLocked() {
+  for (auto& queue : queues_) {
+    while (!queue.empty() && queue.front()->claimed) {
+      queue.pop_front();
+      --num_queued_;
+    }
+  }
+}
+
+void AdmissionController::UpdateGaugesLocked() {
+  if (active_gauge_ != nullptr) {
+    active_gauge_->Set(static_cast<double>(active_));
+    limit_gauge_->Set(static_cast<double>(limit_));
+    queued_gauge_->Set(static_cast<double>(num_queued_));
+  }
+}
+
+void AdmissionController::AdmitQueuedLocked(
+    std::unique_lock<std::mutex>& lock) {
+  std::vector<std::shared_ptr<Pending>> admitted;
+  while (limit_ == 0 || active_ < limit_) {
+    auto next = PopNextLocked();
+    if (next == nullptr) {
+      break;
+    }
+    ++active_;
+    admitted.push_back(std::move(next));
+  }
+  UpdateGaugesLocked();
+
+  lock.unlock();
+  for (const auto& pending : admitted) {
+    Resolve(pending, true);
+  }
+  lock.lock();
+}
+
+void AdmissionController::ExpireQueued(std::stop_token stop) {
+  std::unique_lock<std::mutex> lock{mtx_};
+  while (!stop.stop_requested()) {
+    DropClaimedLocked();
+
+    // Everybody waits for the same amount of time, so the oldest request at
+    // the front of each queue expires first.
+    std::deque<std::shared_ptr<Pending>>* oldest = nullptr;
+    for (auto& queue : queues_) {
+      if (!queue.empty() &&
+          (oldest == nullptr ||
+           queue.front()->enqueued_at < oldest->front()->enqueued_at)) {
+        oldest = &queue;
+      }
+    }
+    if (oldest == nullptr) {
+      queue_cv_.wait(lock, stop, [this]() { return num_queued_ > 0; });
+      continue;
+    }
+
+    const auto deadline = oldest->front()->enqueued_at + opts_.max_queue_wait;
+    if (Clock::now() < deadline) {
+      queue_cv_.wait_until(lock, stop, deadline, [] { return false; });
+      continue;
+    }
+
+    auto expired = std::move(oldest->front());
+    oldest->pop_front();
+    --num_queued_;
+    UpdateGaugesLocked();
+    if (expired->claimed.exchange(true)) {
+      continue;
+    }
+
+    lock.unlock();
+    AXY_LOG_DEBUG("Rejecting queued {}: waited for {}.", opts_.name,
+                  opts_.max_queue_wait);
+    Resolve(expired, false);
+    lock.lock();
+  }
+}
+
+}  // namespace axy
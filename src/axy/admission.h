@@ -0,0 +1,174 @@
+#ifndef AXY_SRC_AXY_ADMISSION_H_
+#define AXY_SRC_AXY_ADMISSION_H_
+
+#include <grpcpp/support/status.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "src/axy/metrics.h"
+
+namespace axy {
+
+/** Limits the number of concurrently active calls of some kind.
+ *
+ * Calls over the limit may wait a short while in a bounded queue for a slot to
+ * free up, otherwise they get rejected right away. When a target latency is
+ * set, the limit is adjusted at runtime (AIMD) from latencies reported through
+ * ObserveLatency(), so that we shed load before the backend falls over.
+ *
+ * Requests belong to weighted classes. When slots free up, waiting requests
+ * are admitted by stride scheduling, so that each class gets a share of the
+ * slots proportional to its weight while there is contention.
+ */
+class AdmissionController
+    : public std::enable_shared_from_this<AdmissionController> {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Class {
+    std::string name;
+    unsigned weight = 1;
+  };
+
+  struct Options {
+    /// Used in log and error messages, e.g. "speech streams".
+    std::string name = "calls";
+    /// Value of the `controller` label of exported metrics. Empty disables
+    /// metrics.
+    std::string metrics_name;
+    /// Classes of requests, indexed by the `class_index` arg to Acquire().
+    std::vector<Class> classes{{.name = "default"}};
+    /// Maximum number of concurrently active calls, 0 for unlimited.
+    std::size_t max_active = 0;
+    /// Maximum number of calls waiting for a slot. 0 disables the queue.
+    std::size_t max_queued = 0;
+    /// How long a call may wait in the queue before it's rejected. 0 means it
+    /// waits until it gets a slot.
+    std::chrono::milliseconds max_queue_wait{0};
+    /// Retry delay suggested to rejected clients.
+    std::chrono::milliseconds retry_after{1000};
+    /// Target for the latency reported through ObserveLatency(). The limit is
+    /// decreased while the observed latency is above it and increased (up to
+    /// `max_active`) while it's below it. 0 disables adaptation.
+    std::chrono::milliseconds target_latency{0};
+    /// The adaptive limit never goes below this, nor below 1, since a limit
+    /// of 0 means unlimited.
+    std::size_t min_active = 1;
+    /// Minimum time between limit adjustments.
+    std::chrono::milliseconds adjust_interval{1000};
+  };
+
+  /// Holds an admission slot, which is released when the ticket is destroyed.
+  class Ticket {
+   public:
+    Ticket(Ticket&& other) noexcept : owner_{std::move(other.owner_)} {}
+    Ticket& operator=(Ticket&& other) noexcept;
+    Ticket(const Ticket&) = delete;
+    Ticket& operator=(const Ticket&) = delete;
+    ~Ticket();
+
+   private:
+    friend class AdmissionController;
+    explicit Ticket(std::shared_ptr<AdmissionController> owner)
+        : owner_{std::move(owner)} {}
+
+    std::shared_ptr<AdmissionController> owner_;
+  };
+
+  /// Called exactly once with a ticket if admitted or `std::nullopt` if
+  /// rejected.
+  using Callback = std::function<void(std::optional<Ticket>)>;
+
+  class Pending;
+
+  static std::shared_ptr<AdmissionController> Create(Options opts);
+
+  ~AdmissionController();
+
+  /** Request a slot.
+   *
+   * `callback` is called before this returns if the call can be admitted or
+   * rejected right away. Otherwise it's called later from another thread,
+   * and the returned handle can be used to Cancel() the request.
+   */
+  std::shared_ptr<Pending> Acquire(Callback callback,
+                                   std::size_t class_index = 0);
+
+  /** Withdraw a queued request.
+   *
+   * Once this returns the callback has either run to completion or will never
+   * be called. Must not be called from within the callback itself.
+   */
+  void Cancel(const std::shared_ptr<Pending>& pending);
+
+  /// Status to finish rejected calls with, with a `google.rpc.RetryInfo` hint.
+  grpc::Status RejectionStatus() const;
+
+  void ObserveLatency(Clock::duration latency);
+
+  /// Change the limit at runtime. 0 means unlimited.
+  void SetLimit(std::size_t limit);
+
+  std::size_t limit() const;
+  std::size_t active() const;
+  std::size_t queued() const;
+
+ private:
+  struct ClassMetrics {
+    Counter* rejected = nullptr;
+    Histogram* wait = nullptr;
+  };
+
+  explicit AdmissionController(Options opts);
+
+  void Release();
+  void Resolve(const std::shared_ptr<Pending>& pending, bool admitted);
+  void AdmitQueuedLocked(std::unique_lock<std::mutex>& lock);
+  /// Pop the next live request to admit, or nullptr if there is none.
+  std::shared_ptr<Pending> PopNextLocked();
+  /// Drop requests at the front that a racing Cancel() hasn't removed yet.
+  void DropClaimedLocked();
+  void UpdateGaugesLocked();
+  void ExpireQueued(std::stop_token stop);
+
+  const Options opts_;
+
+  mutable std::mutex mtx_;
+  std::condition_variable_any queue_cv_;
+  std::size_t limit_;
+  std::size_t active_ = 0;
+  std::size_t num_queued_ = 0;
+  /// One FIFO queue per class.
+  std::vector<std::deque<std::shared_ptr<Pending>>> queues_;
+  /// Stride scheduling state: a class with a lower pass goes first, and each
+  /// admission advances the pass of its class by 1/weight.
+  std::vector<double> pass_;
+  double virtual_time_ = 0.0;
+
+  std::vector<ClassMetrics> class_metrics_;
+  Gauge* active_gauge_ = nullptr;
+  Gauge* limit_gauge_ = nullptr;
+  Gauge* queued_gauge_ = nullptr;
+
+  double latency_ewma_ms_ = 0.0;
+  Clock::time_point last_adjust_{};
+
+  std::jthread expiry_thread_;
+};
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_ADMISSION_H_
@@ -0,0 +1,241 @@
+#include "src/axy/audio-cache.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace axy {
+
+namespace {
+
+/// Odd, so multiplying by it is invertible modulo 2^64.
+constexpr std::uint64_t kHashBase = 0x100000001b3;
+
+/// A single recording may take at most this fraction of the cache.
+constexpr std::size_t kMaxEntryFraction = 16;
+
+Counter& Lookups(const std::string& result) {
+  return MetricsRegistry::Global().GetCounter(
+      "axy_audio_cache_lookups_total",
+      "Speech streams looked up in the audio result cache.",
+      {{"result", result}});
+}
+
+std::size_t ResponseBytes(const AudioResultCache::Response& response) {
+  return sizeof(response) + response.serialized.size();
+}
+
+}  // namespace
+
+void AudioFingerprint::Update(std::string_view audio) {
+  while (!audio.empty()) {
+    const auto to_checkpoint = kCheckpointBytes - size_ % kCheckpointBytes;
+    const auto n = std::min(to_checkpoint, audio.size());
+    for (const char c : audio.substr(0, n)) {
+      // Adding 1 keeps runs of zero bytes, i.e. digital silence, from
+      // hashing to 0.
+      hash_ = hash_ * kHashBase + static_cast<unsigned char>(c) + 1;
+    }
+    size_ += n;
+    audio.remove_prefix(n);
+    if (n == to_checkpoint) {
+      checkpoints_.push_back(hash_);
+    }
+  }
+}
+
+AudioResultCache::Matcher::Matcher(
+    AudioResultCache* cache,
+    std::vector<std::shared_ptr<const Entry>> candidates)
+    : cache_{cache}, candidates_{std::move(candidates)} {
+  if (candidates_.empty()) {
+    counted_ = true;
+    cache_->CountLookup(false);
+  }
+}
+
+AudioResultCache::Matcher::~Matcher() {
+  if (!counted_) {
+    cache_->CountLookup(false);
+  }
+}
+
+bool AudioResultCache::Matcher::Push(std::string_view audio) {
+  if (candidates_.empty()) {
+    return false;
+  }
+  const auto checked = audio_.checkpoints().size();
+  audio_.Update(audio);
+  const auto& checkpoints = audio_.checkpoints();
+  std::erase_if(candidates_, [&](const auto& entry) {
+    const auto& theirs = entry->audio.checkpoints();
+    return entry->audio.size() < audio_.size() ||
+           !std::equal(checkpoints.begin() + checked, checkpoints.end(),
+                       theirs.begin() + checked);
+  });
+  if (candidates_.empty() && !counted_) {
+    counted_ = true;
+    cache_->CountLookup(false);
+  }
+  return !candidates_.empty();
+}
+
+std::shared_ptr<const AudioResultCache::Entry>
+AudioResultCache::Matcher::Finish() {
+  std::shared_ptr<const Entry> hit;
+  for (const auto& entry : candidates_) {
+    if (entry->audio.size() == audio_.size() &&
+        entry->audio.hash() == audio_.hash()) {
+      hit = entry;
+      break;
+    }
+  }
+  candidates_.clear();
+  if (!counted_) {
+    counted_ = true;
+    cache_->CountLookup(hit != nullptr);
+  }
+  if (hit != nullptr) {
+    cache_->Touch(hit);
+  }
+  return hit;
+}
+
+AudioResultCache::Recorder::Recorder(AudioResultCache* cache, std::string key)
+    : cache_{cache},
+      key_{std::move(key)},
+      started_at_{std::chrono::steady_clock::now()},
+      entry_{std::make_shared<Entry>()} {
+  entry_->bytes = sizeof(Entry) + key_.size();
+}
+
+void AudioResultCache::Recorder::AddAudio(std::string_view audio) {
+  std::lock_guard<std::mutex> lock{mtx_};
+  const auto checkpoints = entry_->audio.checkpoints().size();
+  entry_->audio.Update(audio);
+  entry_->bytes += (entry_->audio.checkpoints().size() - checkpoints) *
+                   sizeof(std::uint64_t);
+}
+
+void AudioResultCache::Recorder::AddResponse(std::string serialized) {
+  const auto offset = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - started_at_);
+  std::lock_guard<std::mutex> lock{mtx_};
+  if (too_large_) {
+    return;
+  }
+  entry_->responses.push_back(
+      {.offset = offset, .serialized = std::move(serialized)});
+  entry_->bytes += ResponseBytes(entry_->responses.back());
+  if (entry_->bytes > cache_->max_bytes_ / kMaxEntryFraction) {
+    too_large_ = true;
+    entry_->responses.clear();
+  }
+}
+
+void AudioResultCache::Recorder::Commit() {
+  std::shared_ptr<const Entry> entry;
+  {
+    std::lock_guard<std::mutex> lock{mtx_};
+    if (too_large_ || entry_->responses.empty()) {
+      return;
+    }
+    entry = std::exchange(entry_, std::make_shared<Entry>());
+    too_large_ = true;
+  }
+  cache_->Insert(key_, std::move(entry));
+}
+
+AudioResultCache::AudioResultCache(std::size_t max_bytes)
+    : max_bytes_{max_bytes},
+      hits_{&Lookups("hit")},
+      misses_{&Lookups("miss")},
+      evictions_{&MetricsRegistry::Global().GetCounter(
+          "axy_audio_cache_evictions_total",
+          "Recordings evicted from the audio result cache to stay within "
+          "its memory budget.")},
+      size_bytes_{&MetricsRegistry::Global().GetGauge(
+          "axy_audio_cache_bytes",
+          "Memory used by the audio result cache.")},
+      entries_{&MetricsRegistry::Global().GetGauge(
+          "axy_audio_cache_entries", "Recordings in the audio result cache.")} {
+  if (max_bytes == 0) {
+    throw std::invalid_argument{"The audio result cache needs a budget."};
+  }
+}
+
+std::unique_ptr<AudioResultCache::Matcher> AudioResultCache::Match(
+    const std::string& key, std::size_t max_audio_bytes) {
+  std::vector<std::shared_ptr<const Entry>> candidates;
+  {
+    std::lock_guard<std::mutex> lock{mtx_};
+    const auto [begin, end] = index_.equal_range(key);
+    for (auto it = begin; it != end; ++it) {
+      if (it->second->entry->audio.size() <= max_audio_bytes) {
+        candidates.push_back(it->second->entry);
+      }
+    }
+  }
+  return std::unique_ptr<Matcher>{new Matcher{this, std::move(candidates)}};
+}
+
+std::shared_ptr<AudioResultCache::Recorder> AudioResultCache::Record(
+    std::string key) {
+  return std::shared_ptr<Recorder>{new Recorder{this, std::move(key)}};
+}
+
+void AudioResultCache::Insert(const std::string& key,
+                              std::shared_ptr<const Entry> entry) {
+  std::lock_guard<std::mutex> lock{mtx_};
+  // Streams with the same audio that ran concurrently all missed. Keep the
+  // newest recording.
+  const auto [begin, end] = index_.equal_range(key);
+  for (auto it = begin; it != end; ++it) {
+    const auto& existing = it->second->entry->audio;
+    if (existing.size() == entry->audio.size() &&
+        existing.hash() == entry->audio.hash()) {
+      const auto node = it->second;
+      bytes_ -= node->entry->bytes;
+      nodes_.erase(node->entry.get());
+      index_.erase(it);
+      lru_.erase(node);
+      break;
+    }
+  }
+
+  bytes_ += entry->bytes;
+  lru_.push_front({.key = key, .entry = entry});
+  index_.emplace(key, lru_.begin());
+  nodes_.emplace(entry.get(), lru_.begin());
+
+  while (bytes_ > max_bytes_ && !lru_.empty()) {
+    const auto& victim = lru_.back();
+    const auto [first, last] = index_.equal_range(victim.key);
+    for (auto it = first; it != last; ++it) {
+      if (it->second->entry == victim.entry) {
+        index_.erase(it);
+        break;
+      }
+    }
+    nodes_.erase(victim.entry.get());
+    bytes_ -= victim.entry->bytes;
+    lru_.pop_back();
+    evictions_->Increment();
+  }
+  size_bytes_->Set(static_cast<double>(bytes_));
+  entries_->Set(static_cast<double>(lru_.size()));
+}
+
+void AudioResultCache::Touch(const std::shared_ptr<const Entry>& entry) {
+  std::lock_guard<std::mutex> lock{mtx_};
+  // Gone if it was evicted while the stream was matching.
+  if (const auto it = nodes_.find(entry.get()); it != nodes_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second);
+  }
+}
+
+void AudioResultCache::CountLookup(bool hit) {
+  (hit ? hits_ : misses_)->Increment();
+}
+
+}  // namespace axy
@@ -0,0 +1,163 @@
+#ifndef AXY_SRC_AXY_AUDIO_CACHE_H_
+#define AXY_SRC_AXY_AUDIO_CACHE_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "src/axy/metrics.h"
+
+namespace axy {
+
+/** Hash of an audio stream that doesn't depend on how it was chunked.
+ *
+ * A polynomial rolling hash over the raw bytes, with the running value
+ * recorded every `kCheckpointBytes`. Two streams can be compared while they
+ * are still arriving by comparing checkpoints.
+ */
+class AudioFingerprint {
+ public:
+  /// A quarter of a second of 16 kHz LINEAR16.
+  static constexpr std::size_t kCheckpointBytes = 8192;
+
+  void Update(std::string_view audio);
+
+  std::size_t size() const { return size_; }
+  std::uint64_t hash() const { return hash_; }
+  const std::vector<std::uint64_t>& checkpoints() const {
+    return checkpoints_;
+  }
+
+ private:
+  std::size_t size_ = 0;
+  std::uint64_t hash_ = 0;
+  std::vector<std::uint64_t> checkpoints_;
+};
+
+/** Backend responses of previously seen audio, for replaying instead of
+ * opening another backend stream.
+ *
+ * Entries are looked up by a key for the recognition config and the
+ * fingerprint of the complete audio, and evicted least recently used first
+ * once they take more than `max_bytes`. Only fingerprints are kept, never
+ * the audio itself.
+ *
+ * Responses are stored serialized, so the cache doesn't depend on the
+ * backend's types.
+ */
+class AudioResultCache {
+ public:
+  struct Response {
+    /// Since the stream was admitted.
+    std::chrono::microseconds offset;
+    std::string serialized;
+  };
+
+  struct Entry {
+    AudioFingerprint audio;
+    std::vector<Response> responses;
+    std::size_t bytes = 0;
+  };
+
+  /// Follows the audio of a new stream while it could still be a hit.
+  class Matcher {
+   public:
+    /// Counts as a miss unless `Finish()` found a hit.
+    ~Matcher();
+
+    /// \returns false once no entry can match anymore.
+    bool Push(std::string_view audio);
+    bool matching() const { return !candidates_.empty(); }
+    /// Call once the audio ended. \returns the entry with the exact same
+    /// audio, or null.
+    std::shared_ptr<const Entry> Finish();
+
+   private:
+    friend class AudioResultCache;
+    Matcher(AudioResultCache* cache,
+            std::vector<std::shared_ptr<const Entry>> candidates);
+
+    AudioResultCache* cache_;
+    std::vector<std::shared_ptr<const Entry>> candidates_;
+    AudioFingerprint audio_;
+    bool counted_ = false;
+  };
+
+  /// Records the audio and backend responses of a stream that missed.
+  /// Thread safe, since audio and responses arrive on different reactors.
+  class Recorder {
+   public:
+    void AddAudio(std::string_view audio);
+    void AddResponse(std::string serialized);
+    /// Add the recording to the cache. Only call this once the audio ended
+    /// and the backend stream finished successfully.
+    void Commit();
+
+   private:
+    friend class AudioResultCache;
+    Recorder(AudioResultCache* cache, std::string key);
+
+    AudioResultCache* cache_;
+    const std::string key_;
+    const std::chrono::steady_clock::time_point started_at_;
+    std::mutex mtx_;
+    /// Dropped if it grows larger than a fraction of the cache.
+    bool too_large_ = false;
+    std::shared_ptr<Entry> entry_;
+  };
+
+  /// \throws std::invalid_argument if `max_bytes` is 0.
+  explicit AudioResultCache(std::size_t max_bytes);
+
+  AudioResultCache(const AudioResultCache&) = delete;
+  AudioResultCache& operator=(const AudioResultCache&) = delete;
+
+  /// Start matching a stream with recognition config `key`. Only entries
+  /// with at most `max_audio_bytes` of audio can match, which bounds how
+  /// long the stream waits on the cache. The cache has to outlive the
+  /// matcher.
+  std::unique_ptr<Matcher> Match(
+      const std::string& key,
+      std::size_t max_audio_bytes = std::numeric_limits<std::size_t>::max());
+  /// Start recording a stream with recognition config `key`. The cache has
+  /// to outlive the recorder.
+  std::shared_ptr<Recorder> Record(std::string key);
+
+ private:
+  struct Node {
+    std::string key;
+    std::shared_ptr<const Entry> entry;
+  };
+  using Lru = std::list<Node>;
+
+  void Insert(const std::string& key, std::shared_ptr<const Entry> entry);
+  void Touch(const std::shared_ptr<const Entry>& entry);
+  void CountLookup(bool hit);
+
+  const std::size_t max_bytes_;
+
+  std::mutex mtx_;
+  /// Most recently used first.
+  Lru lru_;
+  std::unordered_multimap<std::string, Lru::iterator> index_;
+  std::unordered_map<const Entry*, Lru::iterator> nodes_;
+  std::size_t bytes_ = 0;
+
+  Counter* hits_;
+  Counter* misses_;
+  Counter* evictions_;
+  Gauge* size_bytes_;
+  Gauge* entries_;
+};
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_AUDIO_CACHE_H_
@@ -0,0 +1,219 @@
+#include "src/axy/audio.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace axy {
+
+namespace {
+
+template <typename T>
+T ReadLittleEndian(std::string_view data, std::size_t offset) {
+  if (offset + sizeof(T) > data.size()) {
+    throw std::invalid_argument{"Truncated WAV header."};
+  }
+  T value = 0;
+  for (std::size_t i = 0; i < sizeof(T); ++i) {
+    value |= static_cast<T>(static_cast<unsigned char>(data[offset + i]))
+             << (8 * i);
+  }
+  return value;
+}
+
+std::vector<std::int16_t> DecodeSamples(std::string_view pcm) {
+  std::vector<std::int16_t> samples(pcm.size() / 2);
+  for (std::size_t i = 0; i < samples.size(); ++i) {
+    samples[i] = static_cast<std::int16_t>(ReadLittleEndian<std::uint16_t>(
+        pcm, 2 * i));
+  }
+  return samples;
+}
+
+std::size_t ToSamples(std::chrono::milliseconds duration,
+                      int sample_rate_hertz) {
+  return static_cast<std::size_t>(duration.count()) * sample_rate_hertz / 1000;
+}
+
+void DeinterleaveStereo(const char* in, std::size_t frames, char* left,
+                        char* right) {
+  std::size_t frame = 0;
+#ifdef __SSE2__
+  // Eight frames at a time. Each 32 bit lane holds a left sample in its low
+  // and a right sample in its high half. Sign extending either half and
+  // packing with saturation gives back the exact samples.
+  for (; frame + 8 <= frames; frame += 8) {
+    const auto* src = reinterpret_cast<const __m128i*>(in + 4 * frame);
+    const __m128i a = _mm_loadu_si128(src);
+    const __m128i b = _mm_loadu_si128(src + 1);
+    const __m128i l =
+        _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+                        _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+    const __m128i r =
+        _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(left + 2 * frame), l);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(right + 2 * frame), r);
+  }
+#endif
+  for (; frame < frames; ++frame) {
+    std::memcpy(left + 2 * frame, in + 4 * frame, 2);
+    std::memcpy(right + 2 * frame, in + 4 * frame + 2, 2);
+  }
+}
+
+/// Level of `samples` in dB relative to full scale.
+double LevelDbfs(const std::int16_t* samples, std::size_t count) {
+  double sum_of_squares = 0.0;
+  for (std::size_t i = 0; i < count; ++i) {
+    sum_of_squares += static_cast<double>(samples[i]) * samples[i];
+  }
+  constexpr double kFullScale = 32768.0 * 32768.0;
+  const double mean_square = sum_of_squares / static_cast<double>(count);
+  return mean_square == 0.0 ? -std::numeric_limits<double>::infinity()
+                            : 10.0 * std::log10(mean_square / kFullScale);
+}
+
+}  // namespace
+
+void DeinterleaveLinear16(const char* in, std::size_t frames,
+                          std::size_t channels, char* const* out) {
+  if (channels == 1) {
+    std::memcpy(out[0], in, 2 * frames);
+    return;
+  }
+  if (channels == 2) {
+    DeinterleaveStereo(in, frames, out[0], out[1]);
+    return;
+  }
+  for (std::size_t frame = 0; frame < frames; ++frame) {
+    for (std::size_t channel = 0; channel < channels; ++channel) {
+      std::memcpy(out[channel] + 2 * frame,
+                  in + 2 * (frame * channels + channel), 2);
+    }
+  }
+}
+
+Deinterleaver::Deinterleaver(std::size_t channels) : channels_{channels} {
+  if (channels == 0 || channels > kMaxAudioChannels) {
+    throw std::invalid_argument{"Unsupported number of audio channels."};
+  }
+}
+
+void Deinterleaver::Push(std::string_view chunk,
+                         std::vector<std::string>& out) {
+  // Only copy the chunk when a partial frame is left over from the last one,
+  // which clients sending whole frames never cause.
+  if (!partial_.empty()) {
+    partial_.append(chunk);
+    chunk = partial_;
+  }
+  const auto frame_bytes = 2 * channels_;
+  const auto frames = chunk.size() / frame_bytes;
+
+  out.resize(channels_);
+  std::array<char*, kMaxAudioChannels> channel_data{};
+  for (std::size_t channel = 0; channel < channels_; ++channel) {
+    out[channel].resize(2 * frames);
+    channel_data[channel] = out[channel].data();
+  }
+  DeinterleaveLinear16(chunk.data(), frames, channels_, channel_data.data());
+
+  // `chunk` may point into `partial_`.
+  std::string rest{chunk.substr(frames * frame_bytes)};
+  partial_ = std::move(rest);
+}
+
+PcmAudio DecodeLinear16(std::string_view data, int sample_rate_hertz) {
+  if (!data.starts_with("RIFF")) {
+    if (sample_rate_hertz <= 0) {
+      throw std::invalid_argument{
+          "A sample rate is required for raw LINEAR16 audio."};
+    }
+    return {.sample_rate_hertz = sample_rate_hertz,
+            .samples = DecodeSamples(data)};
+  }
+
+  if (data.size() < 12 || data.substr(8, 4) != "WAVE") {
+    throw std::invalid_argument{"Not a WAV file."};
+  }
+  PcmAudio audio;
+  audio.sample_rate_hertz = 0;
+  std::size_t offset = 12;
+  while (offset + 8 <= data.size()) {
+    const auto chunk_id = data.substr(offset, 4);
+    const auto chunk_size = ReadLittleEndian<std::uint32_t>(data, offset + 4);
+    const auto chunk = data.substr(offset + 8, chunk_size);
+    if (chunk_id == "fmt ") {
+      const auto format = ReadLittleEndian<std::uint16_t>(chunk, 0);
+      const auto channels = ReadLittleEndian<std::uint16_t>(chunk, 2);
+      const auto bits_per_sample = ReadLittleEndian<std::uint16_t>(chunk, 14);
+      if (format != 1 || channels != 1 || bits_per_sample != 16) {
+        throw std::invalid_argument{
+            "Only 16 bit mono PCM WAV files are supported."};
+      }
+      audio.sample_rate_hertz =
+          static_cast<int>(ReadLittleEndian<std::uint32_t>(chunk, 4));
+    } else if (chunk_id == "data") {
+      if (audio.sample_rate_hertz == 0) {
+        throw std::invalid_argument{"WAV data chunk before fmt chunk."};
+      }
+      audio.samples = DecodeSamples(chunk);
+      return audio;
+    }
+    // Chunks are padded to an even size.
+    offset += 8 + chunk_size + (chunk_size & 1);
+  }
+  throw std::invalid_argument{"WAV file has no data chunk."};
+}
+
+std::vector<AudioSegment> SplitAudio(const PcmAudio& audio,
+                                     const SegmentationOptions& opts) {
+  const auto max_segment = ToSamples(opts.max_segment, audio.sample_rate_hertz);
+  const auto overlap = ToSamples(opts.overlap, audio.sample_rate_hertz);
+  const auto frame = ToSamples(opts.silence_frame, audio.sample_rate_hertz);
+  if (max_segment == 0 || overlap * 2 > max_segment || frame == 0) {
+    throw std::invalid_argument{
+        "Segments must be longer than twice their overlap."};
+  }
+
+  std::vector<AudioSegment> segments;
+  std::size_t begin = 0;
+  while (begin < audio.samples.size()) {
+    const auto end = begin + max_segment;
+    if (end >= audio.samples.size()) {
+      segments.push_back({begin, audio.samples.size()});
+      break;
+    }
+
+    if (opts.split_on_silence) {
+      std::size_t quietest = 0;
+      double quietest_level = std::numeric_limits<double>::infinity();
+      for (auto pos = end - max_segment / 4; pos + frame <= end;
+           pos += frame / 2 + 1) {
+        const auto level = LevelDbfs(&audio.samples[pos], frame);
+        if (level < quietest_level) {
+          quietest = pos;
+          quietest_level = level;
+        }
+      }
+      if (quietest_level < opts.silence_threshold_dbfs) {
+        const auto split = quietest + frame / 2;
+        segments.push_back({begin, split});
+        begin = split;
+        continue;
+      }
+    }
+
+    segments.push_back({begin, end});
+    begin = end - overlap;
+  }
+  return segments;
+}
+
+}  // namespace axy
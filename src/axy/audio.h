@@ -0,0 +1,97 @@
+#ifndef AXY_SRC_AXY_AUDIO_H_
+#define AXY_SRC_AXY_AUDIO_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace axy {
+
+/// 16 bit mono PCM audio.
+struct PcmAudio {
+  int sample_rate_hertz = 16000;
+  std::vector<std::int16_t> samples;
+
+  std::chrono::microseconds Offset(std::size_t sample) const {
+    return std::chrono::microseconds{static_cast<std::int64_t>(sample) *
+                                     1'000'000 / sample_rate_hertz};
+  }
+  std::chrono::microseconds duration() const { return Offset(samples.size()); }
+};
+
+/** Decode a WAV file with 16 bit mono PCM, or raw LINEAR16 if `data` has no
+ * RIFF header.
+ *
+ * \param sample_rate_hertz Sample rate of raw audio, WAV files have their own.
+ * \throws std::invalid_argument If `data` isn't audio we can handle.
+ */
+PcmAudio DecodeLinear16(std::string_view data, int sample_rate_hertz);
+
+struct SegmentationOptions {
+  std::chrono::milliseconds max_segment{30'000};
+  /// Overlap of consecutive segments that aren't split at silence, so words
+  /// at the split aren't cut in half.
+  std::chrono::milliseconds overlap{1'000};
+  /// Split at the quietest frame in the last quarter of a segment if it's
+  /// below `silence_threshold_dbfs`.
+  bool split_on_silence = false;
+  std::chrono::milliseconds silence_frame{20};
+  double silence_threshold_dbfs = -40.0;
+};
+
+/// Samples [begin, end) of a recording.
+struct AudioSegment {
+  std::size_t begin;
+  std::size_t end;
+};
+
+/** Split `audio` into segments of at most `opts.max_segment`.
+ *
+ * Segments are in order and cover all of `audio`. Consecutive segments either
+ * meet at a silence or overlap by `opts.overlap`.
+ */
+std::vector<AudioSegment> SplitAudio(const PcmAudio& audio,
+                                     const SegmentationOptions& opts);
+
+/// Clients announce interleaved multi-channel audio with this metadata key.
+inline constexpr std::string_view kAudioChannelsMetadataKey =
+    "x-axy-audio-channels";
+inline constexpr std::size_t kMaxAudioChannels = 8;
+
+/** Split `frames` frames of interleaved LINEAR16 audio with `channels`
+ * samples each into one buffer per channel.
+ *
+ * Each of `out[0..channels)` needs room for `2 * frames` bytes. Stereo, the
+ * common case for telephony, uses SSE2 where available.
+ */
+void DeinterleaveLinear16(const char* in, std::size_t frames,
+                          std::size_t channels, char* const* out);
+
+/** Deinterleaves a stream of multi-channel LINEAR16 audio chunk by chunk.
+ *
+ * Chunks don't have to end on a frame boundary, the start of a partial frame
+ * is kept until the next chunk completes it.
+ */
+class Deinterleaver {
+ public:
+  /// \throws std::invalid_argument if `channels` is 0 or above
+  ///         `kMaxAudioChannels`.
+  explicit Deinterleaver(std::size_t channels);
+
+  /// Replace the contents of `out[0..channels)` with the complete frames
+  /// from `chunk`.
+  void Push(std::string_view chunk, std::vector<std::string>& out);
+
+  std::size_t channels() const { return channels_; }
+
+ private:
+  std::size_t channels_;
+  std::string partial_;
+};
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_AUDIO_H_
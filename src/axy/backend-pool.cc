@@ -0,0 +1,99 @@
+#include "src/axy/backend-pool.h"
+
+#include <grpc/grpc.h>
+#include <grpcpp/create_channel.h>
+#include <grpcpp/support/channel_arguments.h>
+
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace axy {
+
+namespace {
+
+/// Only there to make the channel args of each channel in a pool distinct.
+constexpr const char* kChannelIndexArg = "axy.backend_channel_index";
+
+}  // namespace
+
+BackendChannelPool::Lease::Lease(Lease&& other) noexcept
+    : pool_{std::exchange(other.pool_, nullptr)}, index_{other.index_} {}
+
+BackendChannelPool::Lease& BackendChannelPool::Lease::operator=(
+    Lease&& other) noexcept {
+  if (this != &other) {
+    if (pool_ != nullptr) {
+      pool_->Release(index_);
+    }
+    pool_ = std::exchange(other.pool_, nullptr);
+    index_ = other.index_;
+  }
+  return *this;
+}
+
+BackendChannelPool::Lease::~Lease() {
+  if (pool_ != nullptr) {
+    pool_->Release(index_);
+  }
+}
+
+BackendChannelPool::BackendChannelPool(
+    const std::string& address,
+    const std::shared_ptr<grpc::ChannelCredentials>& creds, std::size_t size,
+    const std::string& route) {
+  if (size == 0) {
+    throw std::invalid_argument{"A backend channel pool can't be empty."};
+  }
+  for (std::size_t i = 0; i < size; ++i) {
+    grpc::ChannelArguments args;
+    args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+    args.SetInt(kChannelIndexArg, static_cast<int>(i));
+
+    auto slot = std::make_unique<Slot>();
+    slot->channel = grpc::CreateCustomChannel(address, creds, args);
+    slot->streams = &MetricsRegistry::Global().GetGauge(
+        "axy_backend_channel_streams",
+        "Backend streams in flight on each pooled backend connection.",
+        {{"route", route}, {"channel", std::to_string(i)}});
+    slots_.push_back(std::move(slot));
+  }
+}
+
+BackendChannelPool::Lease BackendChannelPool::Acquire() {
+  const auto start = next_.fetch_add(1, std::memory_order_relaxed);
+  std::size_t best = 0;
+  std::size_t best_in_flight = std::numeric_limits<std::size_t>::max();
+  for (std::size_t i = 0; i < slots_.size(); ++i) {
+    const auto index = (start + i) % slots_.size();
+    const auto in_flight =
+        slots_[index]->in_flight.load(std::memory_order_relaxed);
+    if (in_flight < best_in_flight) {
+      best = index;
+      best_in_flight = in_flight;
+    }
+  }
+  // Concurrent callers may pick the same channel, which only costs a little
+  // balance.
+  slots_[best]->in_flight.fetch_add(1, std::memory_order_relaxed);
+  slots_[best]->streams->Add(1);
+  return Lease{this, best};
+}
+
+void BackendChannelPool::Release(std::size_t index) {
+  slots_[index]->in_flight.fetch_sub(1, std::memory_order_relaxed);
+  slots_[index]->streams->Add(-1);
+}
+
+bool BackendChannelPool::WaitForConnected(
+    std::chrono::system_clock::time_point deadline) {
+  for (const auto& slot : slots_) {
+    if (!slot->channel->WaitForConnected(deadline)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace axy
@@ -0,0 +1,84 @@
+#ifndef AXY_SRC_AXY_BACKEND_POOL_H_
+#define AXY_SRC_AXY_BACKEND_POOL_H_
+
+#include <grpcpp/channel.h>
+#include <grpcpp/security/credentials.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/axy/metrics.h"
+
+namespace axy {
+
+/** Independent channels to the same backend address.
+ *
+ * All streams on one `grpc::Channel` share a single HTTP/2 connection, so
+ * they are limited by the server's `MAX_CONCURRENT_STREAMS` and suffer TCP
+ * head-of-line blocking together. Each channel in the pool gets distinct
+ * channel args and a local subchannel pool, so gRPC gives it its own
+ * connection. Streams are spread over the channels by in-flight count.
+ */
+class BackendChannelPool {
+ public:
+  /// A stream on one of the channels, counted as in flight until destroyed.
+  class Lease {
+   public:
+    Lease() = default;
+    Lease(Lease&& other) noexcept;
+    Lease& operator=(Lease&& other) noexcept;
+    ~Lease();
+
+    std::size_t index() const { return index_; }
+
+   private:
+    friend class BackendChannelPool;
+    Lease(BackendChannelPool* pool, std::size_t index)
+        : pool_{pool}, index_{index} {}
+
+    BackendChannelPool* pool_ = nullptr;
+    std::size_t index_ = 0;
+  };
+
+  /// `route` labels the pool's metrics.
+  ///
+  /// \throws std::invalid_argument if `size` is 0.
+  BackendChannelPool(const std::string& address,
+                     const std::shared_ptr<grpc::ChannelCredentials>& creds,
+                     std::size_t size, const std::string& route = "default");
+
+  BackendChannelPool(const BackendChannelPool&) = delete;
+  BackendChannelPool& operator=(const BackendChannelPool&) = delete;
+
+  /// Pick the channel with the fewest streams in flight for a new stream.
+  /// Ties are broken round robin. The pool has to outlive the lease.
+  Lease Acquire();
+
+  std::size_t size() const { return slots_.size(); }
+  const std::shared_ptr<grpc::Channel>& channel(std::size_t index) const {
+    return slots_[index]->channel;
+  }
+
+  /// Wait until every channel is connected, or `deadline` passes.
+  bool WaitForConnected(std::chrono::system_clock::time_point deadline);
+
+ private:
+  struct Slot {
+    std::shared_ptr<grpc::Channel> channel;
+    std::atomic<std::size_t> in_flight = 0;
+    Gauge* streams;
+  };
+
+  void Release(std::size_t index);
+
+  std::vector<std::unique_ptr<Slot>> slots_;
+  std::atomic<std::size_t> next_ = 0;
+};
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_BACKEND_POOL_H_
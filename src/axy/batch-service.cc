@@ -0,0 +1,370 @@
+#include "src/axy/batch-service.h"
+
+#include <fmt/chrono.h>
+#include <fmt/core.h>
+#include <fmt/ranges.h>
+#include <google/protobuf/util/time_util.h>
+#include <grpcpp/client_context.h>
+#include <grpcpp/server_context.h>
+#include <grpcpp/support/status.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "src/axy/audio.h"
+#include "src/axy/logging.h"
+#include "src/axy/metrics.h"
+#include "src/axy/priority.h"
+
+namespace axy {
+
+namespace {
+
+using google::protobuf::util::TimeUtil;
+using Clock = std::chrono::steady_clock;
+
+/// Audio per backend request, 0.5 s at 16 kHz.
+constexpr std::size_t kChunkSamples = 8000;
+
+struct Word {
+  std::chrono::microseconds start;
+  std::chrono::microseconds end;
+  std::string word;
+};
+
+/// Final results of one segment, with offsets relative to the segment.
+struct SegmentTranscript {
+  std::string transcript;
+  std::vector<Word> words;
+};
+
+std::chrono::microseconds FromDuration(const google::protobuf::Duration& d) {
+  return std::chrono::microseconds{TimeUtil::DurationToMicroseconds(d)};
+}
+
+google::protobuf::Duration ToDuration(std::chrono::microseconds d) {
+  return TimeUtil::MicrosecondsToDuration(d.count());
+}
+
+SegmentationOptions SegmentationFrom(
+    const speech::v1alpha::SegmentationConfig& config) {
+  SegmentationOptions opts;
+  if (config.has_max_segment_duration()) {
+    opts.max_segment = std::chrono::duration_cast<std::chrono::milliseconds>(
+        FromDuration(config.max_segment_duration()));
+  }
+  if (config.has_overlap()) {
+    opts.overlap = std::chrono::duration_cast<std::chrono::milliseconds>(
+        FromDuration(config.overlap()));
+  }
+  opts.split_on_silence = config.split_on_silence();
+  return opts;
+}
+
+std::string ReadFile(const std::filesystem::path& path) {
+  std::ifstream file{path, std::ios::binary};
+  if (!file) {
+    throw std::invalid_argument{
+        fmt::format("Could not open '{}'.", path.string())};
+  }
+  return {std::istreambuf_iterator<char>{file},
+          std::istreambuf_iterator<char>{}};
+}
+
+/// Resolves `relative` in `dir`, refusing paths that lead out of it.
+std::filesystem::path ResolveAudioPath(const std::string& dir,
+                                       const std::string& relative) {
+  const auto root = std::filesystem::weakly_canonical(dir);
+  const auto path = std::filesystem::weakly_canonical(root / relative);
+  const auto [root_end, _] =
+      std::mismatch(root.begin(), root.end(), path.begin(), path.end());
+  if (root_end != root.end()) {
+    throw std::invalid_argument{
+        fmt::format("'{}' is outside of the audio directory.", relative)};
+  }
+  return path;
+}
+
+/// Block until `admission` admits or rejects a stream.
+std::optional<AdmissionController::Ticket> AcquireBlocking(
+    AdmissionController& admission, PriorityClass priority) {
+  std::promise<std::optional<AdmissionController::Ticket>> promise;
+  auto ticket = promise.get_future();
+  admission.Acquire(
+      [&promise](std::optional<AdmissionController::Ticket> t) {
+        promise.set_value(std::move(t));
+      },
+      static_cast<std::size_t>(priority));
+  return ticket.get();
+}
+
+/** Keep each word in exactly one segment.
+ *
+ * Consecutive segments either meet or overlap. A word belongs to the segment
+ * whose half of the overlap it starts in.
+ */
+void Stitch(const PcmAudio& audio, const std::vector<AudioSegment>& segments,
+            const std::vector<SegmentTranscript>& transcripts,
+            speech::v1alpha::BatchRecognizeResponse& response) {
+  std::vector<std::string_view> parts;
+  bool have_words = false;
+  for (const auto& transcript : transcripts) {
+    have_words = have_words || !transcript.words.empty();
+  }
+
+  for (std::size_t i = 0; i < segments.size(); ++i) {
+    const auto offset = audio.Offset(segments[i].begin);
+    const auto lower =
+        i == 0 ? std::chrono::microseconds::min()
+               : audio.Offset((segments[i - 1].end + segments[i].begin) / 2);
+    const auto upper =
+        i + 1 == segments.size()
+            ? std::chrono::microseconds::max()
+            : audio.Offset((segments[i].end + segments[i + 1].begin) / 2);
+
+    auto* segment = response.add_segments();
+    *segment->mutable_start_time() = ToDuration(offset);
+    *segment->mutable_end_time() = ToDuration(audio.Offset(segments[i].end));
+    segment->set_transcript(transcripts[i].transcript);
+
+    if (!have_words) {
+      if (!transcripts[i].transcript.empty()) {
+        parts.push_back(transcripts[i].transcript);
+      }
+      continue;
+    }
+    for (const auto& word : transcripts[i].words) {
+      const auto start = offset + word.start;
+      if (start < lower || start >= upper) {
+        continue;
+      }
+      auto* out = response.add_words();
+      *out->mutable_start_time() = ToDuration(start);
+      *out->mutable_end_time() = ToDuration(offset + word.end);
+      out->set_word(word.word);
+      parts.push_back(word.word);
+    }
+  }
+
+  response.set_transcript(fmt::format("{}", fmt::join(parts, " ")));
+}
+
+/// Recognize one segment over its own backend stream.
+template <GoogleApiCompatibleTypes BackendTypes>
+grpc::Status RecognizeSegment(
+    typename BackendTypes::Speech::Stub& stub,
+    grpc::CallbackServerContext& context,
+    const std::map<std::string, std::string>& extra_headers,
+    const speech::v1alpha::BatchRecognizeRequest& request,
+    const PcmAudio& audio, AudioSegment segment,
+    SegmentTranscript& transcript) {
+  auto ctx = grpc::ClientContext::FromCallbackServerContext(context);
+  for (const auto& [key, val] : extra_headers) {
+    ctx->AddMetadata(key, val);
+  }
+  auto stream = stub.StreamingRecognize(ctx.get());
+
+  typename BackendTypes::StreamingRecognizeRequest req;
+  auto* config = req.mutable_streaming_config()->mutable_config();
+  config->set_encoding(BackendTypes::RecognitionConfig::LINEAR16);
+  config->set_sample_rate_hertz(audio.sample_rate_hertz);
+  config->set_language_code(request.language_code().empty()
+                                ? std::string{kDefaultLanguageCode}
+                                : request.language_code());
+  config->set_enable_automatic_punctuation(
+      request.enable_automatic_punctuation());
+  config->set_enable_word_time_offsets(true);
+  req.mutable_streaming_config()->set_interim_results(false);
+  bool ok = stream->Write(req);
+
+  for (auto pos = segment.begin; ok && pos < segment.end;
+       pos += kChunkSamples) {
+    const auto count = std::min(kChunkSamples, segment.end - pos);
+    req.Clear();
+    // LINEAR16 is little endian, like every platform we run on.
+    req.set_audio_content(
+        reinterpret_cast<const char*>(&audio.samples[pos]),
+        count * sizeof(std::int16_t));
+    ok = stream->Write(req);
+  }
+  if (ok) {
+    stream->WritesDone();
+  }
+
+  typename BackendTypes::StreamingRecognizeResponse resp;
+  while (stream->Read(&resp)) {
+    if (resp.has_error()) {
+      ctx->TryCancel();
+      stream->Finish();
+      return {static_cast<grpc::StatusCode>(resp.error().code()),
+              resp.error().message()};
+    }
+    for (const auto& result : resp.results()) {
+      if (!result.is_final() || result.alternatives_size() == 0) {
+        continue;
+      }
+      const auto& best = result.alternatives(0);
+      if (!best.transcript().empty()) {
+        if (!transcript.transcript.empty()) {
+          transcript.transcript += ' ';
+        }
+        transcript.transcript += best.transcript();
+      }
+      for (const auto& word : best.words()) {
+        transcript.words.push_back({.start = FromDuration(word.start_time()),
+                                    .end = FromDuration(word.end_time()),
+                                    .word = word.word()});
+      }
+    }
+  }
+  return stream->Finish();
+}
+
+}  // namespace
+
+template <GoogleApiCompatibleTypes BackendTypes>
+BatchSpeechServiceImpl<BackendTypes>::BatchSpeechServiceImpl(
+    std::shared_ptr<BackendChannelPool> backend,
+    std::shared_ptr<AdmissionController> admission, BatchServiceOptions opts,
+    std::map<std::string, std::string> extra_headers)
+    : backend_{std::move(backend)},
+      admission_{std::move(admission)},
+      opts_{std::move(opts)},
+      extra_headers_{std::move(extra_headers)} {
+  for (std::size_t i = 0; i < backend_->size(); ++i) {
+    stubs_.push_back(BackendTypes::Speech::NewStub(backend_->channel(i)));
+  }
+}
+
+template <GoogleApiCompatibleTypes BackendTypes>
+grpc::ServerUnaryReactor* BatchSpeechServiceImpl<BackendTypes>::BatchRecognize(
+    grpc::CallbackServerContext* context,
+    const speech::v1alpha::BatchRecognizeRequest* request,
+    speech::v1alpha::BatchRecognizeResponse* response) {
+  auto* reactor = context->DefaultReactor();
+  // The backend calls are blocking, so don't tie up a gRPC thread with them.
+  // Nothing may touch the call after Finish, so the thread is detached.
+  std::thread{[this, context, request, response, reactor]() {
+    reactor->Finish(Run(*context, *request, *response));
+  }}.detach();
+  return reactor;
+}
+
+template <GoogleApiCompatibleTypes BackendTypes>
+grpc::Status BatchSpeechServiceImpl<BackendTypes>::Run(
+    grpc::CallbackServerContext& context,
+    const speech::v1alpha::BatchRecognizeRequest& request,
+    speech::v1alpha::BatchRecognizeResponse& response) {
+  const auto started_at = Clock::now();
+
+  PcmAudio audio;
+  std::vector<AudioSegment> segments;
+  try {
+    if (request.has_path()) {
+      if (opts_.audio_dir.empty()) {
+        return {grpc::StatusCode::FAILED_PRECONDITION,
+                "This server doesn't read audio from files."};
+      }
+      audio = DecodeLinear16(
+          ReadFile(ResolveAudioPath(opts_.audio_dir, request.path())),
+          request.sample_rate_hertz());
+    } else {
+      audio = DecodeLinear16(request.content(), request.sample_rate_hertz());
+    }
+    segments = SplitAudio(audio, SegmentationFrom(request.segmentation()));
+  } catch (const std::invalid_argument& e) {
+    return {grpc::StatusCode::INVALID_ARGUMENT, e.what()};
+  }
+  if (segments.empty()) {
+    return {grpc::StatusCode::INVALID_ARGUMENT, "No audio."};
+  }
+
+  const auto parallelism = std::min(
+      {request.max_parallel_streams() > 0
+           ? static_cast<std::size_t>(request.max_parallel_streams())
+           : opts_.default_parallel_streams,
+       opts_.max_parallel_streams, segments.size()});
+
+  std::vector<SegmentTranscript> transcripts(segments.size());
+  std::atomic<std::size_t> next_segment = 0;
+  std::atomic<bool> failed = false;
+  std::mutex error_mtx;
+  grpc::Status error;
+  {
+    std::vector<std::jthread> workers;
+    for (std::size_t worker = 0; worker < parallelism; ++worker) {
+      workers.emplace_back([&]() {
+        while (!failed && !context.IsCancelled()) {
+          const auto i = next_segment.fetch_add(1);
+          if (i >= segments.size()) {
+            return;
+          }
+          auto status = [&]() -> grpc::Status {
+            auto ticket = AcquireBlocking(*admission_, PriorityClass::kBatch);
+            if (!ticket) {
+              return admission_->RejectionStatus();
+            }
+            const auto lease = backend_->Acquire();
+            return RecognizeSegment<BackendTypes>(
+                *stubs_[lease.index()], context, extra_headers_, request,
+                audio, segments[i], transcripts[i]);
+          }();
+          if (!status.ok()) {
+            std::lock_guard<std::mutex> lock{error_mtx};
+            if (!failed.exchange(true)) {
+              error = std::move(status);
+            }
+          }
+        }
+      });
+    }
+  }
+  if (context.IsCancelled()) {
+    return grpc::Status::CANCELLED;
+  }
+  if (failed) {
+    AXY_LOG_WARN("Batch recognition failed: {}", error.error_message());
+    return error;
+  }
+
+  Stitch(audio, segments, transcripts, response);
+  const auto elapsed = Clock::now() - started_at;
+  *response.mutable_audio_duration() = ToDuration(audio.duration());
+  *response.mutable_processing_time() = ToDuration(
+      std::chrono::duration_cast<std::chrono::microseconds>(elapsed));
+
+  static Counter& audio_seconds = MetricsRegistry::Global().GetCounter(
+      "axy_batch_audio_seconds_total",
+      "Seconds of audio transcribed by BatchRecognize.");
+  audio_seconds.Increment(
+      std::chrono::duration<double>(audio.duration()).count());
+
+  AXY_LOG_INFO(
+      "Transcribed {:%T} of audio in {} segments over {} streams in {} "
+      "({:.1f}x real time).",
+      std::chrono::duration_cast<std::chrono::seconds>(audio.duration()),
+      segments.size(), parallelism,
+      std::chrono::duration_cast<std::chrono::milliseconds>(elapsed),
+      std::chrono::duration<double>(audio.duration()) /
+          std::max(std::chrono::duration<double>(elapsed),
+                   std::chrono::duration<double>(1e-6)));
+  return grpc::Status::OK;
+}
+
+template class BatchSpeechServiceImpl<TiroSpeechTypes>;
+template class BatchSpeechServiceImpl<GoogleSpeechTypes>;
+
+}  // namespace axy
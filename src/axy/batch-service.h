@@ -0,0 +1,67 @@
+#ifndef AXY_SRC_AXY_BATCH_SERVICE_H_
+#define AXY_SRC_AXY_BATCH_SERVICE_H_
+
+#include <axy/speech/v1alpha/batch.grpc.pb.h>
+#include <axy/speech/v1alpha/batch.pb.h>
+#include <grpcpp/channel.h>
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/axy/admission.h"
+#include "src/axy/backend-pool.h"
+#include "src/axy/speech-service.h"
+
+namespace axy {
+
+using BatchSpeechService = axy::speech::v1alpha::BatchSpeech::CallbackService;
+
+struct BatchServiceOptions {
+  /// Backend streams per recording when the request doesn't say.
+  std::size_t default_parallel_streams = 4;
+  /// Upper limit on backend streams per recording.
+  std::size_t max_parallel_streams = 16;
+  /// Directory that `BatchRecognizeRequest.path` is relative to. Empty means
+  /// clients can only send audio in the request.
+  std::string audio_dir;
+};
+
+/** Transcribes complete recordings over several concurrent backend streams.
+ *
+ * Recordings are split into segments (see `SplitAudio`), each recognized in
+ * its own `StreamingRecognize` call to the backend. Every backend stream
+ * needs a slot from `admission` in the batch priority class, so batch work
+ * only uses capacity that live streams leave over.
+ */
+template <GoogleApiCompatibleTypes BackendTypes>
+class BatchSpeechServiceImpl final : public BatchSpeechService {
+ public:
+  BatchSpeechServiceImpl(
+      std::shared_ptr<BackendChannelPool> backend,
+      std::shared_ptr<AdmissionController> admission, BatchServiceOptions opts,
+      std::map<std::string, std::string> extra_headers = {});
+
+  grpc::ServerUnaryReactor* BatchRecognize(
+      grpc::CallbackServerContext* context,
+      const axy::speech::v1alpha::BatchRecognizeRequest* request,
+      axy::speech::v1alpha::BatchRecognizeResponse* response) override;
+
+ private:
+  grpc::Status Run(grpc::CallbackServerContext& context,
+                   const axy::speech::v1alpha::BatchRecognizeRequest& request,
+                   axy::speech::v1alpha::BatchRecognizeResponse& response);
+
+  const std::shared_ptr<BackendChannelPool> backend_;
+  /// One for each channel in `backend_`.
+  std::vector<std::unique_ptr<typename BackendTypes::Speech::Stub>> stubs_;
+  const std::shared_ptr<AdmissionController> admission_;
+  const BatchServiceOptions opts_;
+  const std::map<std::string, std::string> extra_headers_;
+};
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_BATCH_SERVICE_H_
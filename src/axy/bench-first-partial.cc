@@ -0,0 +1,207 @@
+// Compares the time to the first partial with and without warm backend
+// streams. Axy runs in this process in front of a mock backend that takes a
+// while to set up each stream, and short streams with the same config arrive
+// at a steady rate. Each mode first runs unmeasured streams, so the pool has
+// seen the arrival rate before it is measured.
+
+#include <fmt/chrono.h>
+#include <fmt/core.h>
+#include <grpcpp/client_context.h>
+#include <sdifi/speech/v1alpha/speech.grpc.pb.h>
+#include <unistd.h>
+
+#include <CLI/CLI.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "src/axy/logging.h"
+#include "src/axy/mock-backend.h"
+#include "src/axy/server.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+  std::size_t warmup_streams = 100;
+  std::size_t streams = 500;
+  /// Between the starts of consecutive streams.
+  std::chrono::milliseconds interval{20};
+  std::size_t chunks_per_stream = 5;
+  std::size_t chunk_bytes = 3200;
+};
+
+/// Run one stream, returning the time from sending its config until its
+/// first result, if it got one.
+std::optional<Clock::duration> RunStream(
+    sdifi::speech::v1alpha::SpeechService::Stub& stub, const BenchOptions& opts,
+    std::size_t stream_index) {
+  grpc::ClientContext context;
+  auto stream = stub.StreamingRecognize(&context);
+
+  sdifi::speech::v1alpha::StreamingRecognizeRequest req;
+  auto* streaming_config = req.mutable_streaming_config();
+  streaming_config->set_conversation(
+      fmt::format("bench-{}-{}", ::getpid(), stream_index));
+  streaming_config->set_interim_results(true);
+  streaming_config->mutable_config()->set_sample_rate_hertz(16000);
+  const auto start = Clock::now();
+  if (!stream->Write(req)) {
+    AXY_LOG_ERROR("Could not start stream {}.", stream_index);
+    return std::nullopt;
+  }
+
+  std::optional<Clock::duration> first_result;
+  req.Clear();
+  req.set_audio_content(std::string(opts.chunk_bytes, '\0'));
+  sdifi::speech::v1alpha::StreamingRecognizeResponse res;
+  for (std::size_t i = 0; i < opts.chunks_per_stream; ++i) {
+    if (!stream->Write(req) || !stream->Read(&res)) {
+      break;
+    }
+    if (!first_result && res.results_size() > 0) {
+      first_result = Clock::now() - start;
+    }
+  }
+
+  stream->WritesDone();
+  while (stream->Read(&res)) {
+  }
+  if (const auto status = stream->Finish(); !status.ok()) {
+    AXY_LOG_ERROR("Stream {} failed: {}", stream_index,
+                  status.error_message());
+    return std::nullopt;
+  }
+  return first_result;
+}
+
+/// Start `count` streams `opts.interval` apart, returning the times to their
+/// first results.
+std::vector<Clock::duration> RunStreams(
+    sdifi::speech::v1alpha::SpeechService::Stub& stub, const BenchOptions& opts,
+    std::size_t first_index, std::size_t count) {
+  std::vector<Clock::duration> samples;
+  std::mutex mtx;
+  std::vector<std::jthread> threads;
+  auto next_start = Clock::now();
+  for (std::size_t i = 0; i < count; ++i) {
+    std::this_thread::sleep_until(next_start);
+    next_start += opts.interval;
+    threads.emplace_back([&, index = first_index + i]() {
+      if (const auto sample = RunStream(stub, opts, index)) {
+        std::lock_guard<std::mutex> lock{mtx};
+        samples.push_back(*sample);
+      }
+    });
+  }
+  threads.clear();
+  return samples;
+}
+
+void Report(const std::string& mode, std::vector<Clock::duration> samples) {
+  if (samples.empty()) {
+    fmt::print("{:<6} no streams got a result\n", mode);
+    return;
+  }
+  std::sort(samples.begin(), samples.end());
+  const auto percentile = [&samples](double p) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        samples[static_cast<std::size_t>(p * (samples.size() - 1))]);
+  };
+  fmt::print("{:<6} {:>10} {:>10} {:>10} {:>10}\n", mode, samples.size(),
+             percentile(0.5), percentile(0.9), percentile(0.99));
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  try {
+    CLI::App app{"Compares the time to the first partial with and without "
+                 "warm backend streams"};
+    app.option_defaults()->always_capture_default();
+
+    BenchOptions opts;
+    app.add_option("--warmup-streams", opts.warmup_streams,
+                   "Unmeasured streams before the measured ones.");
+    app.add_option("--streams", opts.streams, "Measured streams.")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--interval-ms", opts.interval,
+                   "Time between the starts of consecutive streams.");
+    app.add_option("--chunks-per-stream", opts.chunks_per_stream,
+                   "Audio chunks sent on each stream.")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--chunk-bytes", opts.chunk_bytes,
+                   "Size of each audio chunk, 3200 bytes is 100 ms of 16 kHz "
+                   "LINEAR16.");
+    std::chrono::milliseconds setup_time{50};
+    app.add_option("--backend-setup-ms", setup_time,
+                   "How long the mock backend takes to set up a stream after "
+                   "its config.");
+
+    axy::Server::Options server_opts;
+    server_opts.listen_address = "localhost:50171";
+    server_opts.backend_speech_server_address = "localhost:50172";
+    server_opts.backend_speech_server_use_tls = false;
+    server_opts.warm_streams_per_profile = 8;
+    server_opts.warm_stream_max_idle = std::chrono::milliseconds{2000};
+    app.add_option("--listen-address", server_opts.listen_address);
+    app.add_option("--backend-address",
+                   server_opts.backend_speech_server_address,
+                   "Address for the mock backend.");
+    app.add_option("--redis-address", server_opts.redis_addresses,
+                   "Events are written here. Without Redis they are "
+                   "dropped with a warning each.");
+    app.add_option("--warm-streams-per-profile",
+                   server_opts.warm_streams_per_profile,
+                   "Most warm streams in the warm run.")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--warm-stream-max-idle-ms",
+                   server_opts.warm_stream_max_idle)
+        ->check(CLI::PositiveNumber);
+
+    std::string log_level = "warn";
+    app.add_option("--log-level", log_level);
+
+    CLI11_PARSE(app, argc, argv);
+
+    axy::InitLogging({});
+    axy::SetLogLevel(log_level);
+    axy::RegisterLibraryLogHandlers();
+
+    axy::MockSpeechBackend backend{server_opts.backend_speech_server_address,
+                                   std::chrono::microseconds{0}, setup_time};
+
+    fmt::print("{} streams {} apart, backend setup {}\n\n", opts.streams,
+               opts.interval, setup_time);
+    fmt::print("{:<6} {:>10} {:>10} {:>10} {:>10}\n", "mode", "streams",
+               "p50", "p90", "p99");
+
+    for (const bool warm : {false, true}) {
+      auto mode_opts = server_opts;
+      if (!warm) {
+        mode_opts.warm_streams_per_profile = 0;
+      }
+      axy::Server server{mode_opts};
+      auto stub = sdifi::speech::v1alpha::SpeechService::NewStub(
+          server.InProcessChannel());
+      RunStreams(*stub, opts, 0, opts.warmup_streams);
+      Report(warm ? "warm" : "cold",
+             RunStreams(*stub, opts, opts.warmup_streams, opts.streams));
+      server.Shutdown();
+    }
+  } catch (const std::exception& e) {
+    AXY_LOG_ERROR(e.what());
+    axy::ShutdownLogging();
+    return EXIT_FAILURE;
+  }
+
+  axy::ShutdownLogging();
+  return EXIT_SUCCESS;
+}
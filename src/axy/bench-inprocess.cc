@@ -0,0 +1,201 @@
+// Compares the cost of calling Axy over loopback TCP, a Unix domain socket and
+// an in-process channel. Axy runs in this process in front of a mock backend,
+// and each stream sends audio chunks one at a time, waiting for the interim
+// result of each chunk before sending the next.
+
+#include <fmt/chrono.h>
+#include <fmt/core.h>
+#include <grpcpp/client_context.h>
+#include <grpcpp/create_channel.h>
+#include <grpcpp/security/credentials.h>
+#include <sdifi/speech/v1alpha/speech.grpc.pb.h>
+#include <unistd.h>
+
+#include <CLI/CLI.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "src/axy/logging.h"
+#include "src/axy/mock-backend.h"
+#include "src/axy/server.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+  std::size_t streams = 8;
+  std::size_t chunks_per_stream = 500;
+  std::size_t chunk_bytes = 3200;
+};
+
+struct Result {
+  std::vector<Clock::duration> round_trips;
+  Clock::duration elapsed{};
+};
+
+/// Send `opts.chunks_per_stream` chunks on one stream, timing each round trip.
+std::vector<Clock::duration> RunStream(
+    sdifi::speech::v1alpha::SpeechService::Stub& stub, const BenchOptions& opts,
+    std::size_t stream_index) {
+  std::vector<Clock::duration> round_trips;
+  round_trips.reserve(opts.chunks_per_stream);
+
+  grpc::ClientContext context;
+  auto stream = stub.StreamingRecognize(&context);
+
+  sdifi::speech::v1alpha::StreamingRecognizeRequest req;
+  auto* streaming_config = req.mutable_streaming_config();
+  streaming_config->set_conversation(
+      fmt::format("bench-{}-{}", ::getpid(), stream_index));
+  streaming_config->set_interim_results(true);
+  streaming_config->mutable_config()->set_sample_rate_hertz(16000);
+  if (!stream->Write(req)) {
+    AXY_LOG_ERROR("Could not start stream {}.", stream_index);
+    return round_trips;
+  }
+
+  req.Clear();
+  req.set_audio_content(std::string(opts.chunk_bytes, '\0'));
+  sdifi::speech::v1alpha::StreamingRecognizeResponse res;
+  for (std::size_t i = 0; i < opts.chunks_per_stream; ++i) {
+    const auto start = Clock::now();
+    if (!stream->Write(req) || !stream->Read(&res)) {
+      break;
+    }
+    round_trips.push_back(Clock::now() - start);
+  }
+
+  stream->WritesDone();
+  while (stream->Read(&res)) {
+  }
+  if (const auto status = stream->Finish(); !status.ok()) {
+    AXY_LOG_ERROR("Stream {} failed: {}", stream_index,
+                  status.error_message());
+  }
+  return round_trips;
+}
+
+Result RunTransport(const std::shared_ptr<grpc::Channel>& channel,
+                    const BenchOptions& opts) {
+  auto stub = sdifi::speech::v1alpha::SpeechService::NewStub(channel);
+  Result result;
+  std::mutex mtx;
+
+  const auto start = Clock::now();
+  {
+    std::vector<std::jthread> threads;
+    for (std::size_t i = 0; i < opts.streams; ++i) {
+      threads.emplace_back([&, i]() {
+        auto round_trips = RunStream(*stub, opts, i);
+        std::lock_guard<std::mutex> lock{mtx};
+        result.round_trips.insert(result.round_trips.end(),
+                                  round_trips.begin(), round_trips.end());
+      });
+    }
+  }
+  result.elapsed = Clock::now() - start;
+  return result;
+}
+
+void Report(const std::string& transport, Result result) {
+  auto& samples = result.round_trips;
+  if (samples.empty()) {
+    fmt::print("{:<12} no completed round trips\n", transport);
+    return;
+  }
+  std::sort(samples.begin(), samples.end());
+  const auto percentile = [&samples](double p) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        samples[static_cast<std::size_t>(p * (samples.size() - 1))]);
+  };
+  const auto seconds = std::chrono::duration<double>(result.elapsed).count();
+  fmt::print("{:<12} {:>10.0f} {:>10} {:>10} {:>10}\n", transport,
+             static_cast<double>(samples.size()) / seconds, percentile(0.5),
+             percentile(0.99), percentile(1.0));
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  try {
+    CLI::App app{"Compares loopback TCP, Unix socket and in-process calls to "
+                 "Axy"};
+    app.option_defaults()->always_capture_default();
+
+    BenchOptions opts;
+    app.add_option("--streams", opts.streams, "Concurrent streams.")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--chunks-per-stream", opts.chunks_per_stream,
+                   "Audio chunks sent on each stream.")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--chunk-bytes", opts.chunk_bytes,
+                   "Size of each audio chunk, 3200 bytes is 100 ms of 16 kHz "
+                   "LINEAR16.");
+
+    axy::Server::Options server_opts;
+    server_opts.listen_address = "localhost:50161";
+    server_opts.unix_socket_path =
+        fmt::format("/tmp/axy-bench-{}.sock", ::getpid());
+    server_opts.backend_speech_server_address = "localhost:50162";
+    server_opts.backend_speech_server_use_tls = false;
+    app.add_option("--listen-address", server_opts.listen_address);
+    app.add_option("--unix-socket", server_opts.unix_socket_path);
+    app.add_option("--backend-address",
+                   server_opts.backend_speech_server_address,
+                   "Address for the mock backend.");
+    app.add_option("--redis-address", server_opts.redis_addresses,
+                   "Events are written here. Without Redis they are "
+                   "dropped with a warning each.");
+
+    std::string log_level = "warn";
+    app.add_option("--log-level", log_level);
+
+    CLI11_PARSE(app, argc, argv);
+
+    axy::InitLogging({});
+    axy::SetLogLevel(log_level);
+    axy::RegisterLibraryLogHandlers();
+
+    axy::MockSpeechBackend backend{server_opts.backend_speech_server_address};
+    axy::Server server{server_opts};
+
+    fmt::print("{} streams x {} chunks of {} bytes\n\n", opts.streams,
+               opts.chunks_per_stream, opts.chunk_bytes);
+    fmt::print("{:<12} {:>10} {:>10} {:>10} {:>10}\n", "transport",
+               "chunks/s", "p50", "p99", "max");
+
+    const auto insecure = grpc::InsecureChannelCredentials();
+    const std::vector<std::pair<std::string, std::shared_ptr<grpc::Channel>>>
+        transports{
+            {"tcp", grpc::CreateChannel(server_opts.listen_address, insecure)},
+            {"unix", grpc::CreateChannel("unix:" + server_opts.unix_socket_path,
+                                         insecure)},
+            {"in-process", server.InProcessChannel()},
+        };
+    for (const auto& [name, channel] : transports) {
+      // Warm up, so connection setup isn't part of the numbers.
+      RunTransport(channel, {.streams = 1, .chunks_per_stream = 10,
+                             .chunk_bytes = opts.chunk_bytes});
+      Report(name, RunTransport(channel, opts));
+    }
+
+    server.Shutdown();
+    ::unlink(server_opts.unix_socket_path.c_str());
+  } catch (const std::exception& e) {
+    AXY_LOG_ERROR(e.what());
+    axy::ShutdownLogging();
+    return EXIT_FAILURE;
+  }
+
+  axy::ShutdownLogging();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,301 @@
+// Runs Axy in this process in front of a mock backend for hours, churning
+// through short and long conversations, and reports how memory develops: how
+// much each concurrent stream costs, whether memory keeps growing with the
+// number of finished streams, and whether any reactors outlive their streams.
+// Events go to Redis, so use a local one.
+
+#include <fmt/chrono.h>
+#include <fmt/core.h>
+#include <grpcpp/client_context.h>
+#include <sdifi/events/v1alpha/event.grpc.pb.h>
+#include <sdifi/speech/v1alpha/speech.grpc.pb.h>
+#include <unistd.h>
+
+#include <CLI/CLI.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "src/axy/logging.h"
+#include "src/axy/memory-accounting.h"
+#include "src/axy/mock-backend.h"
+#include "src/axy/server.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::array kAccounts{"server_reactor", "client_reactor",
+                               "watch_writer"};
+
+struct SoakOptions {
+  std::chrono::minutes duration{60};
+  std::chrono::seconds report_interval{60};
+  std::size_t chunk_bytes = 3200;
+  /// Concurrent short conversations, each sent as fast as possible.
+  std::size_t short_streams = 32;
+  std::size_t short_chunks = 20;
+  /// Concurrent long conversations, each sent in real time and watched.
+  std::size_t long_streams = 4;
+  std::size_t long_chunks = 3000;
+  std::chrono::milliseconds chunk_interval{100};
+};
+
+struct Counts {
+  std::atomic<std::uint64_t> finished = 0;
+  std::atomic<std::uint64_t> failed = 0;
+};
+
+/// Run one conversation of `chunks` chunks, `interval` apart.
+void RunConversation(sdifi::speech::v1alpha::SpeechService::Stub& stub,
+                     const std::string& conversation_id, std::size_t chunks,
+                     std::size_t chunk_bytes,
+                     std::chrono::milliseconds interval, Counts& counts) {
+  grpc::ClientContext context;
+  auto stream = stub.StreamingRecognize(&context);
+
+  sdifi::speech::v1alpha::StreamingRecognizeRequest req;
+  auto* streaming_config = req.mutable_streaming_config();
+  streaming_config->set_conversation(conversation_id);
+  streaming_config->set_interim_results(true);
+  streaming_config->mutable_config()->set_sample_rate_hertz(16000);
+  bool ok = stream->Write(req);
+
+  req.Clear();
+  req.set_audio_content(std::string(chunk_bytes, '\0'));
+  sdifi::speech::v1alpha::StreamingRecognizeResponse res;
+  for (std::size_t i = 0; ok && i < chunks; ++i) {
+    ok = stream->Write(req) && stream->Read(&res);
+    if (interval.count() > 0) {
+      std::this_thread::sleep_for(interval);
+    }
+  }
+
+  stream->WritesDone();
+  while (stream->Read(&res)) {
+  }
+  if (const auto status = stream->Finish(); !ok || !status.ok()) {
+    AXY_LOG_WARN("{} failed: {}", conversation_id, status.error_message());
+    ++counts.failed;
+  } else {
+    ++counts.finished;
+  }
+}
+
+/// Watch the events of `conversation_id` until `context` is cancelled.
+void WatchConversation(sdifi::events::v1alpha::EventService::Stub& stub,
+                       grpc::ClientContext& context,
+                       const std::string& conversation_id) {
+  sdifi::events::v1alpha::WatchRequest req;
+  req.set_conversation_id(conversation_id);
+  auto reader = stub.Watch(&context, req);
+  sdifi::events::v1alpha::WatchResponse res;
+  while (reader->Read(&res)) {
+  }
+  reader->Finish();
+}
+
+struct Sample {
+  double streams;
+  double heap_bytes;
+};
+
+/// Least squares slope of heap bytes over finished streams.
+double Slope(const std::vector<Sample>& samples) {
+  if (samples.size() < 2) {
+    return 0;
+  }
+  double mean_x = 0;
+  double mean_y = 0;
+  for (const auto& s : samples) {
+    mean_x += s.streams;
+    mean_y += s.heap_bytes;
+  }
+  mean_x /= static_cast<double>(samples.size());
+  mean_y /= static_cast<double>(samples.size());
+  double covariance = 0;
+  double variance = 0;
+  for (const auto& s : samples) {
+    covariance += (s.streams - mean_x) * (s.heap_bytes - mean_y);
+    variance += (s.streams - mean_x) * (s.streams - mean_x);
+  }
+  return variance == 0 ? 0 : covariance / variance;
+}
+
+double MiB(std::uint64_t bytes) {
+  return static_cast<double>(bytes) / (1 << 20);
+}
+
+void PrintRow(Clock::duration elapsed, std::uint64_t streams,
+              std::uint64_t failed, const axy::ProcessMemory& memory) {
+  fmt::print("{:>8} {:>10} {:>7} {:>9.1f} {:>9.1f}",
+             std::chrono::duration_cast<std::chrono::seconds>(elapsed),
+             streams, failed, MiB(memory.resident_bytes),
+             MiB(memory.heap_bytes));
+  for (const auto* kind : kAccounts) {
+    const auto& account = axy::MemoryAccount::For(kind);
+    fmt::print(" {:>8.0f}/{:<8.0f}", account.objects(), account.bytes());
+  }
+  fmt::print("\n");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  try {
+    CLI::App app{"Churns through conversations against a mock backend and "
+                 "reports memory per stream and leak trends"};
+    app.option_defaults()->always_capture_default();
+
+    SoakOptions opts;
+    app.add_option("--duration-minutes", opts.duration)
+        ->check(CLI::PositiveNumber);
+    app.add_option("--report-interval-s", opts.report_interval)
+        ->check(CLI::PositiveNumber);
+    app.add_option("--chunk-bytes", opts.chunk_bytes);
+    app.add_option("--short-streams", opts.short_streams,
+                   "Concurrent short conversations, sent as fast as "
+                   "possible.");
+    app.add_option("--short-chunks", opts.short_chunks);
+    app.add_option("--long-streams", opts.long_streams,
+                   "Concurrent long conversations, sent in real time and "
+                   "watched.");
+    app.add_option("--long-chunks", opts.long_chunks);
+    app.add_option("--chunk-interval-ms", opts.chunk_interval,
+                   "Time between chunks of long conversations.");
+
+    axy::Server::Options server_opts;
+    // Only the in-process channel is used.
+    server_opts.listen_address = "";
+    server_opts.backend_speech_server_address = "localhost:50163";
+    server_opts.backend_speech_server_use_tls = false;
+    app.add_option("--backend-address",
+                   server_opts.backend_speech_server_address,
+                   "Address for the mock backend.");
+    app.add_option("--redis-address", server_opts.redis_addresses,
+                   "Events are written here and watched from here.");
+    app.add_option("--admin-address", server_opts.admin_address,
+                   "Serve metrics and profiles here while soaking.");
+
+    std::string log_level = "warn";
+    app.add_option("--log-level", log_level);
+
+    CLI11_PARSE(app, argc, argv);
+
+    axy::InitLogging({});
+    axy::SetLogLevel(log_level);
+    axy::RegisterLibraryLogHandlers();
+
+    axy::MockSpeechBackend backend{server_opts.backend_speech_server_address};
+    axy::Server server{server_opts};
+    const auto channel = server.InProcessChannel();
+    auto speech = sdifi::speech::v1alpha::SpeechService::NewStub(channel);
+    auto events = sdifi::events::v1alpha::EventService::NewStub(channel);
+
+    fmt::print("{} short streams x {} chunks, {} long streams x {} chunks "
+               "every {}, for {}\n\n",
+               opts.short_streams, opts.short_chunks, opts.long_streams,
+               opts.long_chunks, opts.chunk_interval, opts.duration);
+    fmt::print("{:>8} {:>10} {:>7} {:>9} {:>9}", "elapsed", "streams",
+               "failed", "rss MiB", "heap MiB");
+    for (const auto* kind : kAccounts) {
+      fmt::print(" {:>17}", fmt::format("{} objs/bytes", kind));
+    }
+    fmt::print("\n");
+
+    const auto baseline = axy::ReadProcessMemory();
+    const auto start = Clock::now();
+    const auto deadline = start + opts.duration;
+    Counts short_counts;
+    Counts long_counts;
+    std::atomic<std::uint64_t> next_id = 0;
+    const auto conversation_id = [&](std::string_view kind) {
+      return fmt::format("soak-{}-{}-{}", ::getpid(), kind, next_id++);
+    };
+
+    {
+      std::vector<std::jthread> workers;
+      for (std::size_t i = 0; i < opts.short_streams; ++i) {
+        workers.emplace_back([&] {
+          while (Clock::now() < deadline) {
+            RunConversation(*speech, conversation_id("short"),
+                            opts.short_chunks, opts.chunk_bytes, {},
+                            short_counts);
+          }
+        });
+      }
+      for (std::size_t i = 0; i < opts.long_streams; ++i) {
+        workers.emplace_back([&] {
+          while (Clock::now() < deadline) {
+            const auto id = conversation_id("long");
+            grpc::ClientContext watch_context;
+            std::jthread watcher{
+                [&] { WatchConversation(*events, watch_context, id); }};
+            RunConversation(*speech, id, opts.long_chunks, opts.chunk_bytes,
+                            opts.chunk_interval, long_counts);
+            watch_context.TryCancel();
+          }
+        });
+      }
+
+      // The first interval is warm-up, e.g. for connection pools and arenas.
+      std::vector<Sample> samples;
+      while (Clock::now() < deadline) {
+        std::this_thread::sleep_until(
+            std::min(deadline, Clock::now() + opts.report_interval));
+        const auto memory = axy::ReadProcessMemory();
+        const auto finished = short_counts.finished + long_counts.finished;
+        PrintRow(Clock::now() - start, finished,
+                 short_counts.failed + long_counts.failed, memory);
+        if (Clock::now() - start > opts.report_interval) {
+          samples.push_back({.streams = static_cast<double>(finished),
+                             .heap_bytes =
+                                 static_cast<double>(memory.heap_bytes)});
+        }
+      }
+
+      const auto concurrent = opts.short_streams + opts.long_streams;
+      const auto loaded = axy::ReadProcessMemory();
+      fmt::print("\nheap per concurrent stream: {:.1f} KiB\n",
+                 (static_cast<double>(loaded.heap_bytes) -
+                  static_cast<double>(baseline.heap_bytes)) /
+                     static_cast<double>(concurrent) / 1024);
+      fmt::print("heap growth per 1000 finished streams: {:.1f} KiB\n",
+                 Slope(samples) * 1000 / 1024);
+    }
+
+    // Give reactors a moment to be deleted after their last callback.
+    std::this_thread::sleep_for(std::chrono::seconds{1});
+    const auto drained = axy::ReadProcessMemory();
+    fmt::print("after draining:\n");
+    PrintRow(Clock::now() - start,
+             short_counts.finished + long_counts.finished,
+             short_counts.failed + long_counts.failed, drained);
+    bool leaked = false;
+    for (const auto* kind : kAccounts) {
+      const auto& account = axy::MemoryAccount::For(kind);
+      if (account.objects() != 0 || account.bytes() != 0) {
+        fmt::print("{}: {:.0f} objects holding {:.0f} bytes still alive\n",
+                   kind, account.objects(), account.bytes());
+        leaked = true;
+      }
+    }
+
+    server.Shutdown();
+    axy::ShutdownLogging();
+    return leaked ? EXIT_FAILURE : EXIT_SUCCESS;
+  } catch (const std::exception& e) {
+    AXY_LOG_ERROR(e.what());
+    axy::ShutdownLogging();
+    return EXIT_FAILURE;
+  }
+}
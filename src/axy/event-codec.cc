@@ -0,0 +1,323 @@
+#include "src/axy/event-codec.h"
+
+#include <sdifi/events/v1alpha/event.pb.h>
+
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#include "src/axy/logging.h"
+
+namespace axy {
+
+namespace {
+
+using sdifi::events::v1alpha::Event;
+
+constexpr auto kTypeKey = ":type";
+constexpr auto kContentKey = ":content";
+constexpr auto kChannelKey = ":channel";
+constexpr auto kProvisionalKey = ":provisional";
+constexpr auto kCorrectionKey = ":correction";
+constexpr auto kTypeCodeKey = ":t";
+constexpr auto kCompactContentKey = ":c";
+constexpr auto kCreatedAtKey = ":at";
+constexpr auto kPrefixKey = ":p";
+constexpr auto kKeyframeKey = ":k";
+constexpr auto kIdKey = ":id";
+
+/// The encoder starts over when it follows more chains than this, e.g.
+/// because many streams ended in the middle of an utterance.
+constexpr std::size_t kMaxChains = 4096;
+/// A decoder forgets the oldest chain when it follows more than this. Only
+/// chains of concurrent writers are still needed, the others ended with a
+/// final or a new keyframe.
+constexpr std::size_t kMaxDecodedChains = 64;
+
+struct TypeCode {
+  std::string_view code;
+  std::string type;
+};
+
+const std::array<TypeCode, 3>& TypeCodes() {
+  static const std::array<TypeCode, 3> codes{{
+      {"p", sdifi::events::v1alpha::SpeechPartial::descriptor()->full_name()},
+      {"f", sdifi::events::v1alpha::SpeechFinal::descriptor()->full_name()},
+      {"c", sdifi::events::v1alpha::SpeechContent::descriptor()->full_name()},
+  }};
+  return codes;
+}
+
+std::optional<std::string_view> CodeOf(std::string_view type) {
+  for (const auto& [code, full_name] : TypeCodes()) {
+    if (full_name == type) {
+      return code;
+    }
+  }
+  return std::nullopt;
+}
+
+const std::string* TypeOfCode(std::string_view code) {
+  for (const auto& [type_code, full_name] : TypeCodes()) {
+    if (type_code == code) {
+      return &full_name;
+    }
+  }
+  return nullptr;
+}
+
+template <typename T>
+std::optional<T> ParseNumber(std::string_view s) {
+  T value{};
+  const auto* end = s.data() + s.size();
+  if (std::from_chars(s.data(), end, value).ptr != end || s.empty()) {
+    return std::nullopt;
+  }
+  return value;
+}
+
+std::optional<std::size_t> ChannelOf(const StreamAttrs& attrs) {
+  if (const auto it = attrs.find(kChannelKey); it != attrs.cend()) {
+    return ParseNumber<std::size_t>(it->second);
+  }
+  return std::nullopt;
+}
+
+/// Length of the prefix `a` and `b` share, not splitting UTF-8 characters,
+/// since the rest has to be a valid string on its own.
+std::size_t SharedPrefix(std::string_view a, std::string_view b) {
+  std::size_t n = 0;
+  while (n < a.size() && n < b.size() && a[n] == b[n]) {
+    ++n;
+  }
+  while (n > 0 && n < b.size() &&
+         (static_cast<unsigned char>(b[n]) & 0xC0) == 0x80) {
+    --n;
+  }
+  return n;
+}
+
+void AddFlags(const ConversationEvent& event, EventEncoder::Attrs& attrs) {
+  if (event.channel) {
+    attrs.emplace_back(kChannelKey, std::to_string(*event.channel));
+  }
+  if (event.provisional) {
+    attrs.emplace_back(kProvisionalKey, "1");
+  }
+  if (event.correction) {
+    attrs.emplace_back(kCorrectionKey, "1");
+  }
+}
+
+}  // namespace
+
+EventEncoder::Attrs EventEncoder::EncodeFull(const ConversationEvent& event,
+                                             bool keep_id) {
+  Drop(event);
+  Attrs attrs{{kTypeKey, event.type},
+              {kContentKey, event.event->SerializeAsString()}};
+  AddFlags(event, attrs);
+  if (keep_id) {
+    attrs.emplace_back(kIdKey, event.id.ToString());
+  }
+  return attrs;
+}
+
+void EventEncoder::Drop(const ConversationEvent& event) {
+  chains_.erase({event.conversation_id, event.channel});
+}
+
+EventEncoder::Attrs EventEncoder::Encode(const ConversationEvent& event) {
+  const auto code = CodeOf(event.type);
+  if (!compact_ || !code ||
+      event.event->metadata().conversation().name() != event.conversation_id) {
+    return EncodeFull(event);
+  }
+
+  Event compact = *event.event;
+  auto* metadata = compact.mutable_metadata();
+  metadata->clear_conversation();
+  Attrs attrs{{kTypeCodeKey, std::string{*code}}};
+  // Timestamps usually have microsecond precision, finer ones are kept.
+  if (metadata->has_created_at() &&
+      metadata->created_at().nanos() % 1000 == 0) {
+    const auto& created_at = metadata->created_at();
+    const auto micros = created_at.seconds() * 1'000'000 +
+                        created_at.nanos() / 1000 -
+                        static_cast<std::int64_t>(event.id.ms) * 1000;
+    attrs.emplace_back(kCreatedAtKey, std::to_string(micros));
+    metadata->clear_created_at();
+  }
+  if (metadata->ByteSizeLong() == 0) {
+    compact.clear_metadata();
+  }
+
+  const ChainKey key{event.conversation_id, event.channel};
+  if (compact.has_speech_partial() &&
+      !compact.speech_partial().transcript().empty()) {
+    if (chains_.size() >= kMaxChains && !chains_.contains(key)) {
+      chains_.clear();
+    }
+    auto& chain = chains_[key];
+    auto* partial = compact.mutable_speech_partial();
+    const auto prefix = chain.length == 0 || chain.length >= kKeyframeInterval
+                            ? 0
+                            : SharedPrefix(chain.transcript,
+                                           partial->transcript());
+    chain.transcript = partial->transcript();
+    if (prefix == 0) {
+      chain.keyframe_id = event.id.ToString();
+      chain.length = 0;
+    } else {
+      partial->mutable_transcript()->erase(0, prefix);
+      attrs.emplace_back(kPrefixKey, std::to_string(prefix));
+      attrs.emplace_back(kKeyframeKey, chain.keyframe_id);
+    }
+    ++chain.length;
+  } else if (compact.has_speech_final()) {
+    chains_.erase(key);
+  }
+
+  attrs.emplace_back(kCompactContentKey, compact.SerializeAsString());
+  AddFlags(event, attrs);
+  return attrs;
+}
+
+EventDecoder::EventDecoder(std::string conversation_id, RangeReader read_range)
+    : conversation_id_{std::move(conversation_id)},
+      read_range_{std::move(read_range)} {}
+
+std::string EventDecoder::TypeOf(const StreamAttrs& attrs) {
+  if (const auto it = attrs.find(kTypeKey); it != attrs.cend()) {
+    return it->second;
+  }
+  if (const auto it = attrs.find(kTypeCodeKey); it != attrs.cend()) {
+    if (const auto* type = TypeOfCode(it->second)) {
+      return *type;
+    }
+  }
+  return "";
+}
+
+std::optional<StreamId> EventDecoder::IdOf(const std::string& id,
+                                           const StreamAttrs& attrs) {
+  if (const auto it = attrs.find(kIdKey); it != attrs.cend()) {
+    return StreamId::Parse(it->second);
+  }
+  return StreamId::Parse(id);
+}
+
+std::optional<ConversationEvent> EventDecoder::Decode(
+    const std::string& id, const StreamAttrs& attrs) {
+  return Decode(id, attrs, true);
+}
+
+void EventDecoder::AddChain(const std::string& id, std::string transcript) {
+  if (!chains_.insert_or_assign(id, std::move(transcript)).second) {
+    return;
+  }
+  chain_order_.push_back(id);
+  if (chain_order_.size() > kMaxDecodedChains) {
+    chains_.erase(chain_order_.front());
+    chain_order_.pop_front();
+  }
+}
+
+std::optional<ConversationEvent> EventDecoder::Decode(const std::string& id,
+                                                      const StreamAttrs& attrs,
+                                                      bool may_read) {
+  const auto stream_id = StreamId::Parse(id);
+  ConversationEvent decoded{
+      .conversation_id = conversation_id_,
+      .id = stream_id.value_or(StreamId{}),
+      .type = TypeOf(attrs),
+      .channel = ChannelOf(attrs),
+      .provisional = attrs.contains(kProvisionalKey),
+      .correction = attrs.contains(kCorrectionKey),
+  };
+  if (decoded.type.empty()) {
+    return std::nullopt;
+  }
+
+  auto event = std::make_shared<Event>();
+  auto content_it = attrs.find(kContentKey);
+  const bool compact = content_it == attrs.cend();
+  if (compact) {
+    content_it = attrs.find(kCompactContentKey);
+  }
+  if (content_it == attrs.cend() ||
+      !event->ParseFromString(content_it->second)) {
+    AXY_LOG_WARN("Couldn't parse serialized event {} of conversation '{}'.",
+                 id, conversation_id_);
+    return std::nullopt;
+  }
+  if (!compact) {
+    decoded.event = std::move(event);
+    return decoded;
+  }
+
+  auto* metadata = event->mutable_metadata();
+  metadata->mutable_conversation()->set_name(conversation_id_);
+  if (const auto it = attrs.find(kCreatedAtKey);
+      it != attrs.cend() && stream_id) {
+    if (const auto offset = ParseNumber<std::int64_t>(it->second)) {
+      const auto micros =
+          static_cast<std::int64_t>(stream_id->ms) * 1000 + *offset;
+      metadata->mutable_created_at()->set_seconds(micros / 1'000'000);
+      metadata->mutable_created_at()->set_nanos(
+          static_cast<std::int32_t>(micros % 1'000'000) * 1000);
+    }
+  }
+
+  // A delta may have nothing left of the transcript, if it got shorter.
+  const auto prefix_it = attrs.find(kPrefixKey);
+  if (event->has_speech_partial() &&
+      (prefix_it != attrs.cend() ||
+       !event->speech_partial().transcript().empty())) {
+    auto* transcript = event->mutable_speech_partial()->mutable_transcript();
+    if (prefix_it == attrs.cend()) {
+      AddChain(id, *transcript);
+    } else {
+      const auto prefix = ParseNumber<std::size_t>(prefix_it->second);
+      const auto keyframe_it = attrs.find(kKeyframeKey);
+      if (!prefix || keyframe_it == attrs.cend()) {
+        return std::nullopt;
+      }
+      const auto& keyframe_id = keyframe_it->second;
+      auto chain = chains_.find(keyframe_id);
+      if (chain == chains_.end() && may_read && read_range_) {
+        // We started in the middle of the chain, so catch up from its start.
+        for (const auto& [earlier_id, earlier] :
+             read_range_(keyframe_id, id)) {
+          if (earlier_id == id || !earlier) {
+            continue;
+          }
+          const auto earlier_keyframe = earlier->find(kKeyframeKey);
+          if (earlier_id == keyframe_id ||
+              (earlier_keyframe != earlier->cend() &&
+               earlier_keyframe->second == keyframe_id)) {
+            Decode(earlier_id, *earlier, false);
+          }
+        }
+        chain = chains_.find(keyframe_id);
+      }
+      if (chain == chains_.end() || *prefix > chain->second.size()) {
+        AXY_LOG_WARN("Missing the partial before event {} of conversation "
+                     "'{}', skipping it.",
+                     id, conversation_id_);
+        return std::nullopt;
+      }
+      auto& previous = chain->second;
+      previous.resize(*prefix);
+      previous += *transcript;
+      *transcript = previous;
+    }
+  }
+
+  decoded.event = std::move(event);
+  return decoded;
+}
+
+}  // namespace axy
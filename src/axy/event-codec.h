@@ -0,0 +1,122 @@
+#ifndef AXY_SRC_AXY_EVENT_CODEC_H_
+#define AXY_SRC_AXY_EVENT_CODEC_H_
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "src/axy/event-sink.h"
+
+namespace axy {
+
+/// Attributes of a Redis stream entry.
+using StreamAttrs = std::unordered_map<std::string, std::string>;
+using StreamItem = std::pair<std::string, std::optional<StreamAttrs>>;
+
+/** Turns conversation events into Redis stream entries.
+ *
+ * The full encoding has the fully qualified type in `:type` and the
+ * serialized event in `:content`. The compact encoding has a one letter type
+ * code in `:t` and the event in `:c` without the metadata the entry already
+ * implies: the conversation name is in the stream key, and the creation time
+ * is stored as microseconds after the entry ID in `:at`.
+ *
+ * Compact partials with a transcript are stored as a delta against the
+ * previous one on the same channel: `:p` is the length of the prefix they
+ * share, `:c` has only the rest of the transcript, and `:k` is the ID of the
+ * full partial the chain of deltas starts from. A chain starts over after a
+ * final and every `kKeyframeInterval` partials.
+ *
+ * Both encodings carry `:channel`, `:provisional` and `:correction` as is.
+ * A full entry stored under another ID than its event's keeps that in `:id`.
+ * Not thread safe, the sink encodes from its writer thread.
+ */
+class EventEncoder {
+ public:
+  using Attrs = std::vector<std::pair<std::string, std::string>>;
+
+  static constexpr std::size_t kKeyframeInterval = 32;
+
+  explicit EventEncoder(bool compact) : compact_{compact} {}
+
+  /// The entry for `event`, compact if enabled and possible. Compact entries
+  /// only decode if they are stored with the ID of `event`.
+  Attrs Encode(const ConversationEvent& event);
+
+  /// The full entry for `event`, which decodes stored with any ID. With
+  /// `keep_id`, it carries the ID of `event` for `EventDecoder::IdOf`.
+  /// Deltas against an event encoded before start over.
+  Attrs EncodeFull(const ConversationEvent& event, bool keep_id = false);
+
+  /// The entry for `event` couldn't be stored, so deltas against it start
+  /// over.
+  void Drop(const ConversationEvent& event);
+
+ private:
+  struct Chain {
+    std::string keyframe_id;
+    std::string transcript;
+    std::size_t length = 0;
+  };
+  using ChainKey = std::pair<std::string, std::optional<std::size_t>>;
+
+  const bool compact_;
+  std::map<ChainKey, Chain> chains_;
+};
+
+/** Turns Redis stream entries of one conversation back into events.
+ *
+ * Reads both encodings of `EventEncoder`. Deltas are resolved against the
+ * partials decoded before them, so entries have to be decoded in stream
+ * order. A reader starting in the middle of a chain of deltas, like a
+ * watcher, passes `read_range` to fetch the entries back to its keyframe.
+ */
+class EventDecoder {
+ public:
+  /// Returns the entries from `start` to `end`, both included.
+  using RangeReader = std::function<std::vector<StreamItem>(
+      const std::string& start, const std::string& end)>;
+
+  explicit EventDecoder(std::string conversation_id,
+                        RangeReader read_range = {});
+
+  /// Fully qualified type of the event in the entry, empty if it has none.
+  static std::string TypeOf(const StreamAttrs& attrs);
+
+  /// ID the event in the entry `id` was published with, which differs from
+  /// `id` if Redis picked the ID of the entry.
+  static std::optional<StreamId> IdOf(const std::string& id,
+                                      const StreamAttrs& attrs);
+
+  /// The event in the entry, or nothing if it is not an event or can't be
+  /// decoded, e.g. because its keyframe has been trimmed away.
+  std::optional<ConversationEvent> Decode(const std::string& id,
+                                          const StreamAttrs& attrs);
+
+ private:
+  std::optional<ConversationEvent> Decode(const std::string& id,
+                                          const StreamAttrs& attrs,
+                                          bool may_read);
+
+  /// Start following the chain of deltas from the keyframe `id`.
+  void AddChain(const std::string& id, std::string transcript);
+
+  const std::string conversation_id_;
+  const RangeReader read_range_;
+  /// The latest transcript of each chain, by the ID of its keyframe. Writers
+  /// of the conversation on other workers or nodes have chains of their own
+  /// on the same channels, interleaved with ours.
+  std::map<std::string, std::string> chains_;
+  /// Keys of `chains_`, oldest first.
+  std::deque<std::string> chain_order_;
+};
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_EVENT_CODEC_H_
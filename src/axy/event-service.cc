@@ -3,14 +3,18 @@
 #include <fmt/core.h>
 #include <fmt/ranges.h>
 #include <fmt/std.h>
+#include <grpcpp/alarm.h>
 #include <grpcpp/server_context.h>
 #include <grpcpp/support/server_callback.h>
 #include <grpcpp/support/status.h>
 #include <sdifi/events/v1alpha/event.pb.h>
 #include <sw/redis++/redis.h>
 
+#include <charconv>
 #include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <exception>
 #include <functional>
 #include <memory>
@@ -20,24 +24,76 @@
 #include <stop_token>
 #include <string>
 #include <string_view>
+#include <system_error>
 #include <thread>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "src/axy/admission.h"
+#include "src/axy/event-codec.h"
+#include "src/axy/event-sink.h"
+#include "src/axy/event-store.h"
+#include "src/axy/local-event-bus.h"
 #include "src/axy/logging.h"
+#include "src/axy/memory-accounting.h"
+#include "src/axy/threading.h"
 
 namespace axy {
 
 namespace {
 
-constexpr auto kContentKey = ":content";
-constexpr auto kTypeKey = ":type";
+MemoryAccount& WatchWriterMemory() {
+  static MemoryAccount& account = MemoryAccount::For("watch_writer");
+  return account;
+}
+
+std::int64_t ByteSize(const google::protobuf::Message& message) {
+  return static_cast<std::int64_t>(message.ByteSizeLong());
+}
+
+/// Maximum number of events per batch, 1 unless the watcher says otherwise.
+/// 0 if the watcher sent something unusable.
+std::size_t WatchBatchFromMetadata(const grpc::CallbackServerContext& context) {
+  const auto& metadata = context.client_metadata();
+  const auto it = metadata.find(grpc::string_ref{
+      kWatchBatchMetadataKey.data(), kWatchBatchMetadataKey.size()});
+  if (it == metadata.cend()) {
+    return 1;
+  }
+  std::size_t max_batch = 0;
+  const auto* end = it->second.data() + it->second.size();
+  if (std::from_chars(it->second.data(), end, max_batch).ptr != end ||
+      max_batch > kMaxWatchBatch) {
+    return 0;
+  }
+  return max_batch;
+}
+
+/// Events waiting for a watcher's write in flight. Events from Redis wait
+/// for room, local events over this are left for Redis to deliver.
+constexpr std::size_t kMaxPendingWrites = 64;
+/// IDs of delivered events are remembered until a newer event is this much
+/// younger, which is longer than events wait for the Redis writer.
+constexpr std::chrono::milliseconds kDeliveredIdHorizon{10000};
+/// Bounds the remembered IDs of a very busy conversation.
+constexpr std::size_t kMaxDeliveredIds = 4096;
+/// Longest a watcher waits in XREAD for new events, so it notices when it's
+/// done, e.g. on a conversation that ended.
+constexpr std::chrono::milliseconds kRedisBlockTimeout{1000};
 
 }  // namespace
 
-EventServiceImpl::EventServiceImpl(std::shared_ptr<sw::redis::Redis> redis)
-    : redis_{std::move(redis)} {}
+EventServiceImpl::EventServiceImpl(
+    std::shared_ptr<EventStore> events,
+    std::shared_ptr<LocalEventBus> local_events,
+    std::shared_ptr<AdmissionController> admission, CpuSet worker_cpus,
+    std::chrono::milliseconds batch_linger)
+    : events_{std::move(events)},
+      local_events_{std::move(local_events)},
+      admission_{std::move(admission)},
+      worker_cpus_{std::move(worker_cpus)},
+      batch_linger_{batch_linger} {}
 
 grpc::ServerWriteReactor<sdifi::events::v1alpha::WatchResponse>*
 EventServiceImpl::Watch(grpc::CallbackServerContext* context,
@@ -45,25 +101,70 @@ EventServiceImpl::Watch(grpc::CallbackServerContext* context,
   class Writer
       : public grpc::ServerWriteReactor<sdifi::events::v1alpha::WatchResponse> {
    public:
-    Writer(sw::redis::Redis& redis,
+    Writer(EventStore& events, LocalEventBus* local_events,
+           AdmissionController& admission, const CpuSet& worker_cpus,
+           std::size_t max_batch, std::chrono::milliseconds batch_linger,
            const sdifi::events::v1alpha::WatchRequest* request)
-        : redis_{redis}, request_{request} {
-      StartWriterThread();
+        : events_{events},
+          local_events_{local_events},
+          admission_{admission},
+          worker_cpus_{worker_cpus},
+          max_batch_{max_batch},
+          batch_linger_{max_batch > 1 ? batch_linger
+                                      : std::chrono::milliseconds{0}},
+          request_{request} {
+      pending_admission_ = admission_.Acquire(
+          [this](std::optional<AdmissionController::Ticket> ticket) {
+            OnAdmission(std::move(ticket));
+          });
     }
 
     void OnWriteDone(bool ok) override {
+      AXY_CONV_LOG_DEBUG(request_->conversation_id(), "Watch Write done.");
       if (!ok) {
-        SafelyFinish(grpc::Status::CANCELLED);
-      } else {
-        { std::unique_lock<std::mutex> l{res_mtx_}; }
-        res_cv_.notify_one();
+        return SafelyFinish(grpc::Status::CANCELLED);
+      }
+
+      std::unique_lock<std::mutex> lock{write_mtx_};
+      if (++batch_written_ < batch_.size() && !writes_closed_) {
+        lock.unlock();
+        WriteNext();
+        return;
+      }
+      // Whatever arrived during the last batch goes out right away, it has
+      // waited long enough.
+      if (pending_writes_.empty() || writes_closed_) {
+        write_in_flight_ = false;
+        lock.unlock();
+        write_cv_.notify_all();
+        return;
       }
-      AXY_LOG_DEBUG("Watch Write done.");
+      TakeBatch();
+      lock.unlock();
+      write_cv_.notify_all();
+      WriteNext();
     }
 
     void OnDone() override {
+      admission_.Cancel(pending_admission_);
+      {
+        // Free the slot now, we may not be deleted for a while.
+        std::lock_guard<std::mutex> lg{finished_mtx_};
+        ticket_.reset();
+      }
+      redis_executor_thread_.request_stop();
+      // Waits for deliveries from the local event bus that are under way.
+      subscription_ = {};
       AXY_LOG_INFO("Event Watch done for conversation '{}'.",
                    request_->conversation_id());
+      {
+        std::lock_guard<std::mutex> lock{write_mtx_};
+        done_ = true;
+        if (lingering_) {
+          // The alarm callback deletes us, which is at most a linger away.
+          return;
+        }
+      }
       delete this;
     }
 
@@ -77,38 +178,278 @@ EventServiceImpl::Watch(grpc::CallbackServerContext* context,
     using Attrs = std::unordered_map<std::string, std::string>;
     using Item = std::pair<std::string, std::optional<Attrs>>;
     using ItemStream = std::vector<Item>;
+    using Event = sdifi::events::v1alpha::Event;
+
+    /// Move up to `max_batch_` pending events to the batch to write. Needs
+    /// `write_mtx_`.
+    void TakeBatch() {
+      batch_.clear();
+      batch_written_ = 0;
+      while (!pending_writes_.empty() && batch_.size() < max_batch_) {
+        batch_.emplace_back().mutable_event()->CopyFrom(
+            *pending_writes_.front());
+        // Events are shared between watchers, but each one holds on to them.
+        memory_.Hold(-ByteSize(*pending_writes_.front()));
+        pending_writes_.pop_front();
+      }
+    }
+
+    /// Write the next event of the batch. All but the last may be buffered,
+    /// so a batch goes out in as few frames and syscalls as possible.
+    void WriteNext() {
+      grpc::WriteOptions options;
+      if (batch_written_ + 1 < batch_.size()) {
+        options.set_buffer_hint();
+      }
+      StartWrite(&batch_[batch_written_], options);
+    }
+
+    /// Needs `write_mtx_`, which it unlocks before writing.
+    void StartBatch(std::unique_lock<std::mutex>& lock) {
+      write_in_flight_ = true;
+      TakeBatch();
+      lock.unlock();
+      write_cv_.notify_all();
+      WriteNext();
+    }
+
+    void OnLingerDone() {
+      std::unique_lock<std::mutex> lock{write_mtx_};
+      lingering_ = false;
+      if (done_) {
+        lock.unlock();
+        delete this;
+        return;
+      }
+      if (!write_in_flight_ && !writes_closed_ && !pending_writes_.empty()) {
+        StartBatch(lock);
+      }
+    }
 
     void SafelyFinish(grpc::Status s) {
       std::lock_guard<std::mutex> lg{finished_mtx_};
+      if (finished_) {
+        return;
+      }
       finished_ = true;
+      {
+        std::lock_guard<std::mutex> lock{write_mtx_};
+        writes_closed_ = true;
+      }
+      write_cv_.notify_all();
       Finish(std::move(s));
     }
 
+    void OnAdmission(std::optional<AdmissionController::Ticket> ticket) {
+      if (!ticket) {
+        return SafelyFinish(admission_.RejectionStatus());
+      }
+      {
+        std::lock_guard<std::mutex> lg{finished_mtx_};
+        if (finished_) {
+          return;
+        }
+        ticket_ = std::move(ticket);
+      }
+      StartWriterThread();
+    }
+
+    bool Watches(std::string_view type) const {
+      if (match_filter_.empty()) {
+        return true;
+      }
+      const auto pos = type.find_last_of('.');
+      std::string_view possibly_short_type =
+          pos == std::string_view::npos ? "" : type.substr(pos + 1);
+      return match_filter_.contains(type) ||
+             match_filter_.contains(possibly_short_type);
+    }
+
+    /** Remember that the event `id` was delivered. Needs `write_mtx_`.
+     *
+     * \returns false if it was delivered before.
+     */
+    bool MarkDelivered(const StreamId& id) {
+      if (!delivered_ids_.insert(id).second) {
+        return false;
+      }
+      const auto newest_ms = delivered_ids_.rbegin()->ms;
+      while (delivered_ids_.size() > kMaxDeliveredIds ||
+             delivered_ids_.begin()->ms + kDeliveredIdHorizon.count() <
+                 newest_ms) {
+        delivered_ids_.erase(delivered_ids_.begin());
+      }
+      return true;
+    }
+
+    /** Queue an event read from Redis, unless the local event bus delivered
+     * it already.
+     *
+     * Events carry the Redis stream IDs they were produced with, so the copy
+     * read back from Redis of an event we got from the local event bus has
+     * the same ID, see `EventDecoder::IdOf`.
+     */
+    void DeliverFromRedis(const StreamId& id,
+                          std::shared_ptr<const Event> event,
+                          std::stop_token& stop) {
+      std::unique_lock<std::mutex> lock{write_mtx_};
+      write_cv_.wait(lock, stop, [this] {
+        return pending_writes_.size() < kMaxPendingWrites || writes_closed_;
+      });
+      if (writes_closed_ || !MarkDelivered(id)) {
+        return;
+      }
+      Queue(std::move(event));
+      MaybeStartWrite(lock);
+    }
+
+    /** Redis has delivered everything up to `id`, in order, so local delivery
+     * can resume if that covers the events it left out.
+     */
+    void RedisReached(const StreamId& id) {
+      std::lock_guard<std::mutex> lock{write_mtx_};
+      if (local_gap_ && id >= *local_gap_) {
+        local_gap_.reset();
+      }
+    }
+
+    /** Queue events from the local event bus, unless Redis delivered them
+     * already.
+     *
+     * Once a local event is left out, because too many are waiting or the
+     * ring was overrun (`complete` is false), Redis has to deliver it. Local
+     * delivery stops until Redis caught up with it, so events don't overtake
+     * it.
+     */
+    void DeliverLocal(std::vector<ConversationEvent> events, bool complete) {
+      std::unique_lock<std::mutex> lock{write_mtx_};
+      if (writes_closed_) {
+        return;
+      }
+      for (auto& event : events) {
+        if (!Watches(event.type) || event.correction) {
+          continue;
+        }
+        if (!complete || local_gap_ ||
+            pending_writes_.size() >= kMaxPendingWrites) {
+          if (!local_gap_ || *local_gap_ < event.id) {
+            local_gap_ = event.id;
+          }
+          continue;
+        }
+        if (MarkDelivered(event.id)) {
+          Queue(std::move(event.event));
+        }
+      }
+      MaybeStartWrite(lock);
+    }
+
+    /// Needs `write_mtx_`.
+    void Queue(std::shared_ptr<const Event> event) {
+      memory_.Hold(ByteSize(*event));
+      pending_writes_.push_back(std::move(event));
+    }
+
+    /// Start writing the queued events, unless that's under way or waiting
+    /// for more events. Needs `write_mtx_`, which it may unlock.
+    void MaybeStartWrite(std::unique_lock<std::mutex>& lock) {
+      if (pending_writes_.empty() || write_in_flight_) {
+        return;
+      }
+      if (lingering_) {
+        if (pending_writes_.size() >= max_batch_) {
+          // Full, so write it now. The alarm callback starts the batch, and
+          // may run right away.
+          lock.unlock();
+          linger_alarm_.Cancel();
+        }
+        return;
+      }
+      if (batch_linger_.count() > 0 && pending_writes_.size() < max_batch_) {
+        lingering_ = true;
+        linger_alarm_.Set(std::chrono::system_clock::now() + batch_linger_,
+                          [this](bool) { OnLingerDone(); });
+        return;
+      }
+      StartBatch(lock);
+    }
+
+    /// Called by the local event bus on the publishing thread.
+    void OnLocalEvents() {
+      std::vector<ConversationEvent> events;
+      bool complete = true;
+      {
+        std::lock_guard<std::mutex> lock{local_mtx_};
+        if (!ring_cursor_) {
+          // Still subscribing, Redis will have this.
+          return;
+        }
+        complete = subscription_.ring().ReadFrom(&*ring_cursor_, &events);
+      }
+      if (!complete) {
+        AXY_CONV_LOG_DEBUG(request_->conversation_id(),
+                           "{}: watcher fell behind the local event ring.",
+                           request_->conversation_id());
+      }
+      DeliverLocal(std::move(events), complete);
+    }
+
     void StartWriterThread() {
       if (request_->conversation_id().empty()) {
         return SafelyFinish({grpc::StatusCode::INVALID_ARGUMENT,
                              "Field `conversation_id` cannot be empty"});
       }
+      if (max_batch_ == 0) {
+        return SafelyFinish(
+            {grpc::StatusCode::INVALID_ARGUMENT,
+             fmt::format("Metadata `{}` has to be between 1 and {}",
+                         kWatchBatchMetadataKey, kMaxWatchBatch)});
+      }
 
-      stream_key_ =
-          fmt::format("sdifi/conversation/{}", request_->conversation_id());
+      stream_key_ = EventStore::StreamKey(request_->conversation_id());
+      for (const auto& event_type : request_->watch_event_type()) {
+        match_filter_.emplace(event_type);
+      }
+
+      if (local_events_ != nullptr) {
+        subscription_ = local_events_->Subscribe(request_->conversation_id(),
+                                                 [this] { OnLocalEvents(); });
+        std::lock_guard<std::mutex> lock{local_mtx_};
+        ring_cursor_ = subscription_.ring().end();
+      }
 
       redis_executor_thread_ = std::jthread{[this](std::stop_token stop) {
         try {
           std::optional<std::string> last_id = std::nullopt;
+          // Compact partials may refer to ones before where we start.
+          EventDecoder decoder{
+              request_->conversation_id(),
+              [this](const std::string& start, const std::string& end) {
+                ItemStream items;
+                events_.WithClient(
+                    request_->conversation_id(), [&](auto& redis) {
+                      redis.xrange(stream_key_, start, end,
+                                   std::back_inserter(items));
+                    });
+                return items;
+              }};
 
           AXY_LOG_DEBUG("Started redis executor thread");
 
-          std::set<std::string_view> match_filter{};
-          for (const auto& event_type : request_->watch_event_type()) {
-            match_filter.emplace(event_type);
+          try {
+            PinCurrentThread(worker_cpus_);
+          } catch (const std::system_error& e) {
+            AXY_LOG_WARN("{}", e.what());
           }
 
           while (!stop.stop_requested()) {
             while (!last_id) {
               ItemStream result;
-              redis_.xrevrange(stream_key_, "+", "-", 1,
-                               std::back_inserter(result));
+              events_.WithClient(
+                  request_->conversation_id(), [&](auto& redis) {
+                    redis.xrevrange(stream_key_, "+", "-", 1,
+                                    std::back_inserter(result));
+                  });
 
               if (!result.empty()) {
                 last_id = result.at(0).first;
@@ -117,8 +458,10 @@ EventServiceImpl::Watch(grpc::CallbackServerContext* context,
             }
 
             std::unordered_map<std::string, ItemStream> result;
-            redis_.xread(stream_key_, *last_id, std::chrono::seconds{0},
-                         std::inserter(result, result.end()));
+            events_.WithClient(request_->conversation_id(), [&](auto& redis) {
+              redis.xread(stream_key_, *last_id, kRedisBlockTimeout,
+                          std::inserter(result, result.end()));
+            });
 
             if (const auto it = result.find(stream_key_);
                 !result.empty() && it != result.cend()) {
@@ -129,42 +472,34 @@ EventServiceImpl::Watch(grpc::CallbackServerContext* context,
                 if (!attrs) {
                   continue;
                 }
-                AXY_LOG_TRACE("Got attrs in stream: {}", *attrs);
-
-                const auto type_it = attrs->find(kTypeKey);
-                const auto content_it = attrs->find(kContentKey);
-                if (type_it != attrs->cend() && content_it != attrs->cend()) {
-                  std::string_view type = type_it->second;
-                  const auto pos = type.find_last_of('.');
-                  std::string_view possibly_short_type =
-                      pos == std::string_view::npos ? "" : type.substr(pos + 1);
-
-                  if (!match_filter.empty() &&
-                      !(match_filter.contains(type) ||
-                        match_filter.contains(possibly_short_type))) {
-                    AXY_LOG_DEBUG("Not watching this event: '{}'",
-                                  type_it->second);
-                  } else if (!res_.mutable_event()->ParseFromString(
-                                 content_it->second)) {
-                    AXY_LOG_WARN(
-                        "Couldn't parse serialized event in stream = '{}'. "
-                        "Ignoring...",
-                        stream_key_);
-                  } else {
-                    AXY_LOG_TRACE("Got serialized content: {}",
-                                  content_it->second);
-
-                    StartWrite(&res_);
-
-                    std::unique_lock<std::mutex> l{res_mtx_};
-                    res_cv_.wait(l);
-                  }
-                } else {
-                  AXY_LOG_TRACE(
-                      "Got message missing either '{}' or '{}' attrs. "
-                      "Ignoring..",
-                      kTypeKey, kContentKey);
+                AXY_CONV_LOG_TRACE(request_->conversation_id(),
+                                   "Got attrs in stream: {}", *attrs);
+
+                const auto type = EventDecoder::TypeOf(*attrs);
+                if (type.empty()) {
+                  AXY_CONV_LOG_TRACE(request_->conversation_id(),
+                                     "Got message without an event type. "
+                                     "Ignoring..");
+                  continue;
                 }
+
+                if (!Watches(type)) {
+                  AXY_CONV_LOG_DEBUG(request_->conversation_id(),
+                                     "Not watching this event: '{}'", type);
+                  continue;
+                }
+
+                auto decoded = decoder.Decode(id, *attrs);
+                const auto event_id = EventDecoder::IdOf(id, *attrs);
+                // Watchers already got the provisional final a correction
+                // replaces, see `ConversationEvent::correction`.
+                if (!decoded || !event_id || decoded->correction) {
+                  continue;
+                }
+                DeliverFromRedis(*event_id, std::move(decoded->event), stop);
+              }
+              if (const auto reached = StreamId::Parse(*last_id)) {
+                RedisReached(*reached);
               }
             }
           }
@@ -177,13 +512,42 @@ EventServiceImpl::Watch(grpc::CallbackServerContext* context,
     }
 
     std::string stream_key_;
-    sw::redis::Redis& redis_;
+    EventStore& events_;
+    LocalEventBus* local_events_;
+    AdmissionController& admission_;
+    const CpuSet& worker_cpus_;
+    /// 1 unless the watcher asked for batches, 0 if it asked for nonsense.
+    const std::size_t max_batch_;
+    const std::chrono::milliseconds batch_linger_;
     const sdifi::events::v1alpha::WatchRequest* request_;
-
-    std::mutex res_mtx_;
-    std::condition_variable res_cv_;
-    bool res_written_ = true;
-    sdifi::events::v1alpha::WatchResponse res_;
+    std::set<std::string, std::less<>> match_filter_;
+
+    std::shared_ptr<AdmissionController::Pending> pending_admission_;
+    std::optional<AdmissionController::Ticket> ticket_;
+
+    AccountedObject memory_{WatchWriterMemory()};
+
+    std::mutex write_mtx_;
+    std::condition_variable_any write_cv_;
+    std::deque<std::shared_ptr<const Event>> pending_writes_;
+    /// A batch is being written.
+    bool write_in_flight_ = false;
+    bool writes_closed_ = false;
+    /// IDs of recently delivered events, from either source.
+    std::set<StreamId> delivered_ids_;
+    /// The latest event the local event bus left for Redis to deliver, while
+    /// Redis hasn't got there yet.
+    std::optional<StreamId> local_gap_;
+    std::vector<sdifi::events::v1alpha::WatchResponse> batch_;
+    std::size_t batch_written_ = 0;
+    /// Waiting for the first pending events to be joined by more.
+    bool lingering_ = false;
+    grpc::Alarm linger_alarm_;
+    bool done_ = false;
+
+    std::mutex local_mtx_;
+    std::optional<std::uint64_t> ring_cursor_;
+    LocalEventBus::Subscription subscription_;
 
     std::jthread redis_executor_thread_;
 
@@ -191,7 +555,8 @@ EventServiceImpl::Watch(grpc::CallbackServerContext* context,
     bool finished_ = false;
   };
 
-  return new Writer(*redis_, request);
+  return new Writer(*events_, local_events_.get(), *admission_, worker_cpus_,
+                    WatchBatchFromMetadata(*context), batch_linger_, request);
 }
 
 }  // namespace axy
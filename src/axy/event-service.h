@@ -2,19 +2,39 @@
 #define AXY_SRC_AXY_EVENT_SERVICE_H_
 
 #include <sdifi/events/v1alpha/event.grpc.pb.h>
-#include <sw/redis++/redis.h>
 
+#include <chrono>
+#include <cstddef>
 #include <memory>
+#include <string_view>
 #include <thread>
 
+#include "src/axy/admission.h"
+#include "src/axy/event-store.h"
+#include "src/axy/local-event-bus.h"
 #include "src/axy/logging.h"
+#include "src/axy/threading.h"
 
 namespace axy {
 
+/// Watchers opt in to batched delivery by giving the maximum number of events
+/// per batch with this metadata key.
+inline constexpr std::string_view kWatchBatchMetadataKey =
+    "x-axy-watch-batch";
+inline constexpr std::size_t kMaxWatchBatch = 64;
+
 class EventServiceImpl final
     : public sdifi::events::v1alpha::EventService::CallbackService {
  public:
-  explicit EventServiceImpl(std::shared_ptr<sw::redis::Redis> redis);
+  /// Watchers get events from `local_events` as soon as they are produced on
+  /// this instance, and from `events` otherwise. `local_events` may be null.
+  /// Watch threads doing blocking Redis reads get pinned to `worker_cpus`.
+  /// Batched watchers wait up to `batch_linger` for a batch to fill up.
+  EventServiceImpl(std::shared_ptr<EventStore> events,
+                   std::shared_ptr<LocalEventBus> local_events,
+                   std::shared_ptr<AdmissionController> admission,
+                   CpuSet worker_cpus = {},
+                   std::chrono::milliseconds batch_linger = {});
 
   ~EventServiceImpl() = default;
 
@@ -25,7 +45,11 @@ class EventServiceImpl final
  private:
   // TODO(rkjaran): migrate to AsyncRedis once we can reliably link to
   //   hired>1.0.0
-  std::shared_ptr<sw::redis::Redis> redis_;
+  std::shared_ptr<EventStore> events_;
+  std::shared_ptr<LocalEventBus> local_events_;
+  std::shared_ptr<AdmissionController> admission_;
+  const CpuSet worker_cpus_;
+  const std::chrono::milliseconds batch_linger_;
 };
 
 }  // namespace axy
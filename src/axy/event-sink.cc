@@ -0,0 +1,177 @@
+#include "src/axy/event-sink.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "src/axy/event-codec.h"
+#include "src/axy/logging.h"
+#include "src/axy/metrics.h"
+#include "src/axy/tracing.h"
+
+namespace axy {
+
+namespace {
+
+Counter& DroppedEvents(const std::string& reason) {
+  return MetricsRegistry::Global().GetCounter(
+      "axy_events_dropped_total",
+      "Conversation events that couldn't be written to Redis.",
+      {{"reason", reason}});
+}
+
+/// Low bits of each sequence number, which tell writers apart.
+constexpr int kWriterTagBits = 20;
+
+/// Tags the IDs of this process, so they don't collide with other workers'.
+std::uint64_t WriterTag() {
+  static const std::uint64_t tag = [] {
+    std::random_device random;
+    return std::uniform_int_distribution<std::uint64_t>{
+        0, (std::uint64_t{1} << kWriterTagBits) - 1}(random);
+  }();
+  return tag;
+}
+
+}  // namespace
+
+std::optional<StreamId> StreamId::Parse(std::string_view id) {
+  const auto dash = id.find('-');
+  if (dash == std::string_view::npos) {
+    return std::nullopt;
+  }
+  StreamId parsed;
+  const auto ms = id.substr(0, dash);
+  const auto seq = id.substr(dash + 1);
+  if (std::from_chars(ms.data(), ms.data() + ms.size(), parsed.ms).ec !=
+          std::errc{} ||
+      std::from_chars(seq.data(), seq.data() + seq.size(), parsed.seq).ec !=
+          std::errc{}) {
+    return std::nullopt;
+  }
+  return parsed;
+}
+
+std::string StreamId::ToString() const { return fmt::format("{}-{}", ms, seq); }
+
+StreamId StreamIdGenerator::Next() {
+  const auto now = static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count());
+  // Shared by all generators of this process, so concurrent streams of a
+  // conversation don't hand out the same IDs either.
+  static std::atomic<std::uint64_t> counter{0};
+  std::lock_guard<std::mutex> lock{mtx_};
+  // Keeps increasing if the clock goes backwards, as the counter does.
+  last_ = {.ms = std::max(now, last_.ms),
+           .seq = (counter.fetch_add(1) << kWriterTagBits) | WriterTag()};
+  return last_;
+}
+
+RedisEventSink::RedisEventSink(std::shared_ptr<EventStore> store,
+                               std::size_t max_queued, bool compact,
+                               DroppedCallback on_dropped)
+    : store_{std::move(store)},
+      max_queued_{max_queued},
+      on_dropped_{std::move(on_dropped)},
+      encoder_{std::make_unique<EventEncoder>(compact)},
+      writer_thread_{[this](std::stop_token stop) { WriteLoop(stop); }} {}
+
+RedisEventSink::~RedisEventSink() = default;
+
+void RedisEventSink::Publish(const ConversationEvent& event) {
+  bool queued = false;
+  {
+    std::lock_guard<std::mutex> lock{mtx_};
+    if (queue_.size() < max_queued_) {
+      queue_.push_back(event);
+      queued = true;
+    }
+  }
+  if (queued) {
+    cv_.notify_one();
+    return;
+  }
+
+  static Counter& queue_full = DroppedEvents("queue_full");
+  queue_full.Increment();
+  AXY_CONV_LOG_DEBUG(event.conversation_id,
+                     "{}: Redis write queue full, dropping event {}.",
+                     event.conversation_id, event.id.ToString());
+  if (on_dropped_) {
+    on_dropped_(event);
+  }
+}
+
+void RedisEventSink::WriteLoop(std::stop_token stop) {
+  std::vector<ConversationEvent> batch;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock{mtx_};
+      cv_.wait(lock, stop, [this] { return !queue_.empty(); });
+      if (queue_.empty()) {
+        // Stopped, and everything has been written.
+        return;
+      }
+      batch.assign(std::make_move_iterator(queue_.begin()),
+                   std::make_move_iterator(queue_.end()));
+      queue_.clear();
+    }
+    for (const auto& event : batch) {
+      Write(event);
+    }
+    batch.clear();
+  }
+}
+
+void RedisEventSink::Write(const ConversationEvent& event) {
+  const auto stream_key = EventStore::StreamKey(event.conversation_id);
+  const auto id = event.id.ToString();
+  auto attrs = encoder_->Encode(event);
+  try {
+    store_->WithClient(event.conversation_id, [&](auto& redis) {
+      try {
+        redis.xadd(stream_key, id, attrs.begin(), attrs.end());
+      } catch (const sw::redis::ReplyError& e) {
+        // The stream already has a later entry, e.g. written by another node
+        // with a clock ahead of ours. Let Redis pick the ID instead, and keep
+        // ours in the entry so watchers still recognize the event. Compact
+        // entries depend on their ID, so this one is stored in full.
+        AXY_CONV_LOG_DEBUG(event.conversation_id,
+                           "{}: could not add event with ID {}: {}",
+                           event.conversation_id, id, e.what());
+        attrs = encoder_->EncodeFull(event, true);
+        redis.xadd(stream_key, "*", attrs.begin(), attrs.end());
+      }
+    });
+    static Counter& bytes_written = MetricsRegistry::Global().GetCounter(
+        "axy_event_bytes_written_total",
+        "Bytes of event attributes written to Redis streams.");
+    std::size_t bytes = 0;
+    for (const auto& [key, value] : attrs) {
+      bytes += key.size() + value.size();
+    }
+    bytes_written.Increment(static_cast<double>(bytes));
+    if (const auto trace = event.trace.lock()) {
+      trace->Record(StreamTrace::Event::kRedisXaddDone);
+    }
+  } catch (const sw::redis::Error& e) {
+    static Counter& redis_error = DroppedEvents("redis_error");
+    redis_error.Increment();
+    encoder_->Drop(event);
+    AXY_LOG_WARN("{}: could not write event to Redis: {}",
+                 event.conversation_id, e.what());
+    if (on_dropped_) {
+      on_dropped_(event);
+    }
+  }
+}
+
+}  // namespace axy
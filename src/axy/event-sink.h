@@ -0,0 +1,132 @@
+#ifndef AXY_SRC_AXY_EVENT_SINK_H_
+#define AXY_SRC_AXY_EVENT_SINK_H_
+
+#include <sdifi/events/v1alpha/event.pb.h>
+
+#include <compare>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "src/axy/event-store.h"
+
+namespace axy {
+
+/// ID of an entry in a Redis stream, "<milliseconds>-<sequence>".
+struct StreamId {
+  std::uint64_t ms = 0;
+  std::uint64_t seq = 0;
+
+  static std::optional<StreamId> Parse(std::string_view id);
+  std::string ToString() const;
+
+  auto operator<=>(const StreamId&) const = default;
+};
+
+/** Hands out increasing stream IDs for the events of one conversation.
+ *
+ * Events get their Redis stream IDs when they are produced rather than when
+ * Redis stores them, so watchers can tell events they already got from the
+ * local event bus from the same events read back from Redis. Thread safe, so
+ * the backend streams of a multi-channel stream can share one.
+ *
+ * IDs are unique across generators: the sequence number counts for the whole
+ * process and ends in a random tag of the process. IDs of concurrent writers
+ * still interleave, so some are stored under IDs Redis picks.
+ */
+class StreamIdGenerator {
+ public:
+  StreamId Next();
+
+ private:
+  std::mutex mtx_;
+  StreamId last_;
+};
+
+class StreamTrace;
+
+/// An event of a conversation, as published by a speech stream.
+struct ConversationEvent {
+  std::string conversation_id;
+  StreamId id;
+  /// Full name of the event type, e.g. "sdifi.events.v1alpha.Event".
+  std::string type;
+  std::shared_ptr<const sdifi::events::v1alpha::Event> event;
+  /// Audio channel the event was recognized from, only set for streams with
+  /// several channels, e.g. one per party of a phone call.
+  std::optional<std::size_t> channel;
+  /// A final sent by Axy because the interim transcript stopped changing,
+  /// before the backend decided on it.
+  bool provisional = false;
+  /// A backend final that replaces the provisional final before it on the
+  /// same channel, whether or not its transcript differs. Watchers get one
+  /// final per utterance, so they don't get these.
+  bool correction = false;
+  /// Trace of the stream, if sampled, for sinks to record their progress
+  /// on. Weak, so events kept around don't hold the span open.
+  std::weak_ptr<StreamTrace> trace;
+};
+
+class EventEncoder;
+
+/// Receives the events produced by speech streams.
+class EventSink {
+ public:
+  virtual ~EventSink() = default;
+
+  /// Called on the hot path of a speech stream, so this must not block.
+  virtual void Publish(const ConversationEvent& event) = 0;
+};
+
+/** Writes events to their Redis streams from a background thread, and
+ * records `kRedisXaddDone` on the trace of each event written.
+ *
+ * Events are written in the order they were published. If Redis falls so far
+ * behind that `max_queued` events are waiting, new events are dropped and
+ * counted in `axy_events_dropped_total`, as are events Redis fails to store.
+ * Either way they are passed to `on_dropped`, if set.
+ *
+ * With `compact`, events are stored in the compact encoding of
+ * `EventEncoder`. Bytes written are counted in
+ * `axy_event_bytes_written_total`.
+ */
+class RedisEventSink final : public EventSink {
+ public:
+  using DroppedCallback = std::function<void(const ConversationEvent&)>;
+
+  RedisEventSink(std::shared_ptr<EventStore> store, std::size_t max_queued,
+                 bool compact = false, DroppedCallback on_dropped = {});
+  /// Writes the events still queued before returning.
+  ~RedisEventSink() override;
+
+  void Publish(const ConversationEvent& event) override;
+
+ private:
+  void WriteLoop(std::stop_token stop);
+  void Write(const ConversationEvent& event);
+
+  const std::shared_ptr<EventStore> store_;
+  const std::size_t max_queued_;
+  const DroppedCallback on_dropped_;
+  /// Only used by the writer thread.
+  const std::unique_ptr<EventEncoder> encoder_;
+
+  std::mutex mtx_;
+  std::condition_variable_any cv_;
+  std::deque<ConversationEvent> queue_;
+
+  std::jthread writer_thread_;
+};
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_EVENT_SINK_H_
@@ -0,0 +1,137 @@
+#include "src/axy/event-store.h"
+
+#include <fmt/core.h>
+#include <fmt/ranges.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "src/axy/logging.h"
+
+namespace axy {
+
+namespace {
+
+/// Virtual nodes per shard. More points even out the share of each shard.
+constexpr std::size_t kPointsPerShard = 160;
+
+sw::redis::ConnectionOptions MakeConnectionOptions(
+    const std::string& address, const EventStore::Options& opts) {
+  sw::redis::ConnectionOptions conn_opts{address};
+  conn_opts.connect_timeout = opts.connect_timeout;
+  conn_opts.socket_timeout = opts.socket_timeout;
+  return conn_opts;
+}
+
+}  // namespace
+
+std::uint64_t StableHash(std::string_view data) {
+  std::uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const char c : data) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 0x100000001b3ULL;
+  }
+  // FNV-1a mixes the last bytes poorly, which matters for the ring points that
+  // only differ in their suffix. Finish with the MurmurHash3 finalizer.
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+EventStore::EventStore(const Options& opts)
+    : addresses_{opts.addresses}, is_cluster_{opts.cluster} {
+  if (addresses_.empty()) {
+    throw std::invalid_argument{"At least one Redis address is required."};
+  }
+  pool_opts_.size = opts.pool_size;
+
+  if (is_cluster_) {
+    connection_opts_ = MakeConnectionOptions(addresses_.front(), opts);
+    return;
+  }
+
+  for (std::size_t shard = 0; shard < addresses_.size(); ++shard) {
+    shards_.push_back(std::make_unique<sw::redis::Redis>(
+        MakeConnectionOptions(addresses_[shard], opts), pool_opts_));
+    for (std::size_t point = 0; point < kPointsPerShard; ++point) {
+      ring_.emplace_back(
+          StableHash(fmt::format("{}#{}", addresses_[shard], point)), shard);
+    }
+  }
+  std::sort(ring_.begin(), ring_.end());
+}
+
+std::string EventStore::StreamKey(std::string_view conversation_id) {
+  return fmt::format("sdifi/conversation/{}", conversation_id);
+}
+
+std::size_t EventStore::ShardFor(std::string_view conversation_id) const {
+  if (shards_.size() == 1) {
+    return 0;
+  }
+  const auto hash = StableHash(conversation_id);
+  auto it = std::lower_bound(
+      ring_.begin(), ring_.end(), hash,
+      [](const auto& point, std::uint64_t h) { return point.first < h; });
+  if (it == ring_.end()) {
+    it = ring_.begin();
+  }
+  return it->second;
+}
+
+sw::redis::RedisCluster& EventStore::Cluster() {
+  if (auto* cluster = cluster_ready_.load(std::memory_order_acquire)) {
+    return *cluster;
+  }
+
+  std::lock_guard<std::mutex> lock{cluster_mtx_};
+  if (cluster_ == nullptr) {
+    // redis++ takes a single seed node, so try them in turn.
+    for (std::size_t i = 0; i < addresses_.size(); ++i) {
+      sw::redis::ConnectionOptions conn_opts{addresses_[i]};
+      conn_opts.connect_timeout = connection_opts_.connect_timeout;
+      conn_opts.socket_timeout = connection_opts_.socket_timeout;
+      try {
+        cluster_ =
+            std::make_unique<sw::redis::RedisCluster>(conn_opts, pool_opts_);
+        break;
+      } catch (const sw::redis::Error& e) {
+        if (i + 1 == addresses_.size()) {
+          throw;
+        }
+        AXY_LOG_DEBUG("Redis Cluster seed {} not reachable: {}", addresses_[i],
+                      e.what());
+      }
+    }
+    cluster_ready_.store(cluster_.get(), std::memory_order_release);
+  }
+  return *cluster_;
+}
+
+void EventStore::Ping() {
+  if (is_cluster_) {
+    // Any key will do, this only checks that its node is reachable.
+    Cluster().redis("axy", false).ping();
+    return;
+  }
+  for (auto& shard : shards_) {
+    shard->ping();
+  }
+}
+
+std::string EventStore::Describe() const {
+  if (is_cluster_) {
+    return fmt::format("Redis Cluster (seeds {})",
+                       fmt::join(addresses_, ", "));
+  }
+  if (addresses_.size() == 1) {
+    return addresses_.front();
+  }
+  return fmt::format("{} shards ({})", addresses_.size(),
+                     fmt::join(addresses_, ", "));
+}
+
+}  // namespace axy
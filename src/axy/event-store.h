@@ -0,0 +1,99 @@
+#ifndef AXY_SRC_AXY_EVENT_STORE_H_
+#define AXY_SRC_AXY_EVENT_STORE_H_
+
+#include <sw/redis++/redis++.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace axy {
+
+/// FNV-1a with the MurmurHash3 finalizer. Unlike `std::hash` it's the same
+/// for every build, so all instances agree on it, e.g. on where a
+/// conversation lives.
+std::uint64_t StableHash(std::string_view data);
+
+/** Redis streams holding the events of conversations.
+ *
+ * The events of a conversation live in the stream
+ * `sdifi/conversation/{conversation_id}`. Streams are either all on a single
+ * Redis server, spread over a Redis Cluster, or spread over independent Redis
+ * servers ("shards") by consistent hashing of the conversation ID. With
+ * consistent hashing, adding or removing a shard only moves the conversations
+ * of that shard.
+ *
+ * All axy instances sharing the event store must be given the same addresses,
+ * though not necessarily in the same order.
+ */
+class EventStore {
+ public:
+  struct Options {
+    /// Redis URIs, e.g. "tcp://localhost:6379". With `cluster`, these are
+    /// seed nodes of the cluster, otherwise shards.
+    std::vector<std::string> addresses{"tcp://localhost:6379"};
+    bool cluster = false;
+    /// Number of pooled connections per shard or cluster node.
+    std::size_t pool_size = 1;
+    /// 0 means no timeout.
+    std::chrono::milliseconds connect_timeout{0};
+    std::chrono::milliseconds socket_timeout{0};
+  };
+
+  /// Doesn't connect to anything yet, so this never blocks on Redis.
+  explicit EventStore(const Options& opts);
+
+  static std::string StreamKey(std::string_view conversation_id);
+
+  /** Call `fn` with the client responsible for the stream of
+   * `conversation_id`.
+   *
+   * The client is either a `sw::redis::Redis&` or a
+   * `sw::redis::RedisCluster&`, so `fn` should be a generic lambda. Both have
+   * the same stream commands.
+   */
+  template <typename Fn>
+  decltype(auto) WithClient(std::string_view conversation_id, Fn&& fn) {
+    if (is_cluster_) {
+      return std::forward<Fn>(fn)(Cluster());
+    }
+    return std::forward<Fn>(fn)(*shards_[ShardFor(conversation_id)]);
+  }
+
+  /// Throws `sw::redis::Error` unless all shards or the cluster are reachable.
+  void Ping();
+
+  /// E.g. "2 shards (tcp://a:6379, tcp://b:6379)", for logging.
+  std::string Describe() const;
+
+ private:
+  std::size_t ShardFor(std::string_view conversation_id) const;
+  /// The cluster client connects on construction, so it's created on first
+  /// use.
+  sw::redis::RedisCluster& Cluster();
+
+  const std::vector<std::string> addresses_;
+  const bool is_cluster_;
+  sw::redis::ConnectionOptions connection_opts_;
+  sw::redis::ConnectionPoolOptions pool_opts_;
+
+  std::vector<std::unique_ptr<sw::redis::Redis>> shards_;
+  /// Points on the hash ring and the shards owning the ranges ending at them,
+  /// sorted by point.
+  std::vector<std::pair<std::uint64_t, std::size_t>> ring_;
+
+  std::mutex cluster_mtx_;
+  std::unique_ptr<sw::redis::RedisCluster> cluster_;
+  std::atomic<sw::redis::RedisCluster*> cluster_ready_ = nullptr;
+};
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_EVENT_STORE_H_
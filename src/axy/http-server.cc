@@ -0,0 +1,388 @@
+#include "src/axy/http-server.h"
+
+#include <fmt/core.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include "src/axy/logging.h"
+
+namespace axy {
+
+namespace {
+
+constexpr std::size_t kMaxHeaderBytes = 16 * 1024;
+constexpr std::size_t kMaxBodyBytes = 1024 * 1024;
+/// Clients that take longer than this between bytes of their request are
+/// dropped, so idle connections don't keep their threads.
+constexpr std::chrono::seconds kRequestReadTimeout{10};
+
+std::string_view ReasonPhrase(int status) {
+  switch (status) {
+    case 101:
+      return "Switching Protocols";
+    case 200:
+      return "OK";
+    case 400:
+      return "Bad Request";
+    case 404:
+      return "Not Found";
+    case 405:
+      return "Method Not Allowed";
+    case 409:
+      return "Conflict";
+    case 426:
+      return "Upgrade Required";
+    case 500:
+      return "Internal Server Error";
+    case 501:
+      return "Not Implemented";
+    case 503:
+      return "Service Unavailable";
+    default:
+      return "Unknown";
+  }
+}
+
+std::string ToLower(std::string_view str) {
+  std::string lower{str};
+  std::transform(lower.begin(), lower.end(), lower.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return lower;
+}
+
+std::string_view Trim(std::string_view str) {
+  while (!str.empty() && (str.front() == ' ' || str.front() == '\t')) {
+    str.remove_prefix(1);
+  }
+  while (!str.empty() && (str.back() == ' ' || str.back() == '\t')) {
+    str.remove_suffix(1);
+  }
+  return str;
+}
+
+std::pair<std::string, std::string> SplitHostPort(const std::string& address) {
+  const auto colon = address.rfind(':');
+  if (colon == std::string::npos) {
+    throw std::invalid_argument{
+        fmt::format("address '{}' is missing a port", address)};
+  }
+  std::string host = address.substr(0, colon);
+  if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+    host = host.substr(1, host.size() - 2);
+  }
+  return {host, address.substr(colon + 1)};
+}
+
+/// Zero clears the timeout.
+void SetReceiveTimeout(int fd, std::chrono::seconds timeout) {
+  timeval tv{};
+  tv.tv_sec = static_cast<decltype(tv.tv_sec)>(timeout.count());
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+}  // namespace
+
+std::optional<std::string> HttpRequest::QueryParam(
+    std::string_view name) const {
+  std::string_view rest = query;
+  while (!rest.empty()) {
+    const auto amp = rest.find('&');
+    const auto param = rest.substr(0, amp);
+    rest = amp == std::string_view::npos ? "" : rest.substr(amp + 1);
+
+    const auto eq = param.find('=');
+    if (param.substr(0, eq) == name) {
+      return std::string{eq == std::string_view::npos ? ""
+                                                      : param.substr(eq + 1)};
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<HttpRequest> ReadHttpRequest(int fd) {
+  std::string buf;
+  std::size_t head_end = std::string::npos;
+  char chunk[4096];
+  while (head_end == std::string::npos) {
+    if (buf.size() > kMaxHeaderBytes) {
+      return std::nullopt;
+    }
+    const auto n = ::recv(fd, chunk, sizeof(chunk), 0);
+    if (n <= 0) {
+      return std::nullopt;
+    }
+    buf.append(chunk, n);
+    head_end = buf.find("\r\n\r\n");
+  }
+
+  HttpRequest req;
+  std::string_view head{buf.data(), head_end};
+  const auto line_end = head.find("\r\n");
+  const auto request_line = head.substr(0, line_end);
+  const auto sp1 = request_line.find(' ');
+  const auto sp2 = request_line.rfind(' ');
+  if (sp1 == std::string_view::npos || sp2 == sp1) {
+    return std::nullopt;
+  }
+  req.method = request_line.substr(0, sp1);
+  std::string_view target = request_line.substr(sp1 + 1, sp2 - sp1 - 1);
+  const auto qmark = target.find('?');
+  req.path = target.substr(0, qmark);
+  if (qmark != std::string_view::npos) {
+    req.query = target.substr(qmark + 1);
+  }
+
+  head = line_end == std::string_view::npos ? "" : head.substr(line_end + 2);
+  while (!head.empty()) {
+    const auto eol = head.find("\r\n");
+    const auto line = head.substr(0, eol);
+    head = eol == std::string_view::npos ? "" : head.substr(eol + 2);
+    const auto colon = line.find(':');
+    if (colon == std::string_view::npos) {
+      continue;
+    }
+    req.headers[ToLower(Trim(line.substr(0, colon)))] =
+        Trim(line.substr(colon + 1));
+  }
+
+  std::size_t content_length = 0;
+  if (auto it = req.headers.find("content-length"); it != req.headers.end()) {
+    const auto& value = it->second;
+    const auto [ptr, ec] = std::from_chars(
+        value.data(), value.data() + value.size(), content_length);
+    if (ec != std::errc{} || content_length > kMaxBodyBytes) {
+      return std::nullopt;
+    }
+  }
+
+  req.body = buf.substr(head_end + 4);
+  while (req.body.size() < content_length) {
+    const auto n = ::recv(fd, chunk, sizeof(chunk), 0);
+    if (n <= 0) {
+      return std::nullopt;
+    }
+    req.body.append(chunk, n);
+  }
+  req.body.resize(std::min(req.body.size(), content_length));
+
+  return req;
+}
+
+bool WriteAll(int fd, std::string_view data) {
+  while (!data.empty()) {
+    const auto n = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data.remove_prefix(n);
+  }
+  return true;
+}
+
+bool WriteHttpResponse(int fd, const HttpResponse& response) {
+  std::string head =
+      fmt::format("HTTP/1.1 {} {}\r\nContent-Type: {}\r\n", response.status,
+                  ReasonPhrase(response.status), response.content_type);
+  for (const auto& [name, value] : response.headers) {
+    head += fmt::format("{}: {}\r\n", name, value);
+  }
+  head += fmt::format("Content-Length: {}\r\nConnection: close\r\n\r\n",
+                      response.body.size());
+  return WriteAll(fd, head) && WriteAll(fd, response.body);
+}
+
+HttpServer::HttpServer(std::string address, bool reuse_port,
+                       std::size_t max_connections)
+    : address_{std::move(address)},
+      reuse_port_{reuse_port},
+      max_connections_{max_connections} {}
+
+HttpServer::~HttpServer() { Shutdown(); }
+
+void HttpServer::Handle(std::string path, Handler handler) {
+  handlers_[std::move(path)] = std::move(handler);
+}
+
+void HttpServer::HandleUpgrade(std::string path, UpgradeHandler handler) {
+  upgrade_handlers_[std::move(path)] = std::move(handler);
+}
+
+void HttpServer::Start() {
+  const auto [host, port] = SplitHostPort(address_);
+
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  addrinfo* result = nullptr;
+  if (int err = ::getaddrinfo(host.empty() ? nullptr : host.c_str(),
+                              port.c_str(), &hints, &result);
+      err != 0) {
+    throw std::invalid_argument{fmt::format(
+        "could not resolve '{}': {}", address_, ::gai_strerror(err))};
+  }
+  std::unique_ptr<addrinfo, decltype(&::freeaddrinfo)> addrs{result,
+                                                             ::freeaddrinfo};
+
+  int last_errno = 0;
+  for (auto* ai = addrs.get(); ai != nullptr; ai = ai->ai_next) {
+    int fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                      ai->ai_protocol);
+    if (fd < 0) {
+      last_errno = errno;
+      continue;
+    }
+    int one = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (reuse_port_) {
+      ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    }
+    if (::bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+        ::listen(fd, SOMAXCONN) == 0) {
+      listen_fd_ = fd;
+      break;
+    }
+    last_errno = errno;
+    ::close(fd);
+  }
+
+  if (listen_fd_ < 0) {
+    throw std::system_error{last_errno, std::generic_category(),
+                            fmt::format("could not listen on '{}'", address_)};
+  }
+
+  accept_thread_ =
+      std::jthread{[this](std::stop_token stop) { AcceptLoop(stop); }};
+  AXY_LOG_INFO("HTTP server listening on {}", address_);
+}
+
+void HttpServer::Shutdown() {
+  if (listen_fd_ < 0) {
+    return;
+  }
+
+  accept_thread_.request_stop();
+  // Wakes up the blocking accept()
+  ::shutdown(listen_fd_, SHUT_RDWR);
+  if (accept_thread_.joinable()) {
+    accept_thread_.join();
+  }
+  ::close(listen_fd_);
+  listen_fd_ = -1;
+
+  std::list<Connection> connections;
+  {
+    std::lock_guard<std::mutex> lock{connections_mtx_};
+    for (auto& conn : connections_) {
+      if (conn.fd >= 0) {
+        ::shutdown(conn.fd, SHUT_RDWR);
+      }
+    }
+    connections.splice(connections.end(), connections_);
+  }
+  // Joins the connection threads
+  connections.clear();
+}
+
+void HttpServer::AcceptLoop(std::stop_token stop) {
+  while (!stop.stop_requested()) {
+    int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      if (!stop.stop_requested()) {
+        AXY_LOG_ERROR("HTTP server on {} failed to accept: {}", address_,
+                      std::system_category().message(errno));
+      }
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock{connections_mtx_};
+    ReapConnectionsLocked();
+    if (connections_.size() >= max_connections_) {
+      lock.unlock();
+      AXY_LOG_WARN("HTTP server on {} has {} connections, turning one away.",
+                   address_, max_connections_);
+      WriteHttpResponse(fd, {.status = 503, .body = "Too many connections\n"});
+      ::close(fd);
+      continue;
+    }
+    auto& conn = connections_.emplace_back();
+    conn.fd = fd;
+    conn.thread = std::jthread{[this, &conn]() {
+      Serve(conn);
+      // Under the lock, so Shutdown() doesn't shut down the fd once it may
+      // have been reused.
+      std::lock_guard<std::mutex> lock{connections_mtx_};
+      ::close(conn.fd);
+      conn.fd = -1;
+      conn.done = true;
+    }};
+  }
+}
+
+void HttpServer::Serve(Connection& conn) {
+  SetReceiveTimeout(conn.fd, kRequestReadTimeout);
+  auto req = ReadHttpRequest(conn.fd);
+  if (!req) {
+    WriteHttpResponse(conn.fd, {.status = 400, .body = "Bad request\n"});
+    return;
+  }
+  // Upgraded connections may rightly stay quiet for long.
+  SetReceiveTimeout(conn.fd, std::chrono::seconds{0});
+
+  if (const auto it = upgrade_handlers_.find(req->path);
+      it != upgrade_handlers_.cend()) {
+    try {
+      it->second(*req, conn.fd);
+    } catch (const std::exception& e) {
+      AXY_LOG_ERROR("Unhandled exception in upgrade handler for {}: {}",
+                    req->path, e.what());
+    }
+    return;
+  }
+
+  const auto it = handlers_.find(req->path);
+  if (it == handlers_.cend()) {
+    WriteHttpResponse(conn.fd, {.status = 404, .body = "Not found\n"});
+    return;
+  }
+
+  HttpResponse res;
+  try {
+    res = it->second(*req);
+  } catch (const std::exception& e) {
+    AXY_LOG_ERROR("Unhandled exception in HTTP handler for {}: {}", req->path,
+                  e.what());
+    res = {.status = 500, .body = "Internal server error\n"};
+  }
+  WriteHttpResponse(conn.fd, res);
+}
+
+void HttpServer::ReapConnectionsLocked() {
+  connections_.remove_if(
+      [](const Connection& conn) { return conn.done.load(); });
+}
+
+}  // namespace axy
@@ -0,0 +1,118 @@
+#ifndef AXY_SRC_AXY_HTTP_SERVER_H_
+#define AXY_SRC_AXY_HTTP_SERVER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace axy {
+
+struct HttpRequest {
+  std::string method;
+  std::string path;
+  std::string query;
+  /// Header names are lowercased.
+  std::map<std::string, std::string> headers;
+  std::string body;
+
+  std::optional<std::string> QueryParam(std::string_view name) const;
+};
+
+struct HttpResponse {
+  int status = 200;
+  std::string content_type = "text/plain; charset=utf-8";
+  std::vector<std::pair<std::string, std::string>> headers;
+  std::string body;
+};
+
+/** A minimal, blocking HTTP/1.1 server for admin and debug endpoints.
+ *
+ * Each connection gets its own thread and serves a single request, so this is
+ * only meant for low volume traffic like metrics scrapes. Upgraded
+ * connections (e.g. WebSockets) keep their thread until they are closed.
+ * Connections beyond `max_connections` are turned away with a 503, and
+ * clients that stall while sending their request are dropped.
+ */
+class HttpServer {
+ public:
+  using Handler = std::function<HttpResponse(const HttpRequest&)>;
+  /// Takes over the connection `fd` after the request head has been read.
+  /// The handler writes its own response and the connection is closed when
+  /// it returns. `fd` is shut down on `Shutdown()`, so blocking reads fail.
+  using UpgradeHandler = std::function<void(const HttpRequest&, int fd)>;
+
+  /// `address` is `host:port`, e.g. "0.0.0.0:9090" or "[::1]:9090". With
+  /// `reuse_port`, other processes may listen on the same address and the
+  /// kernel spreads connections over them.
+  explicit HttpServer(std::string address, bool reuse_port = false,
+                      std::size_t max_connections = 256);
+  ~HttpServer();
+
+  HttpServer(const HttpServer&) = delete;
+  HttpServer& operator=(const HttpServer&) = delete;
+
+  /// Register a handler for an exact path. Must be called before Start().
+  void Handle(std::string path, Handler handler);
+
+  /// Register a handler that takes over connections for an exact path. Must
+  /// be called before Start().
+  void HandleUpgrade(std::string path, UpgradeHandler handler);
+
+  /// Bind, listen and start accepting connections.
+  ///
+  /// \throws std::system_error if we can't listen on the address.
+  void Start();
+
+  /// Stop accepting connections and wait for the active ones to finish.
+  void Shutdown();
+
+  const std::string& address() const { return address_; }
+
+ private:
+  struct Connection {
+    /// -1 once closed. Guarded by `connections_mtx_`.
+    int fd;
+    std::atomic<bool> done = false;
+    std::jthread thread;
+  };
+
+  void AcceptLoop(std::stop_token stop);
+  void Serve(Connection& conn);
+  void ReapConnectionsLocked();
+
+  const std::string address_;
+  const bool reuse_port_;
+  const std::size_t max_connections_;
+  std::map<std::string, Handler> handlers_;
+  std::map<std::string, UpgradeHandler> upgrade_handlers_;
+
+  int listen_fd_ = -1;
+  std::jthread accept_thread_;
+
+  std::mutex connections_mtx_;
+  std::list<Connection> connections_;
+};
+
+/// Read an HTTP request head and body from `fd`.
+std::optional<HttpRequest> ReadHttpRequest(int fd);
+
+/// Write a full HTTP response to `fd`.
+bool WriteHttpResponse(int fd, const HttpResponse& response);
+
+/// Write all of `data` to `fd`, retrying on short writes.
+bool WriteAll(int fd, std::string_view data);
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_HTTP_SERVER_H_
@@ -0,0 +1,144 @@
+#include "src/axy/idle-reaper.h"
+
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <utility>
+
+namespace axy {
+
+namespace {
+
+std::size_t Index(IdleReaper::Party party) {
+  return static_cast<std::size_t>(party);
+}
+
+std::size_t Index(IdleReaper::Reason reason) {
+  return static_cast<std::size_t>(reason);
+}
+
+}  // namespace
+
+IdleReaper::Watch::Watch(IdleReaper* reaper, ExpireCallback on_expire)
+    : reaper_{reaper},
+      on_expire_{std::move(on_expire)},
+      started_at_{Clock::now()} {}
+
+IdleReaper::Watch::~Watch() { Stop(); }
+
+void IdleReaper::Watch::Await(Party party) {
+  const std::int64_t since =
+      std::chrono::nanoseconds{Clock::now() - started_at_}.count() + 1;
+  std::int64_t not_waiting = 0;
+  waiting_since_[Index(party)].compare_exchange_strong(
+      not_waiting, since, std::memory_order_relaxed);
+}
+
+void IdleReaper::Watch::Heard(Party party) {
+  waiting_since_[Index(party)].store(0, std::memory_order_relaxed);
+}
+
+void IdleReaper::Watch::Stop() {
+  TimerWheel::TimerId timer;
+  {
+    std::lock_guard<std::mutex> lock{mtx_};
+    if (stopped_) {
+      return;
+    }
+    stopped_ = true;
+    timer = timer_;
+  }
+  // Waits for a running check, which won't schedule another one.
+  reaper_->timers_->Cancel(timer);
+}
+
+void IdleReaper::Watch::Check() {
+  const auto now = Clock::now();
+  const auto& timeouts = reaper_->timeouts_;
+  auto next_check = Clock::time_point::max();
+  std::optional<Reason> expired;
+  const auto check = [&](Clock::time_point deadline, Reason reason) {
+    if (deadline <= now) {
+      expired = expired.value_or(reason);
+    } else {
+      next_check = std::min(next_check, deadline);
+    }
+  };
+
+  if (timeouts.max_duration.count() > 0) {
+    check(started_at_ + timeouts.max_duration, Reason::kMaxDuration);
+  }
+  for (const auto& [party, timeout, reason] :
+       {std::tuple{Party::kClient, timeouts.client_idle, Reason::kClientIdle},
+        std::tuple{Party::kBackend, timeouts.backend_idle,
+                   Reason::kBackendIdle}}) {
+    if (timeout.count() <= 0) {
+      continue;
+    }
+    const auto since =
+        waiting_since_[Index(party)].load(std::memory_order_relaxed);
+    if (since == 0) {
+      // Can't expire before the next time we start waiting.
+      next_check = std::min(next_check, now + timeout);
+    } else {
+      check(started_at_ + std::chrono::nanoseconds{since - 1} + timeout,
+            reason);
+    }
+  }
+
+  if (expired) {
+    reaper_->expired_[Index(*expired)]->Increment();
+    on_expire_(*expired);
+    return;
+  }
+  ScheduleCheck(next_check - now);
+}
+
+void IdleReaper::Watch::ScheduleCheck(Clock::duration delay) {
+  std::lock_guard<std::mutex> lock{mtx_};
+  if (!stopped_) {
+    timer_ = reaper_->timers_->Schedule(delay, [this] { Check(); });
+  }
+}
+
+IdleReaper::IdleReaper(std::shared_ptr<TimerWheel> timers,
+                       StreamTimeouts timeouts)
+    : timers_{std::move(timers)}, timeouts_{timeouts} {
+  for (const auto reason :
+       {Reason::kClientIdle, Reason::kBackendIdle, Reason::kMaxDuration}) {
+    expired_[Index(reason)] = &MetricsRegistry::Global().GetCounter(
+        "axy_streams_expired_total",
+        "Speech streams closed with DEADLINE_EXCEEDED by a stream timeout.",
+        {{"reason", std::string{ToString(reason)}}});
+  }
+}
+
+std::shared_ptr<IdleReaper::Watch> IdleReaper::Start(ExpireCallback on_expire) {
+  std::shared_ptr<Watch> watch{new Watch{this, std::move(on_expire)}};
+  const auto& t = timeouts_;
+  auto first_check = Watch::Clock::duration::max();
+  for (const auto timeout : {t.client_idle, t.backend_idle, t.max_duration}) {
+    if (timeout.count() > 0) {
+      first_check = std::min<Watch::Clock::duration>(first_check, timeout);
+    }
+  }
+  if (first_check != Watch::Clock::duration::max()) {
+    watch->ScheduleCheck(first_check);
+  }
+  return watch;
+}
+
+std::string_view ToString(IdleReaper::Reason reason) {
+  switch (reason) {
+    case IdleReaper::Reason::kClientIdle:
+      return "client_idle";
+    case IdleReaper::Reason::kBackendIdle:
+      return "backend_idle";
+    case IdleReaper::Reason::kMaxDuration:
+      return "max_duration";
+  }
+  return "unknown";
+}
+
+}  // namespace axy
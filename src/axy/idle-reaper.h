@@ -0,0 +1,98 @@
+#ifndef AXY_SRC_AXY_IDLE_REAPER_H_
+#define AXY_SRC_AXY_IDLE_REAPER_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+
+#include "src/axy/metrics.h"
+#include "src/axy/timer-wheel.h"
+
+namespace axy {
+
+/// Limits for a single stream. 0 disables a limit.
+struct StreamTimeouts {
+  /// How long we wait for the next message from the client.
+  std::chrono::milliseconds client_idle{0};
+  /// How long we wait for a response after sending the backend audio.
+  std::chrono::milliseconds backend_idle{0};
+  /// How long a stream may stay open at all.
+  std::chrono::milliseconds max_duration{0};
+
+  bool enabled() const {
+    return client_idle.count() > 0 || backend_idle.count() > 0 ||
+           max_duration.count() > 0;
+  }
+};
+
+/** Expires streams that exceed their `StreamTimeouts`.
+ *
+ * Each stream reports when it starts and stops waiting on either side, which
+ * is only a couple of atomic stores. The checks run on a shared
+ * `TimerWheel`, so idle streams cost no threads and no per-message timers.
+ */
+class IdleReaper {
+ public:
+  enum class Party { kClient, kBackend };
+  enum class Reason { kClientIdle, kBackendIdle, kMaxDuration };
+  using ExpireCallback = std::function<void(Reason)>;
+
+  /// The timeouts of one stream, checked until `Stop()` is called.
+  class Watch {
+   public:
+    ~Watch();
+
+    /// Start waiting on `party`, unless we already are.
+    void Await(Party party);
+    /// `party` did its part, stop waiting on it.
+    void Heard(Party party);
+
+    /// No expiry callback is running or will run once this returns, so the
+    /// stream may be destroyed. Must not be called with locks held that the
+    /// expiry callback takes.
+    void Stop();
+
+   private:
+    friend class IdleReaper;
+    using Clock = TimerWheel::Clock;
+
+    Watch(IdleReaper* reaper, ExpireCallback on_expire);
+    void Check();
+    void ScheduleCheck(Clock::duration delay);
+
+    IdleReaper* reaper_;
+    const ExpireCallback on_expire_;
+    const Clock::time_point started_at_;
+    /// Nanoseconds since `started_at_` at which we started waiting on each
+    /// party, offset by one so 0 means we aren't waiting.
+    std::array<std::atomic<std::int64_t>, 2> waiting_since_{};
+
+    std::mutex mtx_;
+    bool stopped_ = false;
+    TimerWheel::TimerId timer_ = 0;
+  };
+
+  IdleReaper(std::shared_ptr<TimerWheel> timers, StreamTimeouts timeouts);
+
+  /// Start checking the timeouts of a new stream. `on_expire` is called on
+  /// the timer thread at most once, after which the stream should finish.
+  std::shared_ptr<Watch> Start(ExpireCallback on_expire);
+
+  const StreamTimeouts& timeouts() const { return timeouts_; }
+
+ private:
+  const std::shared_ptr<TimerWheel> timers_;
+  const StreamTimeouts timeouts_;
+  std::array<Counter*, 3> expired_;
+};
+
+std::string_view ToString(IdleReaper::Reason reason);
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_IDLE_REAPER_H_
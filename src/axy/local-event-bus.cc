@@ -0,0 +1,127 @@
+#include "src/axy/local-event-bus.h"
+
+#include <stdexcept>
+#include <utility>
+
+namespace axy {
+
+EventRing::EventRing(std::size_t capacity) : slots_(capacity) {
+  if (capacity == 0) {
+    throw std::invalid_argument{"Event ring capacity must be positive."};
+  }
+}
+
+std::uint64_t EventRing::end() const {
+  std::lock_guard<std::mutex> lock{mtx_};
+  return end_;
+}
+
+bool EventRing::ReadFrom(std::uint64_t* cursor,
+                         std::vector<ConversationEvent>* out) {
+  std::lock_guard<std::mutex> lock{mtx_};
+  bool complete = true;
+  if (end_ - *cursor > slots_.size()) {
+    complete = false;
+    *cursor = end_ - slots_.size();
+  }
+  for (; *cursor < end_; ++*cursor) {
+    out->push_back(slots_[*cursor % slots_.size()]);
+  }
+  return complete;
+}
+
+void EventRing::Push(ConversationEvent event) {
+  {
+    std::lock_guard<std::mutex> lock{mtx_};
+    slots_[end_ % slots_.size()] = std::move(event);
+    ++end_;
+  }
+  std::lock_guard<std::mutex> lock{listeners_mtx_};
+  for (const auto& listener : listeners_) {
+    listener();
+  }
+}
+
+LocalEventBus::Subscription::Subscription(Subscription&& other) noexcept
+    : bus_{std::exchange(other.bus_, nullptr)},
+      conversation_id_{std::move(other.conversation_id_)},
+      ring_{std::move(other.ring_)},
+      listener_{other.listener_} {}
+
+LocalEventBus::Subscription& LocalEventBus::Subscription::operator=(
+    Subscription&& other) noexcept {
+  if (this != &other) {
+    Reset();
+    bus_ = std::exchange(other.bus_, nullptr);
+    conversation_id_ = std::move(other.conversation_id_);
+    ring_ = std::move(other.ring_);
+    listener_ = other.listener_;
+  }
+  return *this;
+}
+
+LocalEventBus::Subscription::~Subscription() { Reset(); }
+
+void LocalEventBus::Subscription::Reset() {
+  if (bus_ != nullptr) {
+    bus_->Unsubscribe(*this);
+    bus_ = nullptr;
+    ring_.reset();
+  }
+}
+
+LocalEventBus::LocalEventBus(std::size_t ring_capacity)
+    : ring_capacity_{ring_capacity} {}
+
+LocalEventBus::Subscription LocalEventBus::Subscribe(
+    const std::string& conversation_id, EventRing::Listener listener) {
+  Subscription subscription;
+  std::lock_guard<std::mutex> lock{mtx_};
+  auto& ring = rings_[conversation_id];
+  if (ring == nullptr) {
+    ring = std::make_shared<EventRing>(ring_capacity_);
+  }
+  {
+    std::lock_guard<std::mutex> listeners_lock{ring->listeners_mtx_};
+    subscription.listener_ =
+        ring->listeners_.insert(ring->listeners_.end(), std::move(listener));
+  }
+  subscription.bus_ = this;
+  subscription.conversation_id_ = conversation_id;
+  subscription.ring_ = ring;
+  return subscription;
+}
+
+void LocalEventBus::Unsubscribe(Subscription& subscription) {
+  auto& ring = *subscription.ring_;
+  {
+    std::lock_guard<std::mutex> listeners_lock{ring.listeners_mtx_};
+    ring.listeners_.erase(subscription.listener_);
+  }
+
+  std::lock_guard<std::mutex> lock{mtx_};
+  std::lock_guard<std::mutex> listeners_lock{ring.listeners_mtx_};
+  // The ring may already have been replaced, if another subscription of it
+  // got here first and a new watcher subscribed since.
+  if (const auto it = rings_.find(subscription.conversation_id_);
+      ring.listeners_.empty() && it != rings_.end() &&
+      it->second.get() == &ring) {
+    rings_.erase(it);
+  }
+}
+
+void LocalEventBus::Publish(const ConversationEvent& event) {
+  std::shared_ptr<EventRing> ring;
+  {
+    std::lock_guard<std::mutex> lock{mtx_};
+    if (const auto it = rings_.find(event.conversation_id);
+        it != rings_.end()) {
+      ring = it->second;
+    }
+  }
+  if (ring != nullptr) {
+    ring->Push(event);
+  }
+}
+
+}  // namespace axy
@@ -0,0 +1,110 @@
+#ifndef AXY_SRC_AXY_LOCAL_EVENT_BUS_H_
+#define AXY_SRC_AXY_LOCAL_EVENT_BUS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "src/axy/event-sink.h"
+
+namespace axy {
+
+/** Broadcast ring of the most recent events of one conversation.
+ *
+ * All watchers of the conversation read the same copy of each event, each at
+ * its own cursor. A watcher that falls more than `capacity` events behind
+ * misses events and has to get them from Redis.
+ */
+class EventRing {
+ public:
+  using Listener = std::function<void()>;
+
+  explicit EventRing(std::size_t capacity);
+
+  /// Sequence number of the next event to be pushed.
+  std::uint64_t end() const;
+
+  /** Append the events from `*cursor` on to `out` and move the cursor to the
+   * end.
+   *
+   * \returns false if some of these events were already overwritten.
+   */
+  bool ReadFrom(std::uint64_t* cursor, std::vector<ConversationEvent>* out);
+
+ private:
+  friend class LocalEventBus;
+
+  void Push(ConversationEvent event);
+
+  mutable std::mutex mtx_;
+  std::vector<ConversationEvent> slots_;
+  std::uint64_t end_ = 0;
+
+  /// Called after each push, with `listeners_mtx_` held.
+  std::mutex listeners_mtx_;
+  std::list<Listener> listeners_;
+};
+
+/** Delivers events to watchers of conversations on this instance.
+ *
+ * Speech streams publish every event here as well as to Redis, and watchers
+ * subscribe to their conversation. Rings only exist for conversations that
+ * have local watchers, so publishing to a conversation nobody watches here is
+ * a single lookup.
+ */
+class LocalEventBus final : public EventSink {
+ public:
+  class Subscription {
+   public:
+    Subscription() = default;
+    Subscription(Subscription&& other) noexcept;
+    Subscription& operator=(Subscription&& other) noexcept;
+    ~Subscription();
+
+    /// The ring of the conversation, to read events from.
+    EventRing& ring() const { return *ring_; }
+
+   private:
+    friend class LocalEventBus;
+
+    void Reset();
+
+    LocalEventBus* bus_ = nullptr;
+    std::string conversation_id_;
+    std::shared_ptr<EventRing> ring_;
+    std::list<EventRing::Listener>::iterator listener_;
+  };
+
+  explicit LocalEventBus(std::size_t ring_capacity);
+
+  /** Call `listener` after each event published to `conversation_id`, until
+   * the subscription is destroyed.
+   *
+   * `listener` runs on the publishing thread, so it must be quick. It may
+   * read from the ring, but must not subscribe or unsubscribe. Destroying the
+   * subscription waits for running calls of `listener` to finish.
+   */
+  Subscription Subscribe(const std::string& conversation_id,
+                         EventRing::Listener listener);
+
+  void Publish(const ConversationEvent& event) override;
+
+ private:
+  void Unsubscribe(Subscription& subscription);
+
+  const std::size_t ring_capacity_;
+
+  std::mutex mtx_;
+  std::unordered_map<std::string, std::shared_ptr<EventRing>> rings_;
+};
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_LOCAL_EVENT_BUS_H_
@@ -1,13 +1,142 @@
 #include "src/axy/logging.h"
 
+#include <fmt/chrono.h>
 #include <grpc/support/log.h>
+#include <spdlog/async.h>
 #include <spdlog/common.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
+#include <stop_token>
+#include <thread>
+
+#include "src/axy/metrics.h"
 
 namespace axy {
 
+namespace {
+
+std::atomic<unsigned> g_max_lines_per_site =
+    LoggingOptions{}.max_lines_per_site;
+std::atomic<unsigned> g_max_lines_per_conversation =
+    LoggingOptions{}.max_lines_per_conversation;
+
+std::jthread g_flusher_thread;
+
+Counter& DroppedLines(const std::string& reason) {
+  return MetricsRegistry::Global().GetCounter(
+      "axy_log_lines_dropped_total",
+      "Log lines dropped because of rate limiting or a full log buffer.",
+      {{"reason", reason}});
+}
+
+Counter& RateLimitedLines() {
+  static Counter& counter = DroppedLines("rate_limited");
+  return counter;
+}
+
+std::int64_t CurrentSecond() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+bool Drop() {
+  RateLimitedLines().Increment();
+  return false;
+}
+
+/// Periodically flushes the default logger and reports dropped lines.
+void FlushLoop(std::stop_token stop, std::chrono::milliseconds interval) {
+  Counter& queue_full = DroppedLines("queue_full");
+  Counter& rate_limited = RateLimitedLines();
+  std::size_t last_overruns = 0;
+  double last_rate_limited = rate_limited.value();
+
+  std::mutex mtx;
+  std::condition_variable_any cv;
+  while (!stop.stop_requested()) {
+    {
+      std::unique_lock<std::mutex> lock{mtx};
+      cv.wait_for(lock, stop, interval, [] { return false; });
+    }
+    spdlog::default_logger_raw()->flush();
+
+    const auto overruns = spdlog::thread_pool()->overrun_counter();
+    const auto new_overruns = overruns - last_overruns;
+    last_overruns = overruns;
+    queue_full.Increment(static_cast<double>(new_overruns));
+
+    const auto new_rate_limited = rate_limited.value() - last_rate_limited;
+    last_rate_limited += new_rate_limited;
+
+    if (new_overruns > 0 || new_rate_limited > 0) {
+      AXY_LOG_WARN(
+          "Dropped log lines in the last {}: {} rate limited, {} over the log "
+          "buffer.",
+          interval, new_rate_limited, new_overruns);
+    }
+  }
+}
+
+}  // namespace
+
+namespace internal {
+
+bool LogRateLimiter::Allow() {
+  const auto limit = g_max_lines_per_site.load(std::memory_order_relaxed);
+  if (limit == 0 || site_.Allow(CurrentSecond(), limit)) {
+    return true;
+  }
+  return Drop();
+}
+
+bool KeyedLogRateLimiter::Allow(std::string_view key) {
+  const auto now = CurrentSecond();
+  const auto key_limit =
+      g_max_lines_per_conversation.load(std::memory_order_relaxed);
+  if (key_limit != 0 &&
+      !keys_[std::hash<std::string_view>{}(key) % kSlots].Allow(now,
+                                                                 key_limit)) {
+    return Drop();
+  }
+  const auto site_limit = g_max_lines_per_site.load(std::memory_order_relaxed);
+  if (site_limit != 0 && !site_.Allow(now, site_limit)) {
+    return Drop();
+  }
+  return true;
+}
+
+}  // namespace internal
+
+void InitLogging(const LoggingOptions& opts) {
+  g_max_lines_per_site = opts.max_lines_per_site;
+  g_max_lines_per_conversation = opts.max_lines_per_conversation;
+
+  spdlog::init_thread_pool(opts.queue_size, 1);
+  auto logger = std::make_shared<spdlog::async_logger>(
+      "", std::make_shared<spdlog::sinks::stdout_color_sink_mt>(),
+      spdlog::thread_pool(), spdlog::async_overflow_policy::overrun_oldest);
+  logger->set_level(spdlog::get_level());
+  logger->flush_on(spdlog::level::err);
+  spdlog::set_default_logger(std::move(logger));
+
+  g_flusher_thread = std::jthread{[interval = opts.flush_interval](
+                                      std::stop_token stop) {
+    FlushLoop(stop, interval);
+  }};
+}
+
+void ShutdownLogging() {
+  g_flusher_thread = {};
+  spdlog::shutdown();
+}
+
 void SetLogLevel(LogLevel level) {
   switch (level) {
     case LogLevel::kError:
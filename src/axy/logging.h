@@ -3,18 +3,132 @@
 
 #include <spdlog/spdlog.h>
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 
 namespace axy {
 
+namespace internal {
+
+/// Counts log lines per one second window. Approximate under contention, but
+/// never blocks.
+class LogWindow {
+ public:
+  bool Allow(std::int64_t second, unsigned limit) {
+    auto current = second_.load(std::memory_order_relaxed);
+    if (current != second &&
+        second_.compare_exchange_strong(current, second,
+                                        std::memory_order_relaxed)) {
+      count_.store(0, std::memory_order_relaxed);
+    }
+    return count_.fetch_add(1, std::memory_order_relaxed) < limit;
+  }
+
+ private:
+  std::atomic<std::int64_t> second_ = 0;
+  std::atomic<std::uint32_t> count_ = 0;
+};
+
+/// Rate limits a single logging call site. One of these is a function local
+/// static in every expansion of the debug and trace logging macros.
+class LogRateLimiter {
+ public:
+  bool Allow();
+
+ private:
+  LogWindow site_;
+};
+
+/// Rate limits a single logging call site, both in total and for each key
+/// (conversation). Keys are hashed into a fixed number of slots, so unrelated
+/// conversations occasionally share a budget.
+class KeyedLogRateLimiter {
+ public:
+  bool Allow(std::string_view key);
+
+ private:
+  static constexpr std::size_t kSlots = 64;
+
+  LogWindow site_;
+  std::array<LogWindow, kSlots> keys_;
+};
+
+}  // namespace internal
+
+#define AXY_LOG_RATE_LIMITED_(level, ...)                             \
+  do {                                                                \
+    if (spdlog::default_logger_raw()->should_log(level)) {            \
+      static ::axy::internal::LogRateLimiter axy_log_limiter_;        \
+      if (axy_log_limiter_.Allow()) {                                 \
+        spdlog::log(level, __VA_ARGS__);                              \
+      }                                                               \
+    }                                                                 \
+  } while (false)
+
+#define AXY_CONV_LOG_RATE_LIMITED_(level, conversation_id, ...)      \
+  do {                                                                \
+    if (spdlog::default_logger_raw()->should_log(level)) {            \
+      static ::axy::internal::KeyedLogRateLimiter axy_log_limiter_;   \
+      if (axy_log_limiter_.Allow(conversation_id)) {                  \
+        spdlog::log(level, __VA_ARGS__);                              \
+      }                                                               \
+    }                                                                 \
+  } while (false)
+
 #define AXY_LOG_WARN(...) spdlog::warn(__VA_ARGS__)
 #define AXY_LOG_INFO(...) spdlog::info(__VA_ARGS__)
-#define AXY_LOG_DEBUG(...) spdlog::debug(__VA_ARGS__)
-#define AXY_LOG_TRACE(...) spdlog::trace(__VA_ARGS__)
+/// Debug and trace lines are rate limited per call site, see `LoggingOptions`.
+#define AXY_LOG_DEBUG(...) \
+  AXY_LOG_RATE_LIMITED_(spdlog::level::debug, __VA_ARGS__)
+#define AXY_LOG_TRACE(...) \
+  AXY_LOG_RATE_LIMITED_(spdlog::level::trace, __VA_ARGS__)
 #define AXY_LOG_ERROR(...) spdlog::error(__VA_ARGS__)
 
+/// Like `AXY_LOG_DEBUG`/`AXY_LOG_TRACE`, but additionally rate limited per
+/// conversation, so one chatty conversation can't use up the budget of a call
+/// site. Use these on per-message paths.
+#define AXY_CONV_LOG_DEBUG(conversation_id, ...)                   \
+  AXY_CONV_LOG_RATE_LIMITED_(spdlog::level::debug, conversation_id, \
+                             __VA_ARGS__)
+#define AXY_CONV_LOG_TRACE(conversation_id, ...)                   \
+  AXY_CONV_LOG_RATE_LIMITED_(spdlog::level::trace, conversation_id, \
+                             __VA_ARGS__)
+
 enum class LogLevel { kError, kWarn, kInfo, kDebug, kTrace };
 
+struct LoggingOptions {
+  /// Number of log lines buffered for the background writer. When the buffer
+  /// is full, the oldest lines are dropped instead of blocking the caller.
+  std::size_t queue_size = 8192;
+  /// How often the background writer flushes and reports dropped lines.
+  std::chrono::milliseconds flush_interval{1000};
+  /// Debug and trace lines per second allowed from a single call site,
+  /// 0 for unlimited.
+  unsigned max_lines_per_site = 200;
+  /// Debug and trace lines per second allowed from a single call site for a
+  /// single conversation, 0 for unlimited.
+  unsigned max_lines_per_conversation = 20;
+};
+
+/** Replace the default logger with an asynchronous one.
+ *
+ * Log lines are formatted on the calling thread and written to stdout by a
+ * background thread. Dropped lines, either due to rate limiting or a full
+ * buffer, are counted in `axy_log_lines_dropped_total` and periodically
+ * reported in the log.
+ *
+ * This needs to be called before SetLogLevel.
+ */
+void InitLogging(const LoggingOptions& opts);
+
+/// Flush outstanding log lines and stop the background writer.
+void ShutdownLogging();
+
 void SetLogLevel(LogLevel level);
 
 void SetLogLevel(const std::string& level);
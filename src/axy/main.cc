@@ -4,16 +4,21 @@
 #include <csignal>
 #include <cstdio>
 #include <cstdlib>
+#include <chrono>
 #include <exception>
 #include <memory>
 #include <string>
 #include <thread>
+#include <utility>
+#include <vector>
 
 #include "CLI/Validators.hpp"
 #include "internal_use_only/config.h"
 #include "src/axy/logging.h"
 #include "src/axy/server.h"
+#include "src/axy/speech-router.h"
 #include "src/axy/speech-service.h"
+#include "src/axy/supervisor.h"
 
 std::atomic_flag g_stop_flag = ATOMIC_FLAG_INIT;
 
@@ -48,8 +53,24 @@ int main(int argc, char* argv[]) {
         ->check(CLI::IsMember({"trace", "debug", "info", "warn", "error"}))
         ->ignore_case();
 
+    axy::LoggingOptions logging_opts;
+    app.add_option("--log-queue-size", logging_opts.queue_size,
+                   "Log lines buffered for the background log writer. The "
+                   "oldest lines are dropped when it's full.");
+    app.add_option("--log-lines-per-second", logging_opts.max_lines_per_site,
+                   "Debug and trace lines allowed per second from each place "
+                   "in the code. 0 for unlimited.");
+    app.add_option("--log-lines-per-conversation",
+                   logging_opts.max_lines_per_conversation,
+                   "Debug and trace lines allowed per second from each place "
+                   "in the code for a single conversation. 0 for unlimited.");
+
     axy::Server::Options server_opts;
-    app.add_option("--listen-address", server_opts.listen_address);
+    app.add_option("--listen-address", server_opts.listen_address,
+                   "TCP address for the gRPC server. Empty disables TCP.");
+    app.add_option("--unix-socket", server_opts.unix_socket_path,
+                   "Path of a Unix domain socket to also serve gRPC on, for "
+                   "clients on the same host. Disabled if empty.");
     app.add_option(
         "--backend-speech-server-address",
         server_opts.backend_speech_server_address,
@@ -60,21 +81,238 @@ int main(int argc, char* argv[]) {
         "`GOOGLE_CLOUD_QUOTA_PROJECT` has to be set.");
     app.add_flag("--backend-speech-server-use-tls",
                  server_opts.backend_speech_server_use_tls);
-    app.add_option("--redis-address", server_opts.redis_address,
+    app.add_option("--backend-connections", server_opts.backend_connections,
+                   "Number of independent HTTP/2 connections to the backend "
+                   "speech server. New streams go to the connection with the "
+                   "fewest streams in flight.")
+        ->check(CLI::PositiveNumber);
+    std::vector<std::string> backend_routes;
+    app.add_option("--backend-route", backend_routes,
+                   "Send streams in another language to another backend, "
+                   "e.g. 'en-US=speech.googleapis.com:443'. The format is "
+                   "LANGUAGE[/MODEL]=ADDRESS[,connections=N][,tls=BOOL], "
+                   "where MODEL only matches streams with that `x-axy-model` "
+                   "metadata. Connections and TLS default to the options "
+                   "above.");
+    app.add_option("--redis-address", server_opts.redis_addresses,
                    "The server will write conversation events to streams with "
                    "keys 'sdifi/conversation/{conv_id}' where {conv_id} is the "
-                   "conversation ID.");
+                   "conversation ID. Give several addresses to shard "
+                   "conversations over independent Redis servers by "
+                   "consistent hashing.");
+    app.add_flag("--redis-cluster", server_opts.redis_cluster,
+                 "Use Redis Cluster with `--redis-address` as seed nodes.");
+    app.add_option("--redis-write-queue-size",
+                   server_opts.redis_write_queue_size,
+                   "Events waiting to be written to Redis. Events over this "
+                   "are dropped.")
+        ->check(CLI::PositiveNumber);
+    app.add_flag("--compact-events", server_opts.compact_events,
+                 "Store events in Redis in a compact encoding that only Axy "
+                 "reads.");
+    app.add_option("--local-event-ring-size", server_opts.local_event_ring_size,
+                   "Recent events kept per conversation watched on this "
+                   "instance, so they can be delivered without a Redis round "
+                   "trip. 0 disables local delivery.");
+    app.add_option("--watch-batch-linger-ms", server_opts.watch_batch_linger,
+                   "How long events wait for more to join them, for watchers "
+                   "that ask for batches.");
     app.add_option("--shutdown-timeout-seconds", server_opts.shutdown_timeout,
                    "Deadline for graceful shutdown.");
 
+    axy::SupervisorOptions supervisor_opts;
+    app.add_option("--workers", supervisor_opts.workers,
+                   "Number of worker processes. They share the listen and "
+                   "WebSocket addresses with SO_REUSEPORT and each has its own "
+                   "gRPC threads, backend channel and Redis connections. The "
+                   "admin port of each worker is --admin-address plus its "
+                   "index.")
+        ->check(CLI::PositiveNumber);
+    bool numa_pin_workers = false;
+    app.add_flag("--numa-pin-workers", numa_pin_workers,
+                 "Spread workers over NUMA nodes and pin each to the CPUs "
+                 "and memory of its node, unless --grpc-cpus or --redis-cpus "
+                 "are given.");
+
+    std::size_t grpc_memory_quota_mb = 0;
+    app.add_option("--grpc-memory-quota-mb", grpc_memory_quota_mb,
+                   "Memory quota for the gRPC server. 0 means unlimited.");
+    std::size_t grpc_max_receive_message_mb = 64;
+    app.add_option("--grpc-max-receive-message-mb",
+                   grpc_max_receive_message_mb,
+                   "Largest message the gRPC server accepts. This limits the "
+                   "audio clients can send inline to BatchRecognize.")
+        ->check(CLI::PositiveNumber);
+    std::string grpc_cpus;
+    app.add_option("--grpc-cpus", grpc_cpus,
+                   "CPUs to pin gRPC threads to, e.g. '0-3,8'. Empty means any "
+                   "CPU.");
+    std::string redis_cpus;
+    app.add_option("--redis-cpus", redis_cpus,
+                   "CPUs to pin threads doing blocking Redis work to. Empty "
+                   "means any CPU.");
+    app.add_option("--redis-pool-size", server_opts.redis_pool_size,
+                   "Number of connections in the Redis connection pool of "
+                   "each shard or cluster node.")
+        ->check(CLI::PositiveNumber);
+
+    app.add_option("--max-speech-streams",
+                   server_opts.speech_admission.max_active,
+                   "Maximum number of concurrent StreamingRecognize calls. "
+                   "Calls over the limit are rejected with RESOURCE_EXHAUSTED. "
+                   "0 means unlimited.");
+    app.add_option("--min-speech-streams",
+                   server_opts.speech_admission.min_active,
+                   "Lower bound for the adaptive speech stream limit.")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--speech-target-backend-latency-ms",
+                   server_opts.speech_admission.target_latency,
+                   "Lower the speech stream limit while backend write latency "
+                   "is above this and raise it back up to "
+                   "--max-speech-streams while it's below. 0 disables "
+                   "adaptation.");
+    app.add_option("--max-watchers", server_opts.watch_admission.max_active,
+                   "Maximum number of concurrent Watch calls. 0 means "
+                   "unlimited.");
+    app.add_option("--interactive-weight", server_opts.interactive_weight,
+                   "Share of stream slots and backend writes for interactive "
+                   "streams under contention.")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--batch-weight", server_opts.batch_weight,
+                   "Share of stream slots and backend writes for batch "
+                   "streams under contention. Clients pick the class with the "
+                   "`x-axy-priority` metadata. Otherwise streams without "
+                   "interim results are batch streams.")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--max-inflight-backend-writes",
+                   server_opts.max_inflight_backend_writes,
+                   "Maximum number of in-flight audio writes to the backend, "
+                   "shared between priority classes by weight. 0 means "
+                   "unlimited.");
+    app.add_option("--client-idle-timeout-ms",
+                   server_opts.stream_timeouts.client_idle,
+                   "Close speech streams that send nothing for this long. 0 "
+                   "disables it.");
+    app.add_option("--backend-idle-timeout-ms",
+                   server_opts.stream_timeouts.backend_idle,
+                   "Close speech streams whose backend hasn't responded for "
+                   "this long after being sent audio. 0 disables it.");
+    app.add_option("--max-stream-duration-ms",
+                   server_opts.stream_timeouts.max_duration,
+                   "Close speech streams open for longer than this. 0 "
+                   "disables it.");
+    app.add_option("--stabilization-window-ms",
+                   server_opts.stabilization_window,
+                   "Publish an interim transcript as a provisional final event "
+                   "once it hasn't changed for this long. 0 disables it.");
+    app.add_option("--transcript-snapshots", server_opts.transcript_snapshots,
+                   "Conversations whose transcript so far is kept in memory "
+                   "for GetTranscript. 0 always reads them from Redis.");
+    app.add_option("--transcript-threads", server_opts.transcript_threads,
+                   "Threads answering GetTranscript, which may block on "
+                   "Redis.")
+        ->check(CLI::PositiveNumber);
+    std::size_t audio_cache_mb = 0;
+    app.add_option("--audio-cache-mb", audio_cache_mb,
+                   "Memory for replaying the results of audio that was "
+                   "recognized before. 0 disables the cache.");
+    app.add_option("--warm-streams-per-profile",
+                   server_opts.warm_streams_per_profile,
+                   "Most backend streams opened ahead of time per stream "
+                   "config. 0 disables them.");
+    app.add_option("--warm-stream-max-idle-ms",
+                   server_opts.warm_stream_max_idle,
+                   "Replace warm backend streams before they idle this long.")
+        ->check(CLI::PositiveNumber);
+    std::size_t admission_queue_size = 0;
+    app.add_option("--admission-queue-size", admission_queue_size,
+                   "How many calls over the limits may wait for a free slot.");
+    std::chrono::milliseconds admission_queue_wait{200};
+    app.add_option("--admission-queue-wait-ms", admission_queue_wait,
+                   "How long calls may wait for a free slot.");
+    std::chrono::milliseconds admission_retry_after{1000};
+    app.add_option("--admission-retry-after-ms", admission_retry_after,
+                   "Retry delay suggested to rejected clients.");
+
+    app.add_option("--batch-parallel-streams",
+                   server_opts.batch.default_parallel_streams,
+                   "Backend streams per recording for BatchRecognize, unless "
+                   "the request asks for fewer or more.")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--batch-max-parallel-streams",
+                   server_opts.batch.max_parallel_streams,
+                   "Upper limit on backend streams per recording for "
+                   "BatchRecognize.")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--batch-audio-dir", server_opts.batch.audio_dir,
+                   "Directory BatchRecognize may read audio files from. "
+                   "Disabled if empty.");
+
+    app.add_option("--admin-address", server_opts.admin_address,
+                   "Address for an HTTP server with Prometheus metrics on "
+                   "`/metrics` and profiles on `/debug/pprof`, e.g. "
+                   "'0.0.0.0:9090'. Disabled if empty.");
+    app.add_option("--websocket-address", server_opts.websocket_address,
+                   "Address for serving StreamingRecognize to browsers over "
+                   "WebSocket on `/v1alpha/speech:stream`, e.g. "
+                   "'0.0.0.0:8080'. Disabled if empty.");
+    app.add_option("--websocket-max-connections",
+                   server_opts.websocket_max_connections,
+                   "Maximum number of WebSocket connections, each of which "
+                   "has a thread. Others are turned away with a 503.")
+        ->check(CLI::PositiveNumber);
+
+    app.add_option("--trace-sample-ratio", server_opts.tracing.sample_ratio,
+                   "Fraction of speech streams to trace, by conversation ID.")
+        ->check(CLI::Range(0.0, 1.0));
+    app.add_option("--trace-otlp-file", server_opts.tracing.otlp_file,
+                   "File to append OTLP/JSON traces to.");
+    app.add_option("--trace-otlp-endpoint", server_opts.tracing.otlp_endpoint,
+                   "OTLP/HTTP endpoint to send traces to, e.g. "
+                   "'http://localhost:4318/v1/traces'.");
+
     CLI11_PARSE(app, argc, argv);
 
+    axy::InitLogging(logging_opts);
     axy::SetLogLevel(log_level);
     axy::RegisterLibraryLogHandlers();
 
+    server_opts.grpc_memory_quota_bytes = grpc_memory_quota_mb << 20;
+    server_opts.grpc_max_receive_message_bytes =
+        grpc_max_receive_message_mb << 20;
+    server_opts.audio_cache_bytes = audio_cache_mb << 20;
+    server_opts.grpc_cpus = axy::CpuSet::Parse(grpc_cpus);
+    server_opts.redis_cpus = axy::CpuSet::Parse(redis_cpus);
+    for (const auto& spec : backend_routes) {
+      server_opts.backend_routes.push_back(axy::BackendRoute::Parse(
+          spec, {.use_tls = server_opts.backend_speech_server_use_tls,
+                 .connections = server_opts.backend_connections}));
+    }
+    for (auto* admission :
+         {&server_opts.speech_admission, &server_opts.watch_admission}) {
+      admission->max_queued = admission_queue_size;
+      admission->max_queue_wait = admission_queue_wait;
+      admission->retry_after = admission_retry_after;
+    }
+
+    if (const auto worker = axy::WorkerIndex()) {
+      server_opts = axy::ConfigureWorker(*worker, numa_pin_workers,
+                                         std::move(server_opts));
+    } else if (supervisor_opts.workers > 1) {
+      const int status = axy::RunSupervisor(argv, supervisor_opts);
+      axy::ShutdownLogging();
+      return status;
+    }
+
     axy::Server server{server_opts};
 
-    AXY_LOG_INFO("Server listening on {}", server_opts.listen_address);
+    if (!server_opts.listen_address.empty()) {
+      AXY_LOG_INFO("Server listening on {}", server_opts.listen_address);
+    }
+    if (!server_opts.unix_socket_path.empty()) {
+      AXY_LOG_INFO("Server listening on unix:{}",
+                   server_opts.unix_socket_path);
+    }
 
     std::signal(SIGTERM, handle_signal);
     std::signal(SIGINT, handle_signal);
@@ -88,8 +326,10 @@ int main(int argc, char* argv[]) {
 
   } catch (const std::exception& e) {
     AXY_LOG_ERROR(e.what());
+    axy::ShutdownLogging();
     return EXIT_FAILURE;
   }
 
+  axy::ShutdownLogging();
   return EXIT_SUCCESS;
 }
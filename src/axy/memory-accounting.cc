@@ -0,0 +1,87 @@
+#include "src/axy/memory-accounting.h"
+
+#include <malloc.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#ifdef AXY_WITH_GPERFTOOLS
+#include <gperftools/malloc_extension.h>
+#endif
+
+namespace axy {
+
+MemoryAccount& MemoryAccount::For(const std::string& kind) {
+  static std::mutex mtx;
+  static std::map<std::string, std::unique_ptr<MemoryAccount>> accounts;
+  std::lock_guard<std::mutex> lock{mtx};
+  auto& account = accounts[kind];
+  if (account == nullptr) {
+    account.reset(new MemoryAccount{kind});
+  }
+  return *account;
+}
+
+MemoryAccount::MemoryAccount(const std::string& kind)
+    : objects_{&MetricsRegistry::Global().GetGauge(
+          "axy_live_objects", "Objects of each kind that are alive.",
+          {{"kind", kind}})},
+      bytes_{&MetricsRegistry::Global().GetGauge(
+          "axy_held_bytes",
+          "Bytes buffered by the live objects of each kind, e.g. queued "
+          "messages.",
+          {{"kind", kind}})} {}
+
+AccountedObject::AccountedObject(MemoryAccount& account) : account_{account} {
+  account_.objects_->Add(1);
+}
+
+AccountedObject::~AccountedObject() {
+  account_.bytes_->Add(-static_cast<double>(held_.load()));
+  account_.objects_->Add(-1);
+}
+
+void AccountedObject::Hold(std::int64_t bytes) {
+  held_.fetch_add(bytes, std::memory_order_relaxed);
+  account_.bytes_->Add(static_cast<double>(bytes));
+}
+
+ProcessMemory ReadProcessMemory() {
+  ProcessMemory memory;
+  // Sizes in pages: total, resident, ...
+  std::ifstream statm{"/proc/self/statm"};
+  std::uint64_t total_pages = 0;
+  std::uint64_t resident_pages = 0;
+  if (statm >> total_pages >> resident_pages) {
+    memory.resident_bytes =
+        resident_pages * static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+  }
+
+#ifdef AXY_WITH_GPERFTOOLS
+  std::size_t allocated = 0;
+  if (MallocExtension::instance()->GetNumericProperty(
+          "generic.current_allocated_bytes", &allocated)) {
+    memory.heap_bytes = allocated;
+  }
+#elif defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+  const auto info = ::mallinfo2();
+  memory.heap_bytes = info.uordblks + info.hblkhd;
+#endif
+  return memory;
+}
+
+void SampleProcessMemory() {
+  static Gauge& resident = MetricsRegistry::Global().GetGauge(
+      "axy_process_resident_bytes", "Resident set size of the process.");
+  static Gauge& heap = MetricsRegistry::Global().GetGauge(
+      "axy_process_heap_bytes",
+      "Heap memory allocated and not freed yet, as the allocator sees it.");
+  const auto memory = ReadProcessMemory();
+  resident.Set(static_cast<double>(memory.resident_bytes));
+  heap.Set(static_cast<double>(memory.heap_bytes));
+}
+
+}  // namespace axy
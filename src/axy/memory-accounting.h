@@ -0,0 +1,68 @@
+#ifndef AXY_SRC_AXY_MEMORY_ACCOUNTING_H_
+#define AXY_SRC_AXY_MEMORY_ACCOUNTING_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "src/axy/metrics.h"
+
+namespace axy {
+
+/** Live objects of one kind and the bytes they hold in buffers.
+ *
+ * Exported as `axy_live_objects{kind}` and `axy_held_bytes{kind}`, so memory
+ * growth can be pinned on a subsystem. Held bytes are what the objects
+ * buffer, e.g. queued messages, not their own size.
+ */
+class MemoryAccount {
+ public:
+  /// The process wide account of `kind`, e.g. "server_reactor". Takes a lock,
+  /// so hold on to it.
+  static MemoryAccount& For(const std::string& kind);
+
+  double objects() const { return objects_->value(); }
+  double bytes() const { return bytes_->value(); }
+
+ private:
+  friend class AccountedObject;
+
+  explicit MemoryAccount(const std::string& kind);
+
+  Gauge* objects_;
+  Gauge* bytes_;
+};
+
+/// Counts its owner in an account for as long as it lives, together with the
+/// bytes the owner holds.
+class AccountedObject {
+ public:
+  explicit AccountedObject(MemoryAccount& account);
+  ~AccountedObject();
+
+  AccountedObject(const AccountedObject&) = delete;
+  AccountedObject& operator=(const AccountedObject&) = delete;
+
+  /// The owner holds `bytes` more, or less if negative.
+  void Hold(std::int64_t bytes);
+
+ private:
+  MemoryAccount& account_;
+  std::atomic<std::int64_t> held_ = 0;
+};
+
+struct ProcessMemory {
+  std::uint64_t resident_bytes = 0;
+  /// Allocated from the heap and not freed yet.
+  std::uint64_t heap_bytes = 0;
+};
+
+ProcessMemory ReadProcessMemory();
+
+/// Update `axy_process_resident_bytes` and `axy_process_heap_bytes`, e.g.
+/// before rendering metrics.
+void SampleProcessMemory();
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_MEMORY_ACCOUNTING_H_
@@ -0,0 +1,189 @@
+#include "src/axy/metrics.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace axy {
+
+namespace {
+
+std::string EscapeLabelValue(const std::string& value) {
+  std::string escaped;
+  escaped.reserve(value.size());
+  for (char c : value) {
+    switch (c) {
+      case '\\':
+        escaped += "\\\\";
+        break;
+      case '"':
+        escaped += "\\\"";
+        break;
+      case '\n':
+        escaped += "\\n";
+        break;
+      default:
+        escaped += c;
+    }
+  }
+  return escaped;
+}
+
+/// Renders labels as `a="x",b="y"`, which also serves as the map key.
+std::string RenderLabels(const MetricLabels& labels) {
+  std::string rendered;
+  for (const auto& [name, value] : labels) {
+    if (!rendered.empty()) {
+      rendered += ',';
+    }
+    rendered += fmt::format("{}=\"{}\"", name, EscapeLabelValue(value));
+  }
+  return rendered;
+}
+
+std::string WithBraces(const std::string& labels) {
+  return labels.empty() ? "" : "{" + labels + "}";
+}
+
+std::string FormatValue(double value) {
+  if (std::isinf(value)) {
+    return value > 0 ? "+Inf" : "-Inf";
+  }
+  return fmt::format("{}", value);
+}
+
+}  // namespace
+
+Histogram::Histogram(std::vector<double> bounds)
+    : bounds_{std::move(bounds)},
+      counts_{new std::atomic<std::uint64_t>[bounds_.size() + 1]} {
+  if (!std::is_sorted(bounds_.cbegin(), bounds_.cend())) {
+    throw std::invalid_argument{"histogram bounds have to be sorted"};
+  }
+  for (std::size_t i = 0; i <= bounds_.size(); ++i) {
+    counts_[i] = 0;
+  }
+}
+
+void Histogram::Observe(double value) {
+  const auto bucket =
+      std::lower_bound(bounds_.cbegin(), bounds_.cend(), value) -
+      bounds_.cbegin();
+  counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+std::vector<double> DefaultLatencyBuckets() {
+  return {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1,
+          0.25,  0.5,    1.0,   2.5,  5.0,   10.0, 30.0};
+}
+
+MetricsRegistry& MetricsRegistry::Global() {
+  static MetricsRegistry registry;
+  return registry;
+}
+
+MetricsRegistry::Family& MetricsRegistry::GetFamilyLocked(
+    const std::string& name, const std::string& help, Type type) {
+  auto [it, inserted] = families_.try_emplace(name);
+  if (inserted) {
+    it->second.type = type;
+    it->second.help = help;
+  } else if (it->second.type != type) {
+    throw std::logic_error{
+        fmt::format("metric '{}' registered with different types", name)};
+  }
+  return it->second;
+}
+
+Counter& MetricsRegistry::GetCounter(const std::string& name,
+                                     const std::string& help,
+                                     const MetricLabels& labels) {
+  std::lock_guard<std::mutex> lock{mtx_};
+  auto& slot = GetFamilyLocked(name, help, Type::kCounter)
+                   .counters[RenderLabels(labels)];
+  if (slot == nullptr) {
+    slot = std::make_unique<Counter>();
+  }
+  return *slot;
+}
+
+Gauge& MetricsRegistry::GetGauge(const std::string& name,
+                                 const std::string& help,
+                                 const MetricLabels& labels) {
+  std::lock_guard<std::mutex> lock{mtx_};
+  auto& slot =
+      GetFamilyLocked(name, help, Type::kGauge).gauges[RenderLabels(labels)];
+  if (slot == nullptr) {
+    slot = std::make_unique<Gauge>();
+  }
+  return *slot;
+}
+
+Histogram& MetricsRegistry::GetHistogram(const std::string& name,
+                                         const std::string& help,
+                                         const MetricLabels& labels,
+                                         std::vector<double> bounds) {
+  std::lock_guard<std::mutex> lock{mtx_};
+  auto& slot = GetFamilyLocked(name, help, Type::kHistogram)
+                   .histograms[RenderLabels(labels)];
+  if (slot == nullptr) {
+    slot = std::make_unique<Histogram>(std::move(bounds));
+  }
+  return *slot;
+}
+
+std::string MetricsRegistry::RenderPrometheus() const {
+  std::lock_guard<std::mutex> lock{mtx_};
+  std::string out;
+  for (const auto& [name, family] : families_) {
+    switch (family.type) {
+      case Type::kCounter:
+        out += fmt::format("# HELP {} {}\n# TYPE {} counter\n", name,
+                           family.help, name);
+        for (const auto& [labels, counter] : family.counters) {
+          out += fmt::format("{}{} {}\n", name, WithBraces(labels),
+                             FormatValue(counter->value()));
+        }
+        break;
+      case Type::kGauge:
+        out += fmt::format("# HELP {} {}\n# TYPE {} gauge\n", name,
+                           family.help, name);
+        for (const auto& [labels, gauge] : family.gauges) {
+          out += fmt::format("{}{} {}\n", name, WithBraces(labels),
+                             FormatValue(gauge->value()));
+        }
+        break;
+      case Type::kHistogram:
+        out += fmt::format("# HELP {} {}\n# TYPE {} histogram\n", name,
+                           family.help, name);
+        for (const auto& [labels, histogram] : family.histograms) {
+          const std::string sep = labels.empty() ? "" : ",";
+          std::uint64_t cumulative = 0;
+          for (std::size_t i = 0; i <= histogram->bounds().size(); ++i) {
+            cumulative += histogram->bucket_count(i);
+            const double le = i < histogram->bounds().size()
+                                  ? histogram->bounds()[i]
+                                  : std::numeric_limits<double>::infinity();
+            out += fmt::format("{}_bucket{{{}{}le=\"{}\"}} {}\n", name, labels,
+                               sep, FormatValue(le), cumulative);
+          }
+          out += fmt::format("{}_sum{} {}\n", name, WithBraces(labels),
+                             FormatValue(histogram->sum()));
+          out += fmt::format("{}_count{} {}\n", name, WithBraces(labels),
+                             cumulative);
+        }
+        break;
+    }
+  }
+  return out;
+}
+
+}  // namespace axy
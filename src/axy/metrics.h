@@ -0,0 +1,110 @@
+#ifndef AXY_SRC_AXY_METRICS_H_
+#define AXY_SRC_AXY_METRICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace axy {
+
+/// Label names and values of a metric, e.g. {{"class", "batch"}}.
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+class Counter {
+ public:
+  void Increment(double value = 1.0) {
+    value_.fetch_add(value, std::memory_order_relaxed);
+  }
+  double value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<double> value_ = 0.0;
+};
+
+class Gauge {
+ public:
+  void Set(double value) { value_.store(value, std::memory_order_relaxed); }
+  void Add(double value) { value_.fetch_add(value, std::memory_order_relaxed); }
+  double value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<double> value_ = 0.0;
+};
+
+class Histogram {
+ public:
+  /// `bounds` are the inclusive upper bounds of the buckets, in increasing
+  /// order. There is an implicit +Inf bucket.
+  explicit Histogram(std::vector<double> bounds);
+
+  void Observe(double value);
+
+  /// Convenience for latencies, which we always export in seconds.
+  template <typename Rep, typename Period>
+  void Observe(std::chrono::duration<Rep, Period> duration) {
+    Observe(std::chrono::duration<double>(duration).count());
+  }
+
+  const std::vector<double>& bounds() const { return bounds_; }
+  /// Non-cumulative count of bucket `i`, where `i == bounds().size()` is +Inf.
+  std::uint64_t bucket_count(std::size_t i) const {
+    return counts_[i].load(std::memory_order_relaxed);
+  }
+  double sum() const { return sum_.load(std::memory_order_relaxed); }
+
+ private:
+  const std::vector<double> bounds_;
+  std::unique_ptr<std::atomic<std::uint64_t>[]> counts_;
+  std::atomic<double> sum_ = 0.0;
+};
+
+/// Buckets from 1 ms to ~30 s, suitable for most of our latencies.
+std::vector<double> DefaultLatencyBuckets();
+
+/** Process wide registry of metrics, rendered in the Prometheus text format.
+ *
+ * Metrics are created on first use and live as long as the process, so it's
+ * fine to hold on to the returned references. Updating a metric is lock-free;
+ * only looking them up takes a lock, so do that outside hot paths.
+ */
+class MetricsRegistry {
+ public:
+  static MetricsRegistry& Global();
+
+  Counter& GetCounter(const std::string& name, const std::string& help,
+                      const MetricLabels& labels = {});
+  Gauge& GetGauge(const std::string& name, const std::string& help,
+                  const MetricLabels& labels = {});
+  Histogram& GetHistogram(const std::string& name, const std::string& help,
+                          const MetricLabels& labels = {},
+                          std::vector<double> bounds = DefaultLatencyBuckets());
+
+  std::string RenderPrometheus() const;
+
+ private:
+  enum class Type { kCounter, kGauge, kHistogram };
+
+  struct Family {
+    Type type;
+    std::string help;
+    std::map<std::string, std::unique_ptr<Counter>> counters;
+    std::map<std::string, std::unique_ptr<Gauge>> gauges;
+    std::map<std::string, std::unique_ptr<Histogram>> histograms;
+  };
+
+  Family& GetFamilyLocked(const std::string& name, const std::string& help,
+                          Type type);
+
+  mutable std::mutex mtx_;
+  std::map<std::string, Family> families_;
+};
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_METRICS_H_
@@ -0,0 +1,67 @@
+#include "src/axy/mock-backend.h"
+
+#include <fmt/core.h>
+#include <grpcpp/security/server_credentials.h>
+#include <grpcpp/server_builder.h>
+
+#include <stdexcept>
+#include <thread>
+
+namespace axy {
+
+MockSpeechBackend::MockSpeechBackend(const std::string& address,
+                                     std::chrono::microseconds processing_time,
+                                     std::chrono::microseconds setup_time)
+    : processing_time_{processing_time}, setup_time_{setup_time} {
+  grpc::ServerBuilder builder;
+  builder.RegisterService(this).AddListeningPort(
+      address, grpc::InsecureServerCredentials());
+  server_ = builder.BuildAndStart();
+  if (server_ == nullptr) {
+    throw std::runtime_error{
+        fmt::format("Could not start mock backend on '{}'.", address)};
+  }
+}
+
+MockSpeechBackend::~MockSpeechBackend() {
+  server_->Shutdown(std::chrono::system_clock::now());
+}
+
+grpc::Status MockSpeechBackend::StreamingRecognize(
+    grpc::ServerContext*,
+    grpc::ServerReaderWriter<tiro::speech::v1alpha::StreamingRecognizeResponse,
+                             tiro::speech::v1alpha::StreamingRecognizeRequest>*
+        stream) {
+  tiro::speech::v1alpha::StreamingRecognizeRequest req;
+  tiro::speech::v1alpha::StreamingRecognizeResponse res;
+  std::size_t chunks = 0;
+
+  const auto respond = [&](bool is_final) {
+    if (processing_time_.count() > 0) {
+      std::this_thread::sleep_for(processing_time_);
+    }
+    res.Clear();
+    auto* result = res.add_results();
+    result->set_is_final(is_final);
+    result->add_alternatives()->set_transcript(
+        fmt::format("{} chunks", chunks));
+    return stream->Write(res);
+  };
+
+  while (stream->Read(&req)) {
+    if (req.has_streaming_config()) {
+      if (setup_time_.count() > 0) {
+        std::this_thread::sleep_for(setup_time_);
+      }
+      continue;
+    }
+    ++chunks;
+    if (!respond(false)) {
+      return grpc::Status::CANCELLED;
+    }
+  }
+  respond(true);
+  return grpc::Status::OK;
+}
+
+}  // namespace axy
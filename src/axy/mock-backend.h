@@ -0,0 +1,43 @@
+#ifndef AXY_SRC_AXY_MOCK_BACKEND_H_
+#define AXY_SRC_AXY_MOCK_BACKEND_H_
+
+#include <grpcpp/server.h>
+#include <tiro/speech/v1alpha/speech.grpc.pb.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+namespace axy {
+
+/** A stand-in for the backend speech server, for benchmarks.
+ *
+ * Answers every audio chunk with an interim result and the end of the audio
+ * with a final result, after an optional delay that stands in for
+ * recognition time. Another optional delay after the config stands in for
+ * setting up a decoder. Listens on `address` without TLS.
+ */
+class MockSpeechBackend final
+    : public tiro::speech::v1alpha::Speech::Service {
+ public:
+  explicit MockSpeechBackend(
+      const std::string& address,
+      std::chrono::microseconds processing_time = std::chrono::microseconds{0},
+      std::chrono::microseconds setup_time = std::chrono::microseconds{0});
+  ~MockSpeechBackend() override;
+
+  grpc::Status StreamingRecognize(
+      grpc::ServerContext* context,
+      grpc::ServerReaderWriter<
+          tiro::speech::v1alpha::StreamingRecognizeResponse,
+          tiro::speech::v1alpha::StreamingRecognizeRequest>* stream) override;
+
+ private:
+  const std::chrono::microseconds processing_time_;
+  const std::chrono::microseconds setup_time_;
+  std::unique_ptr<grpc::Server> server_;
+};
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_MOCK_BACKEND_H_
@@ -0,0 +1,46 @@
+#ifndef AXY_SRC_AXY_PRIORITY_H_
+#define AXY_SRC_AXY_PRIORITY_H_
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+namespace axy {
+
+/// Priority class of a speech stream. The values are indices into per-class
+/// arrays, e.g. weights.
+enum class PriorityClass : std::size_t {
+  /// Voice assistant turns and other streams where somebody is waiting for the
+  /// result.
+  kInteractive = 0,
+  /// Bulk or background transcription.
+  kBatch = 1,
+};
+
+inline constexpr std::size_t kNumPriorityClasses = 2;
+
+/// Clients can pick a priority class for their streams with this metadata key.
+inline constexpr std::string_view kPriorityMetadataKey = "x-axy-priority";
+
+inline constexpr std::string_view ToString(PriorityClass priority) {
+  switch (priority) {
+    case PriorityClass::kInteractive:
+      return "interactive";
+    case PriorityClass::kBatch:
+      return "batch";
+  }
+  return "unknown";
+}
+
+inline std::optional<PriorityClass> ParsePriorityClass(std::string_view str) {
+  for (auto priority : {PriorityClass::kInteractive, PriorityClass::kBatch}) {
+    if (str == ToString(priority)) {
+      return priority;
+    }
+  }
+  return std::nullopt;
+}
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_PRIORITY_H_
@@ -0,0 +1,200 @@
+#include "src/axy/profiler.h"
+
+#include <execinfo.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifdef AXY_WITH_GPERFTOOLS
+#include <gperftools/malloc_extension.h>
+#endif
+
+#include "src/axy/logging.h"
+
+namespace axy {
+
+namespace {
+
+constexpr std::size_t kMaxDepth = 64;
+/// The signal handler and the signal trampoline.
+constexpr int kSkippedFrames = 2;
+/// Bounds the memory of a profile, about 33 MiB.
+constexpr std::size_t kMaxSamples = 1 << 16;
+
+/// Filled by the signal handler, which can't allocate.
+struct SampleBuffer {
+  explicit SampleBuffer(std::size_t samples)
+      : pcs(samples * kMaxDepth), depths(samples) {}
+
+  std::vector<void*> pcs;
+  /// 0 for samples that were dropped or never taken.
+  std::vector<int> depths;
+  std::atomic<std::size_t> next = 0;
+};
+
+std::mutex profile_mtx;
+std::atomic<SampleBuffer*> active_buffer = nullptr;
+/// Handlers that may still be writing to the buffer they loaded.
+std::atomic<int> handlers_running = 0;
+
+void OnSigprof(int, siginfo_t*, void*) {
+  const int saved_errno = errno;
+  handlers_running.fetch_add(1);
+  auto* buffer = active_buffer.load();
+  if (buffer != nullptr) {
+    const auto i = buffer->next.fetch_add(1, std::memory_order_relaxed);
+    if (i < buffer->depths.size()) {
+      buffer->depths[i] = backtrace(&buffer->pcs[i * kMaxDepth], kMaxDepth);
+    }
+  }
+  handlers_running.fetch_sub(1);
+  errno = saved_errno;
+}
+
+/** Install the SIGPROF handler for good.
+ *
+ * Restoring the default action after a profile could kill the process with a
+ * signal that was still pending. Without a timer the handler never runs.
+ */
+void InstallHandler() {
+  static std::once_flag installed;
+  std::call_once(installed, [] {
+    // The first call of backtrace() may load libgcc, which mustn't happen in
+    // the signal handler.
+    void* warmup[1];
+    backtrace(warmup, 1);
+
+    struct sigaction action {};
+    action.sa_sigaction = OnSigprof;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, nullptr) != 0) {
+      throw std::system_error{errno, std::generic_category(),
+                              "Could not install the SIGPROF handler"};
+    }
+  });
+}
+
+void SetTimer(int hz) {
+  itimerval timer{};
+  if (hz > 0) {
+    timer.it_interval.tv_usec = 1'000'000 / hz;
+    timer.it_value = timer.it_interval;
+  }
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    throw std::system_error{errno, std::generic_category(),
+                            "Could not set the profiling timer"};
+  }
+}
+
+/// The gperftools CPU profile format is a sequence of native words, followed
+/// by the memory mappings for symbolization.
+void AppendWord(std::string& out, std::uintptr_t word) {
+  out.append(reinterpret_cast<const char*>(&word), sizeof(word));
+}
+
+std::string Encode(const SampleBuffer& buffer, int hz) {
+  std::map<std::vector<void*>, std::uintptr_t> stacks;
+  std::size_t taken = 0;
+  for (std::size_t i = 0; i < buffer.depths.size(); ++i) {
+    const auto depth = buffer.depths[i];
+    if (depth <= kSkippedFrames) {
+      continue;
+    }
+    const auto* pcs = &buffer.pcs[i * kMaxDepth];
+    ++stacks[{pcs + kSkippedFrames, pcs + depth}];
+    ++taken;
+  }
+  const auto attempted = buffer.next.load();
+  if (attempted > taken) {
+    AXY_LOG_WARN("CPU profile is missing {} of {} samples.",
+                 attempted - taken, attempted);
+  }
+
+  std::string out;
+  // Header: header words, version, sampling period in microseconds, padding
+  for (const std::uintptr_t word : {0, 3, 0, 1'000'000 / hz, 0}) {
+    AppendWord(out, word);
+  }
+  for (const auto& [pcs, count] : stacks) {
+    AppendWord(out, count);
+    AppendWord(out, pcs.size());
+    for (auto* pc : pcs) {
+      AppendWord(out, reinterpret_cast<std::uintptr_t>(pc));
+    }
+  }
+  // Trailer
+  for (const std::uintptr_t word : {0, 1, 0}) {
+    AppendWord(out, word);
+  }
+
+  std::ifstream maps{"/proc/self/maps"};
+  out.append(std::istreambuf_iterator<char>{maps},
+             std::istreambuf_iterator<char>{});
+  return out;
+}
+
+}  // namespace
+
+std::optional<std::string> CaptureCpuProfile(std::chrono::seconds duration,
+                                             int hz) {
+  if (duration.count() <= 0 || hz <= 0 || hz > 1000) {
+    throw std::invalid_argument{
+        "A CPU profile needs a positive duration and at most 1000 Hz."};
+  }
+  std::unique_lock<std::mutex> lock{profile_mtx, std::try_to_lock};
+  if (!lock) {
+    return std::nullopt;
+  }
+
+  InstallHandler();
+
+  const auto cpus = std::max(1u, std::thread::hardware_concurrency());
+  SampleBuffer buffer{std::min<std::size_t>(
+      kMaxSamples, static_cast<std::size_t>(duration.count()) * hz * cpus)};
+  active_buffer = &buffer;
+
+  AXY_LOG_INFO("Taking a {}s CPU profile at {} Hz.", duration.count(), hz);
+  std::exception_ptr error;
+  try {
+    SetTimer(hz);
+    std::this_thread::sleep_for(duration);
+    SetTimer(0);
+  } catch (...) {
+    error = std::current_exception();
+  }
+
+  active_buffer = nullptr;
+  while (handlers_running > 0) {
+    std::this_thread::yield();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return Encode(buffer, hz);
+}
+
+std::optional<std::string> CaptureHeapProfile() {
+#ifdef AXY_WITH_GPERFTOOLS
+  std::string out;
+  MallocExtension::instance()->GetHeapSample(&out);
+  return out;
+#else
+  return std::nullopt;
+#endif
+}
+
+}  // namespace axy
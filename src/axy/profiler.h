@@ -0,0 +1,38 @@
+#ifndef AXY_SRC_AXY_PROFILER_H_
+#define AXY_SRC_AXY_PROFILER_H_
+
+#include <chrono>
+#include <optional>
+#include <string>
+
+namespace axy {
+
+/** Sample the CPU usage of the whole process for `duration`.
+ *
+ * A `SIGPROF` timer interrupts the process `hz` times per second of CPU time
+ * and records the stack of the thread that was running. Nothing is installed
+ * outside of a profile, so this costs nothing when not in use.
+ *
+ * \returns The profile in the gperftools CPU profile format, which `pprof`
+ *          reads and symbolizes with the `axy` binary, or nothing if another
+ *          profile is being taken.
+ *
+ * \throws std::system_error if the timer or signal handler can't be set up.
+ * \throws std::invalid_argument unless `duration` and `hz` are positive.
+ */
+std::optional<std::string> CaptureCpuProfile(std::chrono::seconds duration,
+                                             int hz = 100);
+
+/** A heap profile of sampled allocations that are still live.
+ *
+ * Only available when built with `AXY_WITH_GPERFTOOLS`, and only has samples
+ * if tcmalloc was told to take them with `TCMALLOC_SAMPLE_PARAMETER`.
+ *
+ * \returns The profile in the gperftools heap profile format, or nothing
+ *          without gperftools.
+ */
+std::optional<std::string> CaptureHeapProfile();
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_PROFILER_H_
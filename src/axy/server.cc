@@ -3,86 +3,496 @@
 #include <fmt/chrono.h>
 #include <fmt/core.h>
 #include <grpcpp/health_check_service_interface.h>
+#include <grpcpp/resource_quota.h>
 #include <grpcpp/security/credentials.h>
 #include <grpcpp/server_builder.h>
 
+#include <algorithm>
+#include <charconv>
 #include <chrono>
+#include <condition_variable>
 #include <cstdlib>
+#include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include "src/axy/audio-cache.h"
+#include "src/axy/http-server.h"
 #include "src/axy/logging.h"
+#include "src/axy/memory-accounting.h"
+#include "src/axy/metrics.h"
+#include "src/axy/priority.h"
+#include "src/axy/profiler.h"
 #include "src/axy/speech-service.h"
+#include "src/axy/threading.h"
 
 namespace axy {
 
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/// Sleep for `delay` or until a stop is requested, whichever comes first.
+void InterruptibleSleep(std::stop_token stop, Clock::duration delay) {
+  std::mutex mtx;
+  std::condition_variable_any cv;
+  std::unique_lock<std::mutex> lock{mtx};
+  cv.wait_for(lock, stop, delay, [] { return false; });
+}
+
+/** Call `probe` until it succeeds or a stop is requested.
+ *
+ * \returns The time it took for the component to become ready, or
+ *          `std::nullopt` if we were stopped before that happened.
+ */
+template <typename Probe>
+std::optional<Clock::duration> WaitUntilReady(std::stop_token stop,
+                                              std::string_view component,
+                                              Clock::time_point started_at,
+                                              std::chrono::seconds warn_every,
+                                              Probe&& probe) {
+  constexpr std::chrono::milliseconds kMaxBackoff{2000};
+  std::chrono::milliseconds backoff{50};
+  auto next_warning = started_at + warn_every;
+
+  while (!stop.stop_requested()) {
+    if (probe()) {
+      auto elapsed = Clock::now() - started_at;
+      AXY_LOG_INFO(
+          "{} ready after {}.", component,
+          std::chrono::duration_cast<std::chrono::milliseconds>(elapsed));
+      return elapsed;
+    }
+    if (Clock::now() >= next_warning) {
+      AXY_LOG_WARN("Still waiting for {} after {}.", component,
+                   std::chrono::duration_cast<std::chrono::seconds>(
+                       Clock::now() - started_at));
+      next_warning += warn_every;
+    }
+    InterruptibleSleep(stop, backoff);
+    backoff = std::min(backoff * 2, kMaxBackoff);
+  }
+
+  return std::nullopt;
+}
+
+std::shared_ptr<grpc::ChannelCredentials> BackendCredentials(
+    const std::string& address, bool use_tls) {
+  if (address == "speech.googleapis.com:443") {
+    return grpc::GoogleDefaultCredentials();
+  } else if (use_tls) {
+    return grpc::SslCredentials({});
+  } else {
+    return grpc::InsecureChannelCredentials();
+  }
+}
+
+/// Metadata for calls to Google Cloud Speech, which bills them to the quota
+/// project.
+std::map<std::string, std::string> GoogleHeaders() {
+  const char* quota_project = std::getenv("GOOGLE_CLOUD_QUOTA_PROJECT");
+  if (quota_project == nullptr) {
+    throw ServerError{
+        "You need to specify a quota project to use Google Cloud "
+        "Speech. Set the environment variable "
+        "'GOOGLE_CLOUD_QUOTA_PROJECT'"};
+  }
+  return {{"x-goog-user-project", quota_project}};
+}
+
+/// Talks to Google Cloud Speech if that's what `address` is, and to a Tiro
+/// speech server otherwise.
+std::shared_ptr<SpeechBackend> MakeSpeechBackend(
+    std::string route, const std::string& address,
+    std::shared_ptr<BackendChannelPool> channels,
+    SpeechServiceResources resources) {
+  if (address == "speech.googleapis.com:443") {
+    return std::make_shared<SpeechBackendImpl<GoogleSpeechTypes>>(
+        std::move(route), std::move(channels), std::move(resources),
+        GoogleHeaders());
+  }
+  return std::make_shared<SpeechBackendImpl<TiroSpeechTypes>>(
+      std::move(route), std::move(channels), std::move(resources));
+}
+
+/// Speech streams are admitted in the classes of `PriorityClass`.
+AdmissionController::Options WithPriorityClasses(
+    AdmissionController::Options admission, const Server::Options& opts) {
+  admission.classes = {
+      {.name = std::string{ToString(PriorityClass::kInteractive)},
+       .weight = opts.interactive_weight},
+      {.name = std::string{ToString(PriorityClass::kBatch)},
+       .weight = opts.batch_weight},
+  };
+  return admission;
+}
+
+}  // namespace
+
 Server::Server(Options opts)
-    : opts_{std::move(opts)},
-      redis_{std::make_shared<sw::redis::Redis>(opts_.redis_address)},
-      event_cb_service_{redis_},
-      backend_speech_channel_{grpc::CreateChannel(
-          opts_.backend_speech_server_address,
-          [&]() {
-            AXY_LOG_INFO("Connecting to speech service: '{}'",
-                         opts_.backend_speech_server_address);
-            if (opts_.backend_speech_server_address ==
-                "speech.googleapis.com:443") {
-              return grpc::GoogleDefaultCredentials();
-            } else if (opts_.backend_speech_server_use_tls) {
-              return grpc::SslCredentials({});
-            } else {
-              return grpc::InsecureChannelCredentials();
-            }
-          }())},
+    : started_at_{Clock::now()},
+      opts_{std::move(opts)},
+      events_{std::make_shared<EventStore>(EventStore::Options{
+          .addresses = opts_.redis_addresses,
+          .cluster = opts_.redis_cluster,
+          .pool_size = opts_.redis_pool_size,
+      })},
+      transcript_snapshots_{
+          opts_.transcript_snapshots == 0
+              ? nullptr
+              : std::make_shared<TranscriptSnapshots>(
+                    opts_.transcript_snapshots)},
+      redis_event_sink_{std::make_shared<RedisEventSink>(
+          events_, opts_.redis_write_queue_size, opts_.compact_events,
+          transcript_snapshots_ == nullptr
+              ? RedisEventSink::DroppedCallback{}
+              : [snapshots = transcript_snapshots_](
+                    const ConversationEvent& event) {
+                  snapshots->Lost(event.conversation_id);
+                })},
+      local_events_{opts_.local_event_ring_size == 0
+                        ? nullptr
+                        : std::make_shared<LocalEventBus>(
+                              opts_.local_event_ring_size)},
+      speech_admission_{AdmissionController::Create(
+          WithPriorityClasses(opts_.speech_admission, opts_))},
+      watch_admission_{AdmissionController::Create(opts_.watch_admission)},
+      backend_writes_{
+          opts_.max_inflight_backend_writes == 0
+              ? nullptr
+              : AdmissionController::Create(WithPriorityClasses(
+                    {
+                        .name = "backend writes",
+                        .metrics_name = "backend_writes",
+                        .max_active = opts_.max_inflight_backend_writes,
+                        .max_queued = std::numeric_limits<std::size_t>::max(),
+                    },
+                    opts_))},
+      tracer_{Tracer::Create(opts_.tracing)},
+      // A tick fine enough for stabilization windows.
+      timers_{opts_.stream_timeouts.enabled() ||
+                      opts_.stabilization_window.count() > 0 ||
+                      opts_.audio_cache_bytes > 0 ||
+                      opts_.warm_streams_per_profile > 0
+                  ? std::make_shared<TimerWheel>(std::chrono::milliseconds{20})
+                  : nullptr},
+      reaper_{opts_.stream_timeouts.enabled()
+                  ? std::make_shared<IdleReaper>(timers_,
+                                                 opts_.stream_timeouts)
+                  : nullptr},
+      backend_channels_{[&]() {
+        AXY_LOG_INFO("Connecting to speech service: '{}' over {} "
+                     "connections",
+                     opts_.backend_speech_server_address,
+                     opts_.backend_connections);
+        const ScopedThreadPin pin{opts_.grpc_cpus};
+        return std::make_shared<BackendChannelPool>(
+            opts_.backend_speech_server_address,
+            BackendCredentials(opts_.backend_speech_server_address,
+                               opts_.backend_speech_server_use_tls),
+            opts_.backend_connections);
+      }()},
+      event_cb_service_{events_, local_events_, watch_admission_,
+                        opts_.redis_cpus, opts_.watch_batch_linger},
       speech_cb_service_{[&]() -> std::unique_ptr<SpeechService> {
+        SpeechServiceResources resources{
+            .event_sinks = {redis_event_sink_},
+            .admission = speech_admission_,
+            .backend_writes = backend_writes_,
+            .tracer = tracer_,
+            .reaper = reaper_,
+            .timers = timers_,
+            .stabilization_window = opts_.stabilization_window,
+            .audio_cache = opts_.audio_cache_bytes > 0
+                               ? std::make_shared<AudioResultCache>(
+                                     opts_.audio_cache_bytes)
+                               : nullptr,
+            .warm_streams = {.max_per_profile = opts_.warm_streams_per_profile,
+                             .max_idle = opts_.warm_stream_max_idle},
+        };
+        if (local_events_ != nullptr) {
+          resources.event_sinks.push_back(local_events_);
+        }
+        if (transcript_snapshots_ != nullptr) {
+          resources.event_sinks.push_back(transcript_snapshots_);
+        }
+
+        std::vector<SpeechRouter::Route> routes;
+        for (const auto& route : opts_.backend_routes) {
+          AXY_LOG_INFO("Connecting to speech service for {}: '{}' over {} "
+                       "connections",
+                       route.Name(), route.address, route.connections);
+          std::shared_ptr<BackendChannelPool> channels;
+          {
+            const ScopedThreadPin pin{opts_.grpc_cpus};
+            channels = std::make_shared<BackendChannelPool>(
+                route.address,
+                BackendCredentials(route.address, route.use_tls),
+                route.connections, route.Name());
+          }
+          route_channels_.push_back(channels);
+          routes.push_back({
+              .language_code = route.language_code,
+              .model = route.model,
+              .backend = MakeSpeechBackend(route.Name(), route.address,
+                                           std::move(channels), resources),
+          });
+        }
+        return std::make_unique<SpeechRouter>(
+            MakeSpeechBackend("default", opts_.backend_speech_server_address,
+                              backend_channels_, std::move(resources)),
+            std::move(routes));
+      }()},
+      batch_cb_service_{[&]() -> std::unique_ptr<BatchSpeechService> {
         if (opts_.backend_speech_server_address ==
             "speech.googleapis.com:443") {
-          auto quota_project = std::getenv("GOOGLE_CLOUD_QUOTA_PROJECT");
-          if (quota_project == nullptr) {
-            throw ServerError{
-                "You need to specify a quota project to use Google Cloud "
-                "Speech. Set the environment variable "
-                "'GOOGLE_CLOUD_QUOTA_PROJECT'"};
-          }
-          return std::make_unique<SpeechServiceImpl<GoogleSpeechTypes>>(
-              backend_speech_channel_, redis_,
-              std::map<std::string, std::string>{
-                  {"x-goog-user-project", quota_project}});
+          return std::make_unique<BatchSpeechServiceImpl<GoogleSpeechTypes>>(
+              backend_channels_, speech_admission_, opts_.batch,
+              GoogleHeaders());
         }
-        return std::make_unique<SpeechServiceImpl<TiroSpeechTypes>>(
-            backend_speech_channel_, redis_);
+        return std::make_unique<BatchSpeechServiceImpl<TiroSpeechTypes>>(
+            backend_channels_, speech_admission_, opts_.batch);
       }()},
+      transcript_cb_service_{transcript_snapshots_, events_,
+                             opts_.transcript_threads, opts_.redis_cpus},
       grpc_server_{[&]() {
+        // gRPC spawns its threads from the threads that call into it first
+        // or from its own threads, which inherit their affinity. Our other
+        // threads keep the affinity of the process.
+        const ScopedThreadPin pin{opts_.grpc_cpus};
         grpc::EnableDefaultHealthCheckService(true);
         grpc::ServerBuilder server_builder{};
+
+        grpc::ResourceQuota quota{"axy"};
+        if (opts_.grpc_memory_quota_bytes > 0) {
+          quota.Resize(opts_.grpc_memory_quota_bytes);
+        }
+        server_builder.SetResourceQuota(quota);
+        server_builder.SetMaxReceiveMessageSize(static_cast<int>(std::min(
+            opts_.grpc_max_receive_message_bytes,
+            static_cast<std::size_t>(std::numeric_limits<int>::max()))));
+        // gRPC turns this on by default, which would let a second instance
+        // quietly take half of the connections.
+        server_builder.AddChannelArgument(GRPC_ARG_ALLOW_REUSEPORT,
+                                          opts_.reuse_port ? 1 : 0);
+
         server_builder.RegisterService(speech_cb_service_.get())
+            .RegisterService(batch_cb_service_.get())
             .RegisterService(&event_cb_service_)
-            .AddListeningPort(opts_.listen_address,
-                              grpc::InsecureServerCredentials());
+            .RegisterService(&transcript_cb_service_);
+        if (!opts_.listen_address.empty()) {
+          server_builder.AddListeningPort(opts_.listen_address,
+                                          grpc::InsecureServerCredentials());
+        }
+        if (!opts_.unix_socket_path.empty()) {
+          server_builder.AddListeningPort("unix:" + opts_.unix_socket_path,
+                                          grpc::InsecureServerCredentials());
+        }
         return server_builder.BuildAndStart();
       }()} {
   if (grpc_server_ == nullptr) {
-    throw ServerError{
-        fmt::format("Could not build gRPC server listening on '{}'.",
-                    opts_.listen_address)};
+    throw ServerError{fmt::format(
+        "Could not build gRPC server listening on '{}' and '{}'.",
+        opts_.listen_address, opts_.unix_socket_path)};
   }
 
-  if (!backend_speech_channel_->WaitForConnected(
-          std::chrono::system_clock::now() + opts_.backend_speech_wait_delay)) {
-    throw ServerError{fmt::format(
-        "Could not connect to backend speech server '{}' after {}.",
-        opts_.backend_speech_server_address, opts_.backend_speech_wait_delay)};
+  // Until Redis and the backend are reachable, we accept connections but tell
+  // health checkers that we are not ready to take traffic.
+  grpc_server_->GetHealthCheckService()->SetServingStatus(false);
+  AXY_LOG_INFO("gRPC server listening after {}.",
+               std::chrono::duration_cast<std::chrono::milliseconds>(
+                   Clock::now() - started_at_));
+
+  if (!opts_.admin_address.empty()) {
+    admin_server_ = std::make_unique<HttpServer>(opts_.admin_address);
+    admin_server_->Handle("/metrics", [](const HttpRequest&) {
+      SampleProcessMemory();
+      return HttpResponse{
+          .content_type = "text/plain; version=0.0.4; charset=utf-8",
+          .body = MetricsRegistry::Global().RenderPrometheus()};
+    });
+    admin_server_->Handle("/debug/pprof/profile", [](const HttpRequest& req) {
+      constexpr int kMaxSeconds = 300;
+      int seconds = 30;
+      if (const auto param = req.QueryParam("seconds")) {
+        const auto* end = param->data() + param->size();
+        if (std::from_chars(param->data(), end, seconds).ptr != end ||
+            seconds <= 0 || seconds > kMaxSeconds) {
+          return HttpResponse{
+              .status = 400,
+              .body = fmt::format("`seconds` has to be between 1 and {}\n",
+                                  kMaxSeconds)};
+        }
+      }
+      auto profile = CaptureCpuProfile(std::chrono::seconds{seconds});
+      if (!profile) {
+        return HttpResponse{.status = 409,
+                            .body = "Another profile is being taken\n"};
+      }
+      return HttpResponse{.content_type = "application/octet-stream",
+                          .body = std::move(*profile)};
+    });
+    admin_server_->Handle("/debug/pprof/heap", [](const HttpRequest&) {
+      auto profile = CaptureHeapProfile();
+      if (!profile) {
+        return HttpResponse{
+            .status = 501,
+            .body = "Heap profiles need a build with AXY_WITH_GPERFTOOLS\n"};
+      }
+      return HttpResponse{.content_type = "application/octet-stream",
+                          .body = std::move(*profile)};
+    });
+    admin_server_->Start();
+  }
+
+  if (!opts_.websocket_address.empty()) {
+    websocket_bridge_ = std::make_unique<SpeechWebSocketBridge>(
+        InProcessChannel());
+    websocket_server_ = std::make_unique<HttpServer>(
+        opts_.websocket_address, opts_.reuse_port,
+        opts_.websocket_max_connections);
+    websocket_server_->HandleUpgrade(
+        std::string{SpeechWebSocketBridge::kPath},
+        [this](const HttpRequest& req, int fd) {
+          websocket_bridge_->Serve(req, fd);
+        });
+    websocket_server_->Start();
   }
+
+  LogThreadTopology();
+  StartReadinessProbes();
+}
+
+void Server::LogThreadTopology() const {
+  AXY_LOG_INFO("Thread topology: {} hardware threads.",
+               std::thread::hardware_concurrency());
+  AXY_LOG_INFO("  gRPC: CPUs {}, memory quota {}.",
+               opts_.grpc_cpus.ToString(),
+               opts_.grpc_memory_quota_bytes > 0
+                   ? fmt::format("{} MiB",
+                                 opts_.grpc_memory_quota_bytes / (1 << 20))
+                   : "unlimited");
+  AXY_LOG_INFO("  Redis: {}, CPUs {} for watcher threads, {} pooled "
+               "connections each.",
+               events_->Describe(), opts_.redis_cpus.ToString(),
+               opts_.redis_pool_size);
+  for (const auto* admission :
+       {&opts_.speech_admission, &opts_.watch_admission}) {
+    if (admission->max_active > 0) {
+      AXY_LOG_INFO("  At most {} concurrent {}, {} more may wait for {}.",
+                   admission->max_active, admission->name,
+                   admission->max_queued, admission->max_queue_wait);
+    }
+  }
+  if (opts_.max_inflight_backend_writes > 0) {
+    AXY_LOG_INFO(
+        "  At most {} in-flight backend writes, shared {}:{} between "
+        "interactive and batch streams.",
+        opts_.max_inflight_backend_writes, opts_.interactive_weight,
+        opts_.batch_weight);
+  }
+  if (reaper_ != nullptr) {
+    const auto& timeouts = opts_.stream_timeouts;
+    AXY_LOG_INFO(
+        "  Speech stream timeouts: client idle {}, backend idle {}, "
+        "duration {} (0 is unlimited).",
+        timeouts.client_idle, timeouts.backend_idle, timeouts.max_duration);
+  }
+}
+
+void Server::StartReadinessProbes() {
+  readiness_thread_ = std::jthread{[this](std::stop_token stop) {
+    std::optional<Clock::duration> redis_ready;
+    std::optional<Clock::duration> backend_ready;
+
+    {
+      std::jthread redis_probe{[&, this]() {
+        // Probe with a separate client that has a connect timeout, so an
+        // unreachable Redis doesn't block us for the whole TCP timeout.
+        EventStore probe_client{{
+            .addresses = opts_.redis_addresses,
+            .cluster = opts_.redis_cluster,
+            .connect_timeout = std::chrono::milliseconds{500},
+            .socket_timeout = std::chrono::milliseconds{500},
+        }};
+
+        redis_ready = WaitUntilReady(
+            stop, "Redis", started_at_, opts_.backend_speech_wait_delay, [&]() {
+              try {
+                probe_client.Ping();
+                // Warm up connections in the shared pools as well.
+                events_->Ping();
+                return true;
+              } catch (const sw::redis::Error& e) {
+                AXY_LOG_DEBUG("Redis not ready: {}", e.what());
+                return false;
+              }
+            });
+      }};
+
+      std::jthread backend_probe{[&, this]() {
+        backend_ready = WaitUntilReady(
+            stop, "Backend speech server", started_at_,
+            opts_.backend_speech_wait_delay, [this, &stop]() {
+              const auto deadline = std::chrono::system_clock::now() +
+                                    std::chrono::milliseconds{250};
+              return !stop.stop_requested() &&
+                     backend_channels_->WaitForConnected(deadline) &&
+                     std::all_of(route_channels_.begin(),
+                                 route_channels_.end(),
+                                 [&](const auto& channels) {
+                                   return channels->WaitForConnected(deadline);
+                                 });
+            });
+      }};
+    }
+
+    if (stop.stop_requested() || !redis_ready || !backend_ready) {
+      return;
+    }
+
+    grpc_server_->GetHealthCheckService()->SetServingStatus(true);
+    AXY_LOG_INFO(
+        "Ready to serve after {} (Redis: {}, backend: {}).",
+        std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() -
+                                                              started_at_),
+        std::chrono::duration_cast<std::chrono::milliseconds>(*redis_ready),
+        std::chrono::duration_cast<std::chrono::milliseconds>(*backend_ready));
+  }};
+}
+
+std::shared_ptr<grpc::Channel> Server::InProcessChannel(
+    const grpc::ChannelArguments& args) const {
+  return grpc_server_->InProcessChannel(args);
 }
 
 void Server::Wait() { grpc_server_->Wait(); }
 
 void Server::Shutdown() {
   AXY_LOG_INFO("Shutting down with a deadline of {}", opts_.shutdown_timeout);
+  readiness_thread_.request_stop();
+  if (admin_server_ != nullptr) {
+    admin_server_->Shutdown();
+  }
   if (grpc_server_ != nullptr) {
+    grpc_server_->GetHealthCheckService()->SetServingStatus(false);
     grpc_server_->Shutdown(std::chrono::system_clock::now() +
                            opts_.shutdown_timeout);
   }
+  // After the gRPC server, so WebSocket streams get the same grace period.
+  // This closes the sockets of clients that are still connected.
+  if (websocket_server_ != nullptr) {
+    websocket_server_->Shutdown();
+  }
 }
 
 }  // namespace axy
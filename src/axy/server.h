@@ -3,14 +3,31 @@
 
 #include <grpcpp/channel.h>
 #include <grpcpp/server.h>
+#include <grpcpp/support/channel_arguments.h>
 
+#include <chrono>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include "src/axy/admission.h"
+#include "src/axy/backend-pool.h"
+#include "src/axy/batch-service.h"
 #include "src/axy/event-service.h"
+#include "src/axy/event-sink.h"
+#include "src/axy/event-store.h"
+#include "src/axy/local-event-bus.h"
+#include "src/axy/http-server.h"
+#include "src/axy/idle-reaper.h"
+#include "src/axy/speech-router.h"
 #include "src/axy/speech-service.h"
-#include "sw/redis++/redis.h"
+#include "src/axy/speech-websocket.h"
+#include "src/axy/threading.h"
+#include "src/axy/timer-wheel.h"
+#include "src/axy/tracing.h"
+#include "src/axy/transcript-service.h"
 
 namespace axy {
 
@@ -21,26 +38,159 @@ struct ServerError : public std::runtime_error {
 class Server final {
  public:
   struct Options {
+    /// TCP address for the gRPC server. Empty when only in-process callers
+    /// (see `InProcessChannel()`) or the Unix socket should be served.
     std::string listen_address = "localhost:50051";
+    /// Path of a Unix domain socket to also serve gRPC on. Empty disables it.
+    std::string unix_socket_path;
+    /// Let other processes listen on the same gRPC and WebSocket addresses
+    /// with `SO_REUSEPORT`, for running several workers (see `supervisor.h`).
+    bool reuse_port = false;
     bool backend_speech_server_use_tls = true;
     std::string backend_speech_server_address = "speech.tiro.is:443";
+    /// How often to warn while still waiting for the backend to become
+    /// reachable. Startup itself is never blocked on the backend.
     std::chrono::seconds backend_speech_wait_delay{10};
-    std::string redis_address = "tcp://localhost:6379";
+    /// Number of independent connections to the backend. Streams are spread
+    /// over them by the number of streams each has in flight.
+    std::size_t backend_connections = 1;
+    /// Backends for streams in other languages or asking for other models.
+    /// Streams that match none of them go to the backend above.
+    std::vector<BackendRoute> backend_routes;
+    /// Redis servers for conversation events. Several addresses are either
+    /// seed nodes of a Redis Cluster (`redis_cluster`) or independent shards.
+    std::vector<std::string> redis_addresses{"tcp://localhost:6379"};
+    bool redis_cluster = false;
+    /// Events waiting to be written to Redis beyond this are dropped.
+    std::size_t redis_write_queue_size = 65536;
+    /// Store events in the compact encoding of `EventEncoder`, which only Axy
+    /// reads. Readers understand both encodings either way.
+    bool compact_events = false;
+    /// Recent events kept per locally watched conversation, for delivering
+    /// events to watchers on this instance without going through Redis. 0
+    /// disables local delivery.
+    std::size_t local_event_ring_size = 256;
+    /// How long events for watchers that asked for batches wait for more
+    /// events to join them.
+    std::chrono::milliseconds watch_batch_linger{5};
     std::chrono::seconds shutdown_timeout{60};
+
+    /// Memory quota for the gRPC server in bytes, 0 for unlimited.
+    std::size_t grpc_memory_quota_bytes = 0;
+    /// Largest message the gRPC server accepts, which limits the audio
+    /// clients can send inline to `BatchRecognize`. gRPC's default is 4 MiB.
+    std::size_t grpc_max_receive_message_bytes = 64 << 20;
+    /// CPUs for gRPC's threads. Only the threads gRPC spawns while the
+    /// backend channels and the server are created are pinned directly, the
+    /// rest inherit their affinity.
+    CpuSet grpc_cpus;
+    /// CPUs for threads doing blocking Redis work (e.g. event watchers).
+    CpuSet redis_cpus;
+    /// Number of pooled connections per Redis shard or cluster node.
+    std::size_t redis_pool_size = 1;
+
+    AdmissionController::Options speech_admission{
+        .name = "speech streams", .metrics_name = "speech_streams"};
+    AdmissionController::Options watch_admission{
+        .name = "event watchers", .metrics_name = "watchers"};
+
+    /// Relative shares of stream slots and backend writes for the priority
+    /// classes when there is contention.
+    unsigned interactive_weight = 8;
+    unsigned batch_weight = 1;
+    /// Maximum number of in-flight writes to the backend, 0 for unlimited.
+    std::size_t max_inflight_backend_writes = 0;
+    /// Speech streams exceeding these are closed with `DEADLINE_EXCEEDED`,
+    /// which frees their backend stream. Without interim results the backend
+    /// only responds at the end of each utterance, so `backend_idle` has to
+    /// allow for the longest one.
+    StreamTimeouts stream_timeouts;
+    /// Publish an interim transcript as a provisional final event once it
+    /// has stayed the same for this long, instead of waiting for the
+    /// backend's endpointer. 0 disables it.
+    std::chrono::milliseconds stabilization_window{0};
+    /// Memory for replaying the results of audio that was recognized before,
+    /// e.g. prompts played back to callers. 0 disables the cache.
+    std::size_t audio_cache_bytes = 0;
+    /// Most backend streams opened ahead of time per backend and stream
+    /// config, for a faster first partial. 0 disables them. Warm streams
+    /// don't carry the client's deadline, they are cancelled when the
+    /// client's call fails instead.
+    std::size_t warm_streams_per_profile = 0;
+    /// Warm streams are replaced before idling this long, which has to be
+    /// shorter than the backend waits for audio.
+    std::chrono::milliseconds warm_stream_max_idle{5000};
+    /// Conversations whose transcript so far is kept in memory for
+    /// `GetTranscript`. Others are rebuilt from their events in Redis.
+    std::size_t transcript_snapshots = 10000;
+    /// Threads answering `GetTranscript`, which may block on Redis.
+    std::size_t transcript_threads = 4;
+
+    /// Offline transcription of complete recordings.
+    BatchServiceOptions batch;
+
+    /// Address for the HTTP admin server with `/metrics`. Empty disables it.
+    std::string admin_address;
+    /// Address for serving speech streams to browsers over WebSocket (see
+    /// `SpeechWebSocketBridge`). Empty disables it.
+    std::string websocket_address;
+    /// Most WebSocket connections at once, each of which has a thread for as
+    /// long as its stream lasts. Others are turned away with a 503.
+    std::size_t websocket_max_connections = 1024;
+
+    /// Per-stream latency tracing. Disabled unless `sample_ratio` is positive
+    /// and an export destination is given.
+    Tracer::Options tracing;
   };
 
+  /// Starts listening immediately. Redis and the backend speech server are
+  /// connected in the background and the health service reports NOT_SERVING
+  /// until both are reachable.
   explicit Server(Options opts);
   ~Server() = default;
   void Wait();
   void Shutdown();
 
+  /** A channel to this server that skips the network entirely.
+   *
+   * Calls on it go straight into the server's completion queues without TCP,
+   * TLS or HTTP/2 framing. Use it with stubs for `SpeechService`,
+   * `EventService`, `BatchSpeech` and `Transcripts` when embedding Axy in
+   * another process.
+   */
+  std::shared_ptr<grpc::Channel> InProcessChannel(
+      const grpc::ChannelArguments& args = {}) const;
+
  private:
+  void StartReadinessProbes();
+  void LogThreadTopology() const;
+
+  std::chrono::steady_clock::time_point started_at_;
   Options opts_;
-  std::shared_ptr<sw::redis::Redis> redis_;
-  std::shared_ptr<grpc::Channel> backend_speech_channel_;
+  std::shared_ptr<EventStore> events_;
+  /// Null if disabled.
+  std::shared_ptr<TranscriptSnapshots> transcript_snapshots_;
+  std::shared_ptr<RedisEventSink> redis_event_sink_;
+  std::shared_ptr<LocalEventBus> local_events_;
+  std::shared_ptr<AdmissionController> speech_admission_;
+  std::shared_ptr<AdmissionController> watch_admission_;
+  std::shared_ptr<AdmissionController> backend_writes_;
+  std::shared_ptr<Tracer> tracer_;
+  /// Coarse timers shared by all streams, null if nothing needs them.
+  std::shared_ptr<TimerWheel> timers_;
+  std::shared_ptr<IdleReaper> reaper_;
+  std::shared_ptr<BackendChannelPool> backend_channels_;
+  /// One for each of `Options::backend_routes`.
+  std::vector<std::shared_ptr<BackendChannelPool>> route_channels_;
   axy::EventServiceImpl event_cb_service_;
   std::unique_ptr<axy::SpeechService> speech_cb_service_;
+  std::unique_ptr<axy::BatchSpeechService> batch_cb_service_;
+  axy::TranscriptServiceImpl transcript_cb_service_;
   std::unique_ptr<grpc::Server> grpc_server_;
+  std::unique_ptr<HttpServer> admin_server_;
+  std::unique_ptr<SpeechWebSocketBridge> websocket_bridge_;
+  std::unique_ptr<HttpServer> websocket_server_;
+  std::jthread readiness_thread_;
 };
 
 }  // namespace axy
@@ -0,0 +1,209 @@
+#include "src/axy/speech-router.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+#include "src/axy/logging.h"
+
+namespace axy {
+
+namespace {
+
+std::string Lowercase(std::string_view s) {
+  std::string out{s};
+  std::transform(out.begin(), out.end(), out.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return out;
+}
+
+/// Split off everything up to the first `sep` in `s`.
+std::string_view SplitOff(std::string_view& s, char sep) {
+  const auto pos = s.find(sep);
+  const auto head = s.substr(0, pos);
+  s = pos == std::string_view::npos ? "" : s.substr(pos + 1);
+  return head;
+}
+
+std::string ModelFromMetadata(const grpc::CallbackServerContext& context) {
+  const auto& metadata = context.client_metadata();
+  const auto it = metadata.find(
+      grpc::string_ref{kModelMetadataKey.data(), kModelMetadataKey.size()});
+  if (it == metadata.cend()) {
+    return "";
+  }
+  return {it->second.data(), it->second.size()};
+}
+
+}  // namespace
+
+BackendRoute BackendRoute::Parse(std::string_view spec,
+                                 const BackendRoute& defaults) {
+  const auto invalid = [spec](std::string_view why) {
+    return std::invalid_argument{
+        fmt::format("invalid backend route '{}': {}", spec, why)};
+  };
+
+  auto rest = spec;
+  if (rest.find('=') == std::string_view::npos) {
+    throw invalid("expected LANGUAGE[/MODEL]=ADDRESS[,OPTION=VALUE...]");
+  }
+  auto key = SplitOff(rest, '=');
+
+  BackendRoute route = defaults;
+  route.language_code = SplitOff(key, '/');
+  route.model = key;
+  route.address = SplitOff(rest, ',');
+  if (route.language_code.empty() || route.address.empty()) {
+    throw invalid("language and address are required");
+  }
+
+  while (!rest.empty()) {
+    auto value = SplitOff(rest, ',');
+    const auto option = SplitOff(value, '=');
+    if (option == "connections") {
+      const auto* end = value.data() + value.size();
+      if (std::from_chars(value.data(), end, route.connections).ptr != end ||
+          route.connections == 0) {
+        throw invalid("`connections` has to be a positive number");
+      }
+    } else if (option == "tls") {
+      if (value != "true" && value != "false") {
+        throw invalid("`tls` has to be `true` or `false`");
+      }
+      route.use_tls = value == "true";
+    } else {
+      throw invalid(fmt::format("unknown option `{}`", option));
+    }
+  }
+  return route;
+}
+
+std::string BackendRoute::Name() const {
+  return model.empty() ? language_code : language_code + "/" + model;
+}
+
+SpeechRouter::SpeechRouter(std::shared_ptr<SpeechBackend> default_backend,
+                           std::vector<Route> routes)
+    : default_target_{MakeTarget(std::move(default_backend))} {
+  for (auto& route : routes) {
+    auto key = std::make_pair(Lowercase(route.language_code),
+                              Lowercase(route.model));
+    AXY_LOG_INFO("Routing {} streams{} to backend '{}'.", route.language_code,
+                 route.model.empty()
+                     ? ""
+                     : fmt::format(" for model '{}'", route.model),
+                 route.backend->name());
+    if (!routes_.emplace(std::move(key), MakeTarget(std::move(route.backend)))
+             .second) {
+      throw std::invalid_argument{fmt::format(
+          "More than one backend route for language '{}' and model '{}'.",
+          route.language_code, route.model)};
+    }
+  }
+}
+
+SpeechRouter::Target SpeechRouter::MakeTarget(
+    std::shared_ptr<SpeechBackend> backend) {
+  auto* streams = &MetricsRegistry::Global().GetGauge(
+      "axy_route_streams", "Speech streams in flight on each backend route.",
+      {{"route", backend->name()}});
+  return {.backend = std::move(backend), .streams = streams};
+}
+
+const SpeechRouter::Target& SpeechRouter::Pick(std::string_view language_code,
+                                               std::string_view model) const {
+  auto key = std::make_pair(
+      Lowercase(language_code.empty() ? kDefaultLanguageCode : language_code),
+      Lowercase(model));
+  if (const auto it = routes_.find(key); it != routes_.cend()) {
+    return it->second;
+  }
+  key.second.clear();
+  if (const auto it = routes_.find(key); it != routes_.cend()) {
+    return it->second;
+  }
+  return default_target_;
+}
+
+SpeechServerReactor* SpeechRouter::StreamingRecognize(
+    grpc::CallbackServerContext* context) {
+  // This is a self deleting callback reactor, which hands the stream to the
+  // backend of its route once the first message is in.
+  class RoutingReactor : public SpeechServerReactor {
+   public:
+    RoutingReactor(const SpeechRouter& router,
+                   grpc::CallbackServerContext* context)
+        : router_{router}, context_{context} {
+      // We need the streaming config before we can pick a route.
+      StartRead(&first_);
+    }
+
+    void OnReadDone(bool ok) override {
+      if (handler_ != nullptr) {
+        handler_->OnReadDone(ok);
+        return;
+      }
+
+      const auto& target =
+          router_.Pick(first_.streaming_config().config().language_code(),
+                       ModelFromMetadata(*context_));
+      streams_ = target.streams;
+      streams_->Add(1);
+      auto* handler = target.backend->Open(this, context_, std::move(first_));
+      bool cancelled;
+      {
+        std::lock_guard<std::mutex> lg{cancel_mtx_};
+        handler_ = handler;
+        cancelled = cancelled_;
+      }
+      handler->OnReadDone(ok);
+      if (cancelled) {
+        handler->OnCancel();
+      }
+    }
+
+    void OnWriteDone(bool ok) override { handler_->OnWriteDone(ok); }
+
+    void OnCancel() override {
+      SpeechStreamHandler* handler;
+      {
+        std::lock_guard<std::mutex> lg{cancel_mtx_};
+        cancelled_ = true;
+        handler = handler_;
+      }
+      // Otherwise the handler hears about it once it's there.
+      if (handler != nullptr) {
+        handler->OnCancel();
+      }
+    }
+
+    void OnDone() override {
+      if (handler_ != nullptr) {
+        handler_->OnDone();
+        streams_->Add(-1);
+      }
+      delete this;
+    }
+
+   private:
+    const SpeechRouter& router_;
+    grpc::CallbackServerContext* context_;
+    sdifi::speech::v1alpha::StreamingRecognizeRequest first_;
+    /// Set once the first message is in. Only `OnCancel` may race with
+    /// setting it.
+    SpeechStreamHandler* handler_ = nullptr;
+    Gauge* streams_ = nullptr;
+    std::mutex cancel_mtx_;
+    bool cancelled_ = false;
+  };
+
+  return new RoutingReactor{*this, context};
+}
+
+}  // namespace axy
@@ -0,0 +1,90 @@
+#ifndef AXY_SRC_AXY_SPEECH_ROUTER_H_
+#define AXY_SRC_AXY_SPEECH_ROUTER_H_
+
+#include <grpcpp/server_context.h>
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "src/axy/metrics.h"
+#include "src/axy/speech-service.h"
+
+namespace axy {
+
+/// Clients pick between routes for the same language with this metadata key.
+inline constexpr std::string_view kModelMetadataKey = "x-axy-model";
+
+/// A backend cluster for the speech streams of one language, and optionally
+/// only those asking for one model.
+struct BackendRoute {
+  std::string language_code;
+  /// Empty for streams asking for any model, or none.
+  std::string model;
+  std::string address;
+  bool use_tls = true;
+  std::size_t connections = 1;
+
+  /** Parse a route like "en-US/phone=speech.googleapis.com:443,connections=4".
+   *
+   * The language and address are required. `connections` and `tls` (`true`
+   * or `false`) are optional and taken from `defaults` if missing.
+   *
+   * \throws std::invalid_argument if `spec` is malformed.
+   */
+  static BackendRoute Parse(std::string_view spec,
+                            const BackendRoute& defaults);
+
+  /// The language and model, e.g. "en-US/phone", which labels metrics.
+  std::string Name() const;
+};
+
+/** Sends each speech stream to a backend picked by its first message.
+ *
+ * Streams go to the route for the language code of their streaming config
+ * and the model in their `x-axy-model` metadata, or for their language and
+ * any model, or else to the default backend. Language codes are compared
+ * case-insensitively, and streams without one are in `kDefaultLanguageCode`.
+ *
+ * Streams in flight on each route are exported as
+ * `axy_route_streams{route}`, next to the per route backend latencies.
+ */
+class SpeechRouter final : public SpeechService {
+ public:
+  struct Route {
+    std::string language_code;
+    /// Empty matches any model.
+    std::string model;
+    std::shared_ptr<SpeechBackend> backend;
+  };
+
+  explicit SpeechRouter(std::shared_ptr<SpeechBackend> default_backend,
+                        std::vector<Route> routes = {});
+
+  SpeechServerReactor* StreamingRecognize(
+      grpc::CallbackServerContext* context) override;
+
+ private:
+  struct Target {
+    std::shared_ptr<SpeechBackend> backend;
+    Gauge* streams;
+  };
+
+  static Target MakeTarget(std::shared_ptr<SpeechBackend> backend);
+
+  /// Where a stream in `language_code` asking for `model` goes.
+  const Target& Pick(std::string_view language_code,
+                     std::string_view model) const;
+
+  const Target default_target_;
+  /// By lowercase language code and model.
+  std::map<std::pair<std::string, std::string>, Target> routes_;
+};
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_SPEECH_ROUTER_H_
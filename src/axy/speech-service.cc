@@ -8,27 +8,64 @@
 #include <grpcpp/support/status.h>
 #include <sdifi/events/v1alpha/event.pb.h>
 #include <sdifi/speech/v1alpha/speech.pb.h>
-#include <sw/redis++/redis.h>
 #include <tiro/speech/v1alpha/speech.grpc.pb.h>
 #include <tiro/speech/v1alpha/speech.pb.h>
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <deque>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <utility>
 #include <vector>
 
+#include "src/axy/admission.h"
+#include "src/axy/audio-cache.h"
+#include "src/axy/audio.h"
+#include "src/axy/event-sink.h"
+#include "src/axy/idle-reaper.h"
 #include "src/axy/logging.h"
+#include "src/axy/memory-accounting.h"
+#include "src/axy/metrics.h"
+#include "src/axy/priority.h"
 #include "src/axy/server.h"
+#include "src/axy/stabilizer.h"
+#include "src/axy/tracing.h"
+#include "src/axy/warm-stream-pool.h"
 
 namespace axy {
 
 namespace {
 
+/// Interactive streams only wait on the audio cache for recordings this
+/// short, so their first partial isn't held back for long. Batch streams
+/// wait for any length.
+constexpr std::size_t kMaxInteractiveCachedAudio =
+    2 * AudioFingerprint::kCheckpointBytes;
+
+MemoryAccount& ServerReactorMemory() {
+  static MemoryAccount& account = MemoryAccount::For("server_reactor");
+  return account;
+}
+
+MemoryAccount& ClientReactorMemory() {
+  static MemoryAccount& account = MemoryAccount::For("client_reactor");
+  return account;
+}
+
+std::int64_t ByteSize(const google::protobuf::Message& message) {
+  return static_cast<std::int64_t>(message.ByteSizeLong());
+}
+
 template <GoogleApiCompatibleTypes BackendTypes>
 auto Convert(
     const typename BackendTypes::StreamingRecognizeResponse::SpeechEventType&
@@ -99,6 +136,51 @@ std::optional<std::string> ConvertToEvent(
   return type;
 }
 
+/** Publish `resp` to all event sinks
+ *
+ * `published` has the conversation ID and tags of the event, the rest is
+ * filled in from `resp`.
+ *
+ * \returns Whether `resp` made for an event
+ */
+template <GoogleApiCompatibleTypes BackendTypes>
+bool PublishEvent(const SpeechServiceResources& resources,
+                  StreamIdGenerator& event_ids,
+                  const typename BackendTypes::StreamingRecognizeResponse& resp,
+                  ConversationEvent published) {
+  if (resources.event_sinks.empty()) {
+    return false;
+  }
+  const auto& conversation_id = published.conversation_id;
+  auto event = std::make_shared<sdifi::events::v1alpha::Event>();
+  auto type = ConvertToEvent<BackendTypes>(conversation_id, resp, *event);
+  if (!type) {
+    return false;
+  }
+  published.id = event_ids.Next();
+  published.type = std::move(*type);
+  published.event = std::move(event);
+  AXY_CONV_LOG_DEBUG(conversation_id, "{}: publishing event {}",
+                     conversation_id, published.id.ToString());
+  for (const auto& sink : resources.event_sinks) {
+    sink->Publish(published);
+  }
+  return true;
+}
+
+/// What in a streaming config can change the results for the same audio.
+/// Results of different routes may come from different kinds of backends.
+std::string AudioCacheKey(
+    std::string_view route,
+    const sdifi::speech::v1alpha::StreamingRecognitionConfig& config) {
+  const auto& rec = config.config();
+  return fmt::format("{}|{}|{}|{}|{}|{}|{}|{}|{}", route, rec.language_code(),
+                     rec.sample_rate_hertz(), static_cast<int>(rec.encoding()),
+                     rec.enable_automatic_punctuation(),
+                     rec.enable_word_time_offsets(), rec.max_alternatives(),
+                     config.interim_results(), config.single_utterance());
+}
+
 template <GoogleApiCompatibleTypes BackendTypes>
 void ConvertRequest(const sdifi::speech::v1alpha::StreamingRecognizeRequest& in,
                     typename BackendTypes::StreamingRecognizeRequest& out) {
@@ -116,7 +198,7 @@ void ConvertRequest(const sdifi::speech::v1alpha::StreamingRecognizeRequest& in,
     out_rec_config->set_enable_automatic_punctuation(
         in_config.enable_automatic_punctuation());
     if (in_config.language_code().empty()) {
-      out_rec_config->set_language_code("is-IS");
+      out_rec_config->set_language_code(std::string{kDefaultLanguageCode});
     } else {
       out_rec_config->set_language_code(in_config.language_code());
     }
@@ -181,84 +263,408 @@ void ConvertResponse(
   }
 }
 
+/** A backend stream, which passes its callbacks on to its handler.
+ *
+ * Warm streams are opened and sent their config by the warm stream pool
+ * before there is a speech stream for them, and only get their handler once
+ * one takes them. Until then the pool hears whether they are ready or broke.
+ */
+template <GoogleApiCompatibleTypes BackendTypes>
+class BackendStream final
+    : public grpc::ClientBidiReactor<
+          typename BackendTypes::StreamingRecognizeRequest,
+          typename BackendTypes::StreamingRecognizeResponse>,
+      public WarmStreamPool::Stream {
+ public:
+  class Handler {
+   public:
+    virtual ~Handler() = default;
+
+    virtual void OnReadDone(bool ok) = 0;
+    virtual void OnWriteDone(bool ok) = 0;
+    virtual void OnWritesDoneDone(bool ok) = 0;
+    /// The stream deletes itself once this returns.
+    virtual void OnDone(const grpc::Status& status) = 0;
+  };
+
+  /// A stream for a speech stream that's already there, see `Attach`.
+  BackendStream(typename BackendTypes::Speech::Stub* stub,
+                BackendChannelPool::Lease lease,
+                std::unique_ptr<grpc::ClientContext> ctx,
+                const std::map<std::string, std::string>& extra_headers)
+      : lease_{std::move(lease)}, ctx_{std::move(ctx)} {
+    for (const auto& [key, val] : extra_headers) {
+      ctx_->AddMetadata(key, val);
+    }
+    stub->async()->StreamingRecognize(ctx_.get(), this);
+  }
+
+  /// A warm stream for `pool`, which sends `config` once started. Keeps
+  /// `channels` alive for its lease, since it may outlive the backend.
+  BackendStream(typename BackendTypes::Speech::Stub* stub,
+                BackendChannelPool::Lease lease,
+                std::shared_ptr<BackendChannelPool> channels,
+                const std::map<std::string, std::string>& extra_headers,
+                typename BackendTypes::StreamingRecognizeRequest config,
+                std::weak_ptr<WarmStreamPool> pool)
+      : BackendStream{stub, std::move(lease),
+                      std::make_unique<grpc::ClientContext>(), extra_headers} {
+    channels_ = std::move(channels);
+    pool_ = std::move(pool);
+    warm_ = true;
+    out_req = std::move(config);
+  }
+
+  /// Start the call with a read pending and a hold, which the handler
+  /// removes once it's done reading. Warm streams also send their config.
+  void Start() override {
+    this->StartRead(&in_resp);
+    this->AddHold();
+    if (warm_) {
+      this->StartWrite(&out_req);
+    }
+    this->StartCall();
+  }
+
+  void Close() override {
+    ctx_->TryCancel();
+    this->RemoveHold();
+  }
+
+  void TryCancel() { ctx_->TryCancel(); }
+
+  /** Pass the callbacks on to `handler` from now on.
+   *
+   * \returns false if a warm stream broke after it was taken, in which case
+   *          it closes itself and must not be used.
+   */
+  bool Attach(Handler* handler) {
+    {
+      std::lock_guard<std::mutex> lg{mtx_};
+      if (!broken_) {
+        handler_ = handler;
+        return true;
+      }
+    }
+    Close();
+    return false;
+  }
+
+  void OnReadDone(bool ok) override {
+    // Nothing should come before the audio, so a warm stream that got
+    // anything is no good.
+    if (auto* handler = HandlerOrBreak(); handler != nullptr) {
+      handler->OnReadDone(ok);
+    } else {
+      Lost();
+    }
+  }
+
+  void OnWriteDone(bool ok) override {
+    // Without a handler, this is the config of a warm stream.
+    if (ok) {
+      if (auto* handler = GetHandler(); handler != nullptr) {
+        handler->OnWriteDone(ok);
+      } else if (auto pool = pool_.lock()) {
+        pool->Ready(this);
+      }
+    } else if (auto* handler = HandlerOrBreak(); handler != nullptr) {
+      handler->OnWriteDone(ok);
+    } else {
+      Lost();
+    }
+  }
+
+  void OnWritesDoneDone(bool ok) override {
+    if (auto* handler = GetHandler(); handler != nullptr) {
+      handler->OnWritesDoneDone(ok);
+    }
+  }
+
+  void OnDone(const grpc::Status& status) override {
+    if (auto* handler = GetHandler(); handler != nullptr) {
+      handler->OnDone(status);
+    }
+    delete this;
+  }
+
+  typename BackendTypes::StreamingRecognizeResponse in_resp;
+  typename BackendTypes::StreamingRecognizeRequest out_req;
+
+ private:
+  Handler* GetHandler() {
+    std::lock_guard<std::mutex> lg{mtx_};
+    return handler_;
+  }
+
+  /// The handler, or null after marking a warm stream as broken, so that
+  /// `Attach` fails.
+  Handler* HandlerOrBreak() {
+    std::lock_guard<std::mutex> lg{mtx_};
+    if (handler_ == nullptr) {
+      broken_ = true;
+    }
+    return handler_;
+  }
+
+  /// A warm stream broke before it got a handler.
+  void Lost() {
+    // Otherwise it's been closed by the pool, or taken and `Attach` closes
+    // it.
+    auto pool = pool_.lock();
+    if (pool != nullptr && pool->Lost(this)) {
+      Close();
+    }
+  }
+
+  std::shared_ptr<BackendChannelPool> channels_;
+  // Counts this stream against its backend channel until it's deleted.
+  BackendChannelPool::Lease lease_;
+  std::unique_ptr<grpc::ClientContext> ctx_;
+  bool warm_ = false;
+  std::weak_ptr<WarmStreamPool> pool_;
+
+  std::mutex mtx_;
+  Handler* handler_ = nullptr;
+  bool broken_ = false;
+};
+
 }  // namespace
 
-template class SpeechServiceImpl<TiroSpeechTypes>;
-template class SpeechServiceImpl<GoogleSpeechTypes>;
+template <GoogleApiCompatibleTypes BackendTypes>
+WarmStreamPool::Stream* SpeechBackendImpl<BackendTypes>::OpenWarmStream(
+    const std::string& profile) {
+  typename BackendTypes::StreamingRecognizeRequest config;
+  config.ParseFromString(profile);
+  auto lease = backend_->Acquire();
+  auto* stub = stubs_[lease.index()].get();
+  return new BackendStream<BackendTypes>{
+      stub, std::move(lease), backend_, extra_headers_,
+      std::move(config), warm_streams_};
+}
+
+template class SpeechBackendImpl<TiroSpeechTypes>;
+template class SpeechBackendImpl<GoogleSpeechTypes>;
 
 template <GoogleApiCompatibleTypes BackendTypes>
-grpc::ServerBidiReactor<sdifi::speech::v1alpha::StreamingRecognizeRequest,
-                        sdifi::speech::v1alpha::StreamingRecognizeResponse>*
-SpeechServiceImpl<BackendTypes>::StreamingRecognize(
-    grpc::CallbackServerContext* context) {
-  // This is a self deleting callback reactor
-  class ServerReactor
-      : public grpc::ServerBidiReactor<
-            sdifi::speech::v1alpha::StreamingRecognizeRequest,
-            sdifi::speech::v1alpha::StreamingRecognizeResponse> {
+SpeechStreamHandler* SpeechBackendImpl<BackendTypes>::Open(
+    SpeechServerReactor* reactor, grpc::CallbackServerContext* context,
+    sdifi::speech::v1alpha::StreamingRecognizeRequest first) {
+  // This is a self deleting stream handler
+  class ServerReactor : public SpeechStreamHandler {
    public:
     explicit ServerReactor(
-        grpc::CallbackServerContext* context,
-        typename BackendTypes::Speech::Stub* stub,
-        sw::redis::Redis* redis_client,
-        const std::map<std::string, std::string>& extra_headers)
-        : client_reactor_{new ClientReactor{
-              this, stub,
-              grpc::ClientContext::FromCallbackServerContext(*context),
-              redis_client, extra_headers}} {
-      StartRead(&req);
-      client_reactor_->StartRead(&client_reactor_->in_resp);
-      client_reactor_->AddHold();
-      client_reactor_->StartCall();
+        SpeechServerReactor* reactor, grpc::CallbackServerContext* context,
+        sdifi::speech::v1alpha::StreamingRecognizeRequest first,
+        const std::string& route, BackendChannelPool& backend,
+        const std::vector<std::unique_ptr<typename BackendTypes::Speech::Stub>>&
+            stubs,
+        const SpeechServiceResources& resources,
+        const std::map<std::string, std::string>& extra_headers,
+        WarmStreamPool* warm_streams)
+        : SpeechStreamHandler{reactor},
+          context_{context},
+          route_{route},
+          backend_{backend},
+          stubs_{stubs},
+          resources_{resources},
+          extra_headers_{extra_headers},
+          warm_streams_{warm_streams},
+          priority_{PriorityFromMetadata(*context)},
+          req{std::move(first)} {
+      for (auto& gone : client_gone_) {
+        gone = true;
+      }
     }
 
     void SafelyFinish(grpc::Status status) {
       std::lock_guard<std::mutex> lg{finish_mtx_};
+      FinishLocked(std::move(status));
+    }
+
+    void FinishLocked(grpc::Status status) {
       if (finished_) {
         return;
       }
       finished_ = true;
-      if (!client_gone_) {
-        client_reactor_->server_gone = true;
+      if (!status.ok()) {
+        // Cold backend streams are cancelled with our call, whose deadline
+        // they carry, but warm ones were opened on their own.
+        CancelClientsLocked();
+      }
+      for (std::size_t channel = 0; channel < client_reactors_.size();
+           ++channel) {
+        if (client_alive_[channel]) {
+          client_reactors_[channel]->server_gone = true;
+        }
+      }
+      if (trace_ != nullptr) {
+        trace_->SetStatusCode(status.error_code());
       }
 
       Finish(status);
     }
 
-    void ReleaseClient() {
-      if (!client_gone_) {
-        client_reactor_->RemoveHold();
-        client_gone_ = true;
+    /// Called by the reaper when the stream exceeded one of its timeouts.
+    void Expire(IdleReaper::Reason reason) {
+      std::lock_guard<std::mutex> lg{finish_mtx_};
+      if (finished_) {
+        return;
+      }
+      AXY_LOG_INFO("{}: closing stream, {} timeout exceeded.",
+                   conversation_id_, ToString(reason));
+      // Frees the backend streams right away instead of waiting for the
+      // backend to notice.
+      CancelClientsLocked();
+      FinishLocked({grpc::StatusCode::DEADLINE_EXCEEDED,
+                    fmt::format("Stream closed, {} timeout exceeded",
+                                ToString(reason))});
+    }
+
+    void ReleaseClient(std::size_t channel) {
+      // Marked first, since the client reactor may be deleted right after
+      // its hold is removed.
+      if (!client_gone_[channel].exchange(true)) {
+        client_reactors_[channel]->RemoveHold();
+      }
+    }
+
+    /** Called by the client reactor of `channel` right before it deletes
+     * itself.
+     *
+     * Client reactors call us until then, from backend callbacks and the
+     * stabilizer's timer, so we outlive them: if the server stream is
+     * already done, the last one deletes us.
+     */
+    void RemoveClient(std::size_t channel) {
+      bool last = false;
+      {
+        std::lock_guard<std::mutex> lg{finish_mtx_};
+        client_alive_[channel] = false;
+        last = server_done_ &&
+               std::none_of(client_alive_.begin(), client_alive_.end(),
+                            [](bool alive) { return alive; });
+      }
+      if (last) {
+        delete this;
+      }
+    }
+
+    /// Called when a backend stream is done. The client stream finishes once
+    /// all of them are, or as soon as one fails.
+    void OnClientDone(const grpc::Status& status) {
+      std::lock_guard<std::mutex> lg{finish_mtx_};
+      --clients_running_;
+      if (status.ok() && clients_running_ == 0 && client_ended_ &&
+          recorder_ != nullptr) {
+        // The backend saw all of the audio, so its results are complete.
+        recorder_->Commit();
+      }
+      if (!status.ok() || clients_running_ == 0) {
+        CancelClientsLocked();
+        FinishLocked(status);
+      }
+    }
+
+    /// Called when a backend stream has accepted its part of the last client
+    /// message.
+    void OnClientWriteDone(bool ok) {
+      if (!ok) {
+        client_write_failed_ = true;
+      }
+      if (pending_client_writes_.fetch_sub(1) == 1 && !client_write_failed_) {
+        ReadNext();
+      }
+    }
+
+    /// Send `response` to the client, unless the stream finished. Called by
+    /// client reactors.
+    void QueueResponseIfOpen(
+        sdifi::speech::v1alpha::StreamingRecognizeResponse response) {
+      std::lock_guard<std::mutex> lg{finish_mtx_};
+      if (!finished_) {
+        QueueResponse(std::move(response));
+      }
+    }
+
+    /// Send `response` to the client once the ones before it are written.
+    void QueueResponse(
+        sdifi::speech::v1alpha::StreamingRecognizeResponse response) {
+      std::lock_guard<std::mutex> lg{write_mtx_};
+      memory_.Hold(ByteSize(response));
+      write_queue_.push_back(std::move(response));
+      if (!writing_) {
+        writing_ = true;
+        StartWrite(&write_queue_.front());
       }
     }
 
     void OnReadDone(bool ok) override {
+      if (!admission_requested_) {
+        admission_requested_ = true;
+        RequestAdmission(ok);
+        return;
+      }
+
+      if (watch_ != nullptr) {
+        watch_->Heard(IdleReaper::Party::kClient);
+      }
       if (ok) {
+        Trace(StreamTrace::Event::kClientFrameReceived);
         if (req.has_streaming_config()) {
           conversation_id_ = req.streaming_config().conversation();
           if (conversation_id_.empty()) {
-            client_reactor_->server_gone = true;
             SafelyFinish({grpc::StatusCode::INVALID_ARGUMENT,
                           "Conversation ID missing from `streaming_config`"});
             return;
           }
         }
-        ConvertRequest<BackendTypes>(req, client_reactor_->out_req);
-        StartWriteClient(&client_reactor_->out_req);
+        if (matcher_ != nullptr) {
+          MatchRequest();
+          return;
+        }
+        ForwardRequest();
       } else {
-        StartWritesDoneClient();
+        client_ended_ = true;
+        if (matcher_ != nullptr) {
+          FinishMatching();
+          return;
+        }
+        StartWritesDoneClients();
       }
     }
 
     void OnDone() override {
-      std::lock_guard<std::mutex> lg{finish_mtx_};
+      // Has to happen before we take the lock, since the admission callback
+      // takes it too.
+      resources_.admission->Cancel(pending_admission_);
+      // Same for the reaper, whose expiry callback takes the lock.
+      if (watch_ != nullptr) {
+        watch_->Stop();
+      }
+      StopReplay();
 
-      AXY_LOG_INFO("{}: server all done.", conversation_id_);
-      if (!client_gone_) {
-        client_reactor_->server_gone = true;
-        ReleaseClient();
+      bool last = false;
+      {
+        std::lock_guard<std::mutex> lg{finish_mtx_};
+
+        AXY_LOG_INFO("{}: server all done.", conversation_id_);
+        for (std::size_t channel = 0; channel < client_reactors_.size();
+             ++channel) {
+          if (client_alive_[channel]) {
+            client_reactors_[channel]->server_gone = true;
+            ReleaseClient(channel);
+          }
+        }
+        // Client reactors that are still there stop their stabilizers in
+        // their `OnDone`, and the last one deletes us, see `RemoveClient`.
+        server_done_ = true;
+        last = std::none_of(client_alive_.begin(), client_alive_.end(),
+                            [](bool alive) { return alive; });
+      }
+      if (last) {
+        delete this;
       }
-      delete this;
     }
 
     void OnCancel() override {
@@ -270,84 +676,541 @@ SpeechServiceImpl<BackendTypes>::StreamingRecognize(
       if (!ok) {
         AXY_LOG_DEBUG("{}: no more server writes", conversation_id_);
         SafelyFinish(grpc::Status::CANCELLED);
+        return;
+      }
+      Trace(StreamTrace::Event::kClientWriteDone);
+
+      std::lock_guard<std::mutex> lg{write_mtx_};
+      memory_.Hold(-ByteSize(write_queue_.front()));
+      write_queue_.pop_front();
+      if (write_queue_.empty()) {
+        writing_ = false;
+      } else {
+        StartWrite(&write_queue_.front());
       }
     }
 
    private:
-    void StartWriteClient(
-        typename BackendTypes::StreamingRecognizeRequest* req) {
-      if (!client_gone_) {
-        client_reactor_->StartWrite(req);
+    void Trace(StreamTrace::Event event) {
+      if (trace_ != nullptr) {
+        trace_->Record(event);
+      }
+    }
+
+    static std::optional<PriorityClass> PriorityFromMetadata(
+        const grpc::CallbackServerContext& context) {
+      const auto& metadata = context.client_metadata();
+      const auto it = metadata.find(grpc::string_ref{
+          kPriorityMetadataKey.data(), kPriorityMetadataKey.size()});
+      if (it == metadata.cend()) {
+        return std::nullopt;
+      }
+      return ParsePriorityClass(
+          std::string_view{it->second.data(), it->second.size()});
+    }
+
+    /// Number of interleaved channels in the client's audio, 1 unless the
+    /// client says otherwise. 0 if the client sent something unusable.
+    static std::size_t ChannelsFromMetadata(
+        const grpc::CallbackServerContext& context) {
+      const auto& metadata = context.client_metadata();
+      const auto it = metadata.find(grpc::string_ref{
+          kAudioChannelsMetadataKey.data(), kAudioChannelsMetadataKey.size()});
+      if (it == metadata.cend()) {
+        return 1;
       }
+      std::size_t channels = 0;
+      const auto* end = it->second.data() + it->second.size();
+      if (std::from_chars(it->second.data(), end, channels).ptr != end ||
+          channels > kMaxAudioChannels) {
+        return 0;
+      }
+      return channels;
     }
 
-    void StartWritesDoneClient() {
-      if (!client_gone_) {
-        client_reactor_->StartWritesDone();
+    /// Called with the first message from the client, which has to contain
+    /// the streaming config.
+    void RequestAdmission(bool ok) {
+      if (!ok || !req.has_streaming_config()) {
+        SafelyFinish({grpc::StatusCode::INVALID_ARGUMENT,
+                      "First message has to contain `streaming_config`"});
+        return;
+      }
+
+      conversation_id_ = req.streaming_config().conversation();
+      if (conversation_id_.empty()) {
+        SafelyFinish({grpc::StatusCode::INVALID_ARGUMENT,
+                      "Conversation ID missing from `streaming_config`"});
+        return;
+      }
+
+      channels_ = ChannelsFromMetadata(*context_);
+      if (channels_ == 0) {
+        SafelyFinish({grpc::StatusCode::INVALID_ARGUMENT,
+                      fmt::format("`{}` has to be between 1 and {}",
+                                  kAudioChannelsMetadataKey,
+                                  kMaxAudioChannels)});
+        return;
+      }
+      if (channels_ > 1) {
+        deinterleaver_.emplace(channels_);
+      } else if (warm_streams_ != nullptr) {
+        typename BackendTypes::StreamingRecognizeRequest config;
+        ConvertRequest<BackendTypes>(req, config);
+        profile_ = config.SerializeAsString();
+      }
+
+      // Somebody who doesn't want interim results isn't waiting on the other
+      // end.
+      if (!priority_) {
+        priority_ = req.streaming_config().interim_results()
+                        ? PriorityClass::kInteractive
+                        : PriorityClass::kBatch;
+      }
+      AXY_LOG_DEBUG("{}: priority class {}, {} channels", conversation_id_,
+                    ToString(*priority_), channels_);
+
+      if (resources_.tracer != nullptr) {
+        trace_ = resources_.tracer->StartStream(conversation_id_);
+        if (trace_ != nullptr) {
+          trace_->SetAttribute("axy.priority",
+                               std::string{ToString(*priority_)});
+          Trace(StreamTrace::Event::kClientFrameReceived);
+        }
       }
+
+      pending_admission_ = resources_.admission->Acquire(
+          [this](std::optional<AdmissionController::Ticket> ticket) {
+            OnAdmission(std::move(ticket));
+          },
+          static_cast<std::size_t>(*priority_));
+    }
+
+    void OnAdmission(std::optional<AdmissionController::Ticket> ticket) {
+      std::lock_guard<std::mutex> lg{finish_mtx_};
+      if (finished_) {
+        return;
+      }
+      if (!ticket) {
+        FinishLocked(resources_.admission->RejectionStatus());
+        return;
+      }
+
+      ticket_ = std::move(ticket);
+      admitted_at_ = TimerWheel::Clock::now();
+      if (resources_.reaper != nullptr) {
+        watch_ = resources_.reaper->Start(
+            [this](IdleReaper::Reason reason) { Expire(reason); });
+      }
+
+      if (resources_.audio_cache != nullptr && channels_ == 1) {
+        const auto key = AudioCacheKey(route_, req.streaming_config());
+        recorder_ = resources_.audio_cache->Record(key);
+        matcher_ = *priority_ == PriorityClass::kInteractive
+                       ? resources_.audio_cache->Match(
+                             key, kMaxInteractiveCachedAudio)
+                       : resources_.audio_cache->Match(key);
+        if (matcher_->matching()) {
+          // Hold off on the backend until we know whether we need it.
+          HoldRequest();
+          ReadNext();
+          return;
+        }
+        matcher_.reset();
+      }
+
+      StartClientsLocked();
+      // `req` still holds the streaming config
+      ForwardRequest();
+    }
+
+    /// Open the backend streams, one per channel, or take a warm one.
+    void StartClientsLocked() {
+      // A multi-channel stream takes one admission slot, but a backend
+      // stream and connection lease per channel.
+      std::vector<BackendStream<BackendTypes>*> cold;
+      for (std::size_t channel = 0; channel < channels_; ++channel) {
+        auto* client_reactor =
+            new ClientReactor{this,       route_, channel, resources_,
+                              *priority_, trace_, watch_,  event_ids_};
+        client_reactors_.push_back(client_reactor);
+        client_gone_[channel] = false;
+        client_alive_[channel] = true;
+        if (AttachWarmStream(channel)) {
+          continue;
+        }
+        auto lease = backend_.Acquire();
+        auto* stub = stubs_[lease.index()].get();
+        auto* stream = new BackendStream<BackendTypes>{
+            stub, std::move(lease),
+            grpc::ClientContext::FromCallbackServerContext(*context_),
+            extra_headers_};
+        client_reactor->Use(stream, false);
+        stream->Attach(client_reactor);
+        cold.push_back(stream);
+      }
+      clients_running_ = channels_;
+
+      for (auto* stream : cold) {
+        stream->Start();
+      }
+    }
+
+    /// Hand the client reactor of `channel` a warm stream opened with our
+    /// config, if there is one. Its callbacks may come right away.
+    bool AttachWarmStream(std::size_t channel) {
+      if (warm_streams_ == nullptr || channels_ > 1) {
+        return false;
+      }
+      auto* client_reactor = client_reactors_[channel];
+      while (auto* stream = static_cast<BackendStream<BackendTypes>*>(
+                 warm_streams_->Take(profile_))) {
+        client_reactor->Use(stream, true);
+        // Fails if it broke since it was taken.
+        if (stream->Attach(client_reactor)) {
+          warm_ = true;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    /// Keep `req` in the backlog until we know whether we need the backend.
+    void HoldRequest() {
+      memory_.Hold(ByteSize(req));
+      backlog_.push_back(std::move(req));
+    }
+
+    /// Called with each message from the client while its audio could still
+    /// be in the audio cache.
+    void MatchRequest() {
+      const bool matching =
+          req.has_audio_content() && matcher_->Push(req.audio_content());
+      HoldRequest();
+      if (matching) {
+        ReadNext();
+        return;
+      }
+
+      AXY_LOG_DEBUG("{}: not in the audio cache, sending {} held messages",
+                    conversation_id_, backlog_.size());
+      matcher_.reset();
+      std::lock_guard<std::mutex> lg{finish_mtx_};
+      if (finished_) {
+        return;
+      }
+      StartClientsLocked();
+      ReadNext();
+    }
+
+    /// Called once the client's audio ended while it could still be in the
+    /// audio cache.
+    void FinishMatching() {
+      const auto hit = std::exchange(matcher_, nullptr)->Finish();
+      std::lock_guard<std::mutex> lg{finish_mtx_};
+      if (finished_) {
+        return;
+      }
+      if (hit != nullptr) {
+        AXY_LOG_INFO("{}: replaying {} responses from the audio cache",
+                     conversation_id_, hit->responses.size());
+        recorder_.reset();
+        for (const auto& held : backlog_) {
+          memory_.Hold(-ByteSize(held));
+        }
+        backlog_.clear();
+        replay_ = hit;
+        ScheduleReplay();
+        return;
+      }
+      StartClientsLocked();
+      ReadNext();
+    }
+
+    void ScheduleReplay() {
+      std::lock_guard<std::mutex> lg{replay_mtx_};
+      if (replay_stopped_) {
+        return;
+      }
+      // With the timing of the original stream, which is as if the backend
+      // were recognizing the audio as fast as it did back then.
+      const auto due = admitted_at_ + replay_->responses[replayed_].offset;
+      replay_timer_ = resources_.timers->Schedule(
+          std::max<TimerWheel::Clock::duration>(
+              due - TimerWheel::Clock::now(), {}),
+          [this] { ReplayNext(); });
+    }
+
+    void ReplayNext() {
+      std::lock_guard<std::mutex> lg{finish_mtx_};
+      if (finished_) {
+        return;
+      }
+      const auto& cached = replay_->responses[replayed_++];
+      typename BackendTypes::StreamingRecognizeResponse resp;
+      if (resp.ParseFromString(cached.serialized)) {
+        sdifi::speech::v1alpha::StreamingRecognizeResponse out;
+        ConvertResponse<BackendTypes>(resp, out);
+        QueueResponse(std::move(out));
+        if (PublishEvent<BackendTypes>(
+                resources_, *event_ids_, resp,
+                {.conversation_id = conversation_id_, .trace = trace_})) {
+          Trace(StreamTrace::Event::kEventPublished);
+        }
+      }
+
+      if (replayed_ == replay_->responses.size()) {
+        FinishLocked(grpc::Status::OK);
+        return;
+      }
+      ScheduleReplay();
+    }
+
+    /// The replay timer is neither running nor will it run once this
+    /// returns.
+    void StopReplay() {
+      TimerWheel::TimerId timer;
+      {
+        std::lock_guard<std::mutex> lg{replay_mtx_};
+        replay_stopped_ = true;
+        timer = replay_timer_;
+      }
+      if (timer != 0) {
+        resources_.timers->Cancel(timer);
+      }
+    }
+
+    void CancelClientsLocked() {
+      for (std::size_t channel = 0; channel < client_reactors_.size();
+           ++channel) {
+        if (!client_gone_[channel]) {
+          client_reactors_[channel]->TryCancel();
+        }
+      }
+    }
+
+    /// Pass `req` on to the backend streams, splitting multi-channel audio
+    /// between them.
+    void ForwardRequest() {
+      if (warm_ && req.has_streaming_config()) {
+        ReadNext();
+        return;
+      }
+      if (recorder_ != nullptr && req.has_audio_content()) {
+        recorder_->AddAudio(req.audio_content());
+      }
+      if (deinterleaver_ && req.has_audio_content()) {
+        deinterleaver_->Push(req.audio_content(), channel_audio_);
+        if (channel_audio_[0].empty()) {
+          // Not even one whole frame yet.
+          ReadNext();
+          return;
+        }
+        for (std::size_t channel = 0; channel < channels_; ++channel) {
+          if (!client_gone_[channel]) {
+            auto& out_req = client_reactors_[channel]->out_req();
+            out_req.Clear();
+            out_req.set_audio_content(std::move(channel_audio_[channel]));
+          }
+        }
+      } else {
+        for (std::size_t channel = 0; channel < channels_; ++channel) {
+          if (!client_gone_[channel]) {
+            ConvertRequest<BackendTypes>(
+                req, client_reactors_[channel]->out_req());
+          }
+        }
+      }
+      StartWriteClients();
+    }
+
+    void StartWriteClients() {
+      std::size_t writes = 0;
+      for (std::size_t channel = 0; channel < channels_; ++channel) {
+        writes += client_gone_[channel] ? 0 : 1;
+      }
+      if (writes == 0) {
+        return;
+      }
+      pending_client_writes_ = writes;
+      client_write_failed_ = false;
+      for (std::size_t channel = 0; channel < channels_; ++channel) {
+        if (!client_gone_[channel]) {
+          client_reactors_[channel]->ScheduleWrite();
+        }
+      }
+    }
+
+    void StartWritesDoneClients() {
+      if (watch_ != nullptr) {
+        // For the final results.
+        watch_->Await(IdleReaper::Party::kBackend);
+      }
+      for (std::size_t channel = 0; channel < client_reactors_.size();
+           ++channel) {
+        if (!client_gone_[channel]) {
+          client_reactors_[channel]->StartWritesDone();
+        }
+      }
+    }
+
+    void ReadNext() {
+      if (matcher_ == nullptr && !backlog_.empty()) {
+        // Held while matching against the audio cache.
+        req = std::move(backlog_.front());
+        backlog_.pop_front();
+        memory_.Hold(-ByteSize(req));
+        ForwardRequest();
+        return;
+      }
+      if (client_ended_ && matcher_ == nullptr) {
+        StartWritesDoneClients();
+        return;
+      }
+      if (watch_ != nullptr) {
+        watch_->Await(IdleReaper::Party::kClient);
+      }
+      StartRead(&req);
     }
 
     // TODO(rkjaran): Generalize this client callback reactor for more backends
-    class ClientReactor
-        : public grpc::ClientBidiReactor<
-              typename BackendTypes::StreamingRecognizeRequest,
-              typename BackendTypes::StreamingRecognizeResponse> {
+    class ClientReactor : public BackendStream<BackendTypes>::Handler {
      public:
+      /// Needs a stream, see `Use`.
       explicit ClientReactor(
-          ServerReactor* server_reactor,
-          typename BackendTypes::Speech::Stub* stub,
-          std::unique_ptr<grpc::ClientContext> ctx,
-          sw::redis::Redis* redis_client,
-          const std::map<std::string, std::string>& extra_headers)
+          ServerReactor* server_reactor, const std::string& route,
+          std::size_t channel, const SpeechServiceResources& resources,
+          PriorityClass priority,
+          std::shared_ptr<StreamTrace> trace,
+          std::shared_ptr<IdleReaper::Watch> watch,
+          std::shared_ptr<StreamIdGenerator> event_ids)
           : server_reactor_{server_reactor},
-            ctx_{std::move(ctx)},
-            redis_client_{redis_client} {
-        for (const auto& [key, val] : extra_headers) {
-          ctx_->AddMetadata(key, val);
+            conversation_id_{server_reactor->conversation_id_},
+            admitted_at_{server_reactor->admitted_at_},
+            channel_{channel},
+            tag_channel_{server_reactor->channels_ > 1},
+            route_{route},
+            resources_{resources},
+            priority_{priority},
+            trace_{std::move(trace)},
+            watch_{std::move(watch)},
+            event_ids_{std::move(event_ids)},
+            recorder_{server_reactor->recorder_},
+            started_at_{std::chrono::steady_clock::now()},
+            write_latency_{&MetricsRegistry::Global().GetHistogram(
+                "axy_backend_write_latency_seconds",
+                "Time from receiving audio until the backend accepted it, "
+                "including time waiting for a write slot.",
+                {{"class", std::string{ToString(priority)}},
+                 {"route", route}})},
+            first_response_latency_{&MetricsRegistry::Global().GetHistogram(
+                "axy_backend_first_response_seconds",
+                "Time from opening or taking a backend stream until its "
+                "first response.",
+                {{"class", std::string{ToString(priority)}},
+                 {"route", route}})} {
+        if (resources_.stabilization_window.count() > 0) {
+          stabilizer_ = std::make_unique<TranscriptStabilizer>(
+              resources_.timers, resources_.stabilization_window,
+              [this](const std::string& transcript) {
+                OnStable(transcript);
+              });
+        }
+      }
+
+      /// Write `out_req` once we get a write slot.
+      void ScheduleWrite() {
+        write_requested_at_ = std::chrono::steady_clock::now();
+        write_bytes_ = ByteSize(stream_->out_req);
+        memory_.Hold(write_bytes_);
+        if (resources_.backend_writes == nullptr) {
+          return DoWrite();
         }
-        stub->async()->StreamingRecognize(ctx_.get(), this);
+
+        pending_write_ = resources_.backend_writes->Acquire(
+            [this](std::optional<AdmissionController::Ticket> ticket) {
+              write_ticket_ = std::move(ticket);
+              DoWrite();
+            },
+            static_cast<std::size_t>(priority_));
       }
 
+      /// Use `stream`, which is warm if it came from the pool, once attached
+      /// to it.
+      void Use(BackendStream<BackendTypes>* stream, bool warm) {
+        stream_ = stream;
+        first_result_latency_ = &MetricsRegistry::Global().GetHistogram(
+            "axy_first_result_seconds",
+            "Time from admitting a speech stream until its first partial or "
+            "final, by whether its backend stream was warm.",
+            {{"class", std::string{ToString(priority_)}},
+             {"route", route_},
+             {"stream", warm ? "warm" : "cold"}});
+      }
+
+      typename BackendTypes::StreamingRecognizeRequest& out_req() {
+        return stream_->out_req;
+      }
+
+      /// Cancel the backend stream, e.g. once the server stream expired.
+      void TryCancel() { stream_->TryCancel(); }
+
+      /// We're done reading, see `BackendStream::Start`.
+      void RemoveHold() { stream_->RemoveHold(); }
+
+      void StartWritesDone() { stream_->StartWritesDone(); }
+
       void OnReadDone(bool ok) override {
         if (ok) {
-          if (!server_gone) {
-            ConvertResponse<BackendTypes>(in_resp, server_reactor_->resp);
-            server_reactor_->StartWrite(&server_reactor_->resp);
+          Trace(StreamTrace::Event::kBackendResponseReceived);
+          if (watch_ != nullptr) {
+            watch_->Heard(IdleReaper::Party::kBackend);
+          }
+          if (!got_response_) {
+            got_response_ = true;
+            first_response_latency_->Observe(std::chrono::steady_clock::now() -
+                                             started_at_);
+          }
+          if (!got_result_ && stream_->in_resp.results_size() > 0) {
+            got_result_ = true;
+            first_result_latency_->Observe(TimerWheel::Clock::now() -
+                                           admitted_at_);
           }
 
-          if (redis_client_ != nullptr) {
-            sdifi::events::v1alpha::Event event;
-
-            if (auto type = ConvertToEvent<BackendTypes>(
-                    server_reactor_->conversation_id_, in_resp, event)) {
-              std::string stream_key = fmt::format(
-                  "sdifi/conversation/{key}",
-                  fmt::arg("key", server_reactor_->conversation_id_));
-
-              AXY_LOG_DEBUG("Writing message to {}", stream_key);
-              std::vector<std::pair<std::string, std::string>> attrs{
-                  {":type", type.value()},
-                  {":content", event.SerializeAsString()}};
-              redis_client_->xadd(stream_key, "*", attrs.begin(), attrs.end());
-            }
+          if (recorder_ != nullptr) {
+            recorder_->AddResponse(stream_->in_resp.SerializeAsString());
           }
+          ConversationEvent tags;
+          const bool publish = Stabilize(stream_->in_resp, tags);
+          Forward(stream_->in_resp, std::move(tags), publish);
 
-          this->StartRead(&in_resp);
+          stream_->StartRead(&stream_->in_resp);
         } else {
           AXY_LOG_DEBUG("no more client reads");
 
           if (!server_gone) {
-            server_reactor_->ReleaseClient();
+            server_reactor_->ReleaseClient(channel_);
           }
         }
       }
 
       void OnWriteDone(bool ok) override {
-        if (ok && !server_gone) {
-          server_reactor_->StartRead(&server_reactor_->req);
+        const auto now = std::chrono::steady_clock::now();
+        // How long the backend takes to accept audio is our signal for how
+        // loaded it is.
+        resources_.admission->ObserveLatency(now - write_started_at_);
+        write_latency_->Observe(now - write_requested_at_);
+        write_ticket_.reset();
+        memory_.Hold(-write_bytes_);
+        if (ok) {
+          Trace(StreamTrace::Event::kBackendWriteDone);
         } else {
           AXY_LOG_DEBUG("client write went bad");
         }
+
+        if (!server_gone) {
+          server_reactor_->OnClientWriteDone(ok);
+        }
       }
 
       void OnWritesDoneDone(bool ok) override {
@@ -356,6 +1219,9 @@ SpeechServiceImpl<BackendTypes>::StreamingRecognize(
 
       void OnDone(const grpc::Status& status) override {
         AXY_LOG_INFO("client all done");
+        if (stabilizer_ != nullptr) {
+          stabilizer_->Stop();
+        }
 
         // Check for unknown here since there seems to be an upstream bug.
         if (!status.ok()) {
@@ -365,39 +1231,227 @@ SpeechServiceImpl<BackendTypes>::StreamingRecognize(
                        status.error_message(), status.error_details());
         }
 
+        if (resources_.backend_writes != nullptr) {
+          resources_.backend_writes->Cancel(pending_write_);
+        }
+
         if (!server_gone) {
-          server_reactor_->SafelyFinish(status);
+          server_reactor_->OnClientDone(status);
         }
 
+        // May delete the server reactor.
+        server_reactor_->RemoveClient(channel_);
         delete this;
       }
 
      private:
+      void Trace(StreamTrace::Event event) {
+        if (trace_ != nullptr) {
+          trace_->Record(event);
+        }
+      }
+
+      /** Let the stabilizer drop the events of results it already published
+       * as provisional finals, and tag the backend's finals that replace
+       * them in `tags`.
+       *
+       * \returns false if the event of `resp` shouldn't be published.
+       */
+      bool Stabilize(
+          const typename BackendTypes::StreamingRecognizeResponse& resp,
+          ConversationEvent& tags) {
+        if (stabilizer_ == nullptr || resp.results_size() == 0 ||
+            resp.results(0).alternatives_size() == 0) {
+          return true;
+        }
+        const auto& result = resp.results(0);
+        const auto& transcript = result.alternatives(0).transcript();
+        if (!result.is_final()) {
+          return stabilizer_->Partial(transcript);
+        }
+        // Either way it replaces the provisional final in Redis, with its
+        // own transcript, and watchers skip it.
+        tags.correction =
+            stabilizer_->Final(transcript) !=
+            TranscriptStabilizer::FinalOutcome::kNew;
+        return true;
+      }
+
+      /** Send `resp` to the client and publish its event, tagged like
+       * `tags`, if `publish`.
+       *
+       * Provisional finals are only published. The client has no way to
+       * tell them from the backend's finals, so it gets those instead, with
+       * their word offsets.
+       */
+      void Forward(
+          const typename BackendTypes::StreamingRecognizeResponse& resp,
+          ConversationEvent tags, bool publish = true) {
+        // Also called from the timer thread for provisional finals.
+        std::lock_guard<std::mutex> lg{forward_mtx_};
+        if (!tags.provisional) {
+          sdifi::speech::v1alpha::StreamingRecognizeResponse out;
+          ConvertResponse<BackendTypes>(resp, out);
+          server_reactor_->QueueResponseIfOpen(std::move(out));
+        }
+        if (!publish) {
+          return;
+        }
+
+        tags.conversation_id = conversation_id_;
+        tags.trace = trace_;
+        if (tag_channel_) {
+          tags.channel = channel_;
+        }
+        if (PublishEvent<BackendTypes>(resources_, *event_ids_, resp,
+                                       std::move(tags))) {
+          Trace(StreamTrace::Event::kEventPublished);
+        }
+      }
+
+      void OnStable(const std::string& transcript) {
+        typename BackendTypes::StreamingRecognizeResponse resp;
+        auto* result = resp.add_results();
+        result->set_is_final(true);
+        result->add_alternatives()->set_transcript(transcript);
+        Forward(resp, {.provisional = true});
+      }
+
+      void DoWrite() {
+        write_started_at_ = std::chrono::steady_clock::now();
+        if (watch_ != nullptr) {
+          watch_->Await(IdleReaper::Party::kBackend);
+        }
+        stream_->StartWrite(&stream_->out_req);
+      }
+
+      /// Outlives us, see `ServerReactor::RemoveClient`.
       ServerReactor* server_reactor_;
-      std::unique_ptr<grpc::ClientContext> ctx_;
-      sw::redis::Redis* redis_client_;
+      /// Copies of the server reactor's, which is written on other threads.
+      const std::string conversation_id_;
+      const TimerWheel::Clock::time_point admitted_at_;
+      /// Which channel of the client's audio this backend stream recognizes.
+      const std::size_t channel_;
+      /// Only events of multi-channel streams are tagged with their channel.
+      const bool tag_channel_;
+      const std::string& route_;
+      /// Deletes itself after our `OnDone`.
+      BackendStream<BackendTypes>* stream_ = nullptr;
+      const SpeechServiceResources& resources_;
+      const PriorityClass priority_;
+      const std::shared_ptr<StreamTrace> trace_;
+      /// Shared with the server reactor, may be null.
+      const std::shared_ptr<IdleReaper::Watch> watch_;
+      /// Shared by all channels, which publish to the same conversation.
+      const std::shared_ptr<StreamIdGenerator> event_ids_;
+      /// Null unless stabilization is enabled.
+      std::unique_ptr<TranscriptStabilizer> stabilizer_;
+      AccountedObject memory_{ClientReactorMemory()};
+      /// Size of `out_req` while it's being written.
+      std::int64_t write_bytes_ = 0;
+      std::mutex forward_mtx_;
+      /// Set if this stream's results go into the audio cache.
+      const std::shared_ptr<AudioResultCache::Recorder> recorder_;
+
+      const std::chrono::steady_clock::time_point started_at_;
+      bool got_response_ = false;
+      bool got_result_ = false;
+      std::chrono::steady_clock::time_point write_requested_at_;
+      std::chrono::steady_clock::time_point write_started_at_;
+      Histogram* write_latency_;
+      Histogram* first_response_latency_;
+      Histogram* first_result_latency_ = nullptr;
+
+      std::shared_ptr<AdmissionController::Pending> pending_write_;
+      std::optional<AdmissionController::Ticket> write_ticket_;
 
      public:
       std::atomic<bool> server_gone = false;
-      typename BackendTypes::StreamingRecognizeResponse in_resp;
-      typename BackendTypes::StreamingRecognizeRequest out_req;
     };
 
-    ClientReactor* client_reactor_;
-    std::atomic<bool> client_gone_ = false;
+    grpc::CallbackServerContext* context_;
+    const std::string& route_;
+    BackendChannelPool& backend_;
+    const std::vector<std::unique_ptr<typename BackendTypes::Speech::Stub>>&
+        stubs_;
+    const SpeechServiceResources& resources_;
+    const std::map<std::string, std::string>& extra_headers_;
+    /// Null unless warm streams are enabled.
+    WarmStreamPool* const warm_streams_;
+    std::optional<PriorityClass> priority_;
+    /// Interleaved channels in the client's audio, each recognized by its own
+    /// backend stream.
+    std::size_t channels_ = 1;
+    std::optional<Deinterleaver> deinterleaver_;
+    std::vector<std::string> channel_audio_;
+    /// The backend config, which a warm stream has to be opened with. Only
+    /// set if we may take one.
+    std::string profile_;
+    /// Set if we took a warm stream, which already sent the config.
+    bool warm_ = false;
+    std::shared_ptr<StreamTrace> trace_;
+    /// Set once admitted, if streams have timeouts.
+    std::shared_ptr<IdleReaper::Watch> watch_;
+    const std::shared_ptr<StreamIdGenerator> event_ids_ =
+        std::make_shared<StreamIdGenerator>();
+
+    /// Set while the client's audio could still be in the audio cache, until
+    /// then its messages are held in `backlog_`.
+    std::unique_ptr<AudioResultCache::Matcher> matcher_;
+    std::deque<sdifi::speech::v1alpha::StreamingRecognizeRequest> backlog_;
+    /// Set if the results of this stream go into the audio cache.
+    std::shared_ptr<AudioResultCache::Recorder> recorder_;
+    std::atomic<bool> client_ended_ = false;
+    /// The cached responses replayed instead of opening a backend stream.
+    std::shared_ptr<const AudioResultCache::Entry> replay_;
+    std::size_t replayed_ = 0;
+    std::mutex replay_mtx_;
+    bool replay_stopped_ = false;
+    TimerWheel::TimerId replay_timer_ = 0;
+
+    bool admission_requested_ = false;
+    std::shared_ptr<AdmissionController::Pending> pending_admission_;
+    std::optional<AdmissionController::Ticket> ticket_;
+    TimerWheel::Clock::time_point admitted_at_;
+
+    /// One per channel, empty until we've been admitted.
+    std::vector<ClientReactor*> client_reactors_;
+    /// There is no backend stream until we've been admitted.
+    std::array<std::atomic<bool>, kMaxAudioChannels> client_gone_;
+    /// Whether each client reactor is still there, under `finish_mtx_`.
+    std::array<bool, kMaxAudioChannels> client_alive_{};
+    /// Backend streams whose `OnDone` hasn't been called, under
+    /// `finish_mtx_`.
+    std::size_t clients_running_ = 0;
+    /// The server reads the next message once every backend stream accepted
+    /// its part of the last one.
+    std::atomic<std::size_t> pending_client_writes_ = 0;
+    std::atomic<bool> client_write_failed_ = false;
 
     std::mutex finish_mtx_;
     bool finished_ = false;
+    /// Set in `OnDone`, after which we're deleted with the last client
+    /// reactor.
+    bool server_done_ = false;
+
+    AccountedObject memory_{ServerReactorMemory()};
+
+    /// Responses of all backend streams, written to the client one at a
+    /// time.
+    std::mutex write_mtx_;
+    std::deque<sdifi::speech::v1alpha::StreamingRecognizeResponse>
+        write_queue_;
+    bool writing_ = false;
 
    public:
     sdifi::speech::v1alpha::StreamingRecognizeRequest req;
-    sdifi::speech::v1alpha::StreamingRecognizeResponse resp;
     std::string conversation_id_ = "<unk>";
   };
 
   // ServerReactor deletes itself once finished.
-  return new ServerReactor{context, stub_.get(), redis_client_.get(),
-                           extra_headers_};
+  return new ServerReactor{
+      reactor, context, std::move(first), name_, *backend_, stubs_,
+      resources_, extra_headers_, warm_streams_.get()};
 }
 
 }  // namespace axy
@@ -5,16 +5,31 @@
 #include <grpcpp/channel.h>
 #include <grpcpp/create_channel.h>
 #include <grpcpp/security/credentials.h>
+#include <grpcpp/server_context.h>
+#include <grpcpp/support/server_callback.h>
+#include <grpcpp/support/status.h>
 #include <sdifi/speech/v1alpha/speech.grpc.pb.h>
 #include <sdifi/speech/v1alpha/speech.pb.h>
-#include <sw/redis++/redis.h>
 #include <tiro/speech/v1alpha/speech.grpc.pb.h>
 #include <tiro/speech/v1alpha/speech.pb.h>
 
+#include <chrono>
 #include <concepts>
 #include <map>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "src/axy/admission.h"
+#include "src/axy/audio-cache.h"
+#include "src/axy/backend-pool.h"
+#include "src/axy/event-sink.h"
+#include "src/axy/idle-reaper.h"
+#include "src/axy/timer-wheel.h"
+#include "src/axy/tracing.h"
+#include "src/axy/warm-stream-pool.h"
 
 namespace axy {
 
@@ -54,30 +69,144 @@ struct GoogleSpeechTypes {
   using RecognitionConfig = google::cloud::speech::v1::RecognitionConfig;
 };
 
+/// For streams whose recognition config has no language code.
+inline constexpr std::string_view kDefaultLanguageCode = "is-IS";
+
 using SpeechService = sdifi::speech::v1alpha::SpeechService::CallbackService;
+using SpeechServerReactor = grpc::ServerBidiReactor<
+    sdifi::speech::v1alpha::StreamingRecognizeRequest,
+    sdifi::speech::v1alpha::StreamingRecognizeResponse>;
+
+/// Shared state used by all speech streams, besides the backend connection.
+struct SpeechServiceResources {
+  /// Every event produced by a stream is published to all of these.
+  std::vector<std::shared_ptr<EventSink>> event_sinks;
+  /// Limits the number of concurrent streams. Streams are admitted in the
+  /// class of their `PriorityClass`.
+  std::shared_ptr<AdmissionController> admission;
+  /// Limits the number of in-flight writes to the backend, shared between
+  /// priority classes by weight. May be null.
+  std::shared_ptr<AdmissionController> backend_writes;
+  /// Records latency timelines of sampled streams. May be null.
+  std::shared_ptr<Tracer> tracer;
+  /// Closes streams that idle or run for too long. May be null.
+  std::shared_ptr<IdleReaper> reaper;
+  /// Coarse timers shared by all streams. May be null if nothing needs them.
+  std::shared_ptr<TimerWheel> timers;
+  /// Publish an interim transcript as a provisional final once it has stayed
+  /// the same for this long (see `TranscriptStabilizer`). 0 disables it,
+  /// otherwise `timers` is required.
+  std::chrono::milliseconds stabilization_window{0};
+  /// Replays the results of single-channel audio it has seen before instead
+  /// of opening a backend stream. May be null, otherwise `timers` is
+  /// required.
+  std::shared_ptr<AudioResultCache> audio_cache;
+  /// Backend streams opened ahead of single-channel streams, per backend.
+  /// Disabled if `max_per_profile` is 0, otherwise `timers` is required.
+  WarmStreamPool::Options warm_streams;
+};
+
+/** A speech stream once it has been routed to a backend.
+ *
+ * The stream's reactor stays with the router, which passes its callbacks on
+ * to the handler.
+ */
+class SpeechStreamHandler {
+ public:
+  explicit SpeechStreamHandler(SpeechServerReactor* reactor)
+      : reactor_{reactor} {}
+  virtual ~SpeechStreamHandler() = default;
+
+  virtual void OnReadDone(bool ok) = 0;
+  virtual void OnWriteDone(bool ok) = 0;
+  /// The handler deletes itself.
+  virtual void OnDone() = 0;
+  virtual void OnCancel() = 0;
+
+ protected:
+  void StartRead(sdifi::speech::v1alpha::StreamingRecognizeRequest* req) {
+    reactor_->StartRead(req);
+  }
+  void StartWrite(
+      const sdifi::speech::v1alpha::StreamingRecognizeResponse* resp) {
+    reactor_->StartWrite(resp);
+  }
+  void Finish(grpc::Status status) { reactor_->Finish(std::move(status)); }
+
+ private:
+  SpeechServerReactor* reactor_;
+};
+
+/// A backend speech streams can be routed to, whatever its API.
+class SpeechBackend {
+ public:
+  virtual ~SpeechBackend() = default;
+
+  /** Take over the stream of `reactor`, once its first message has been read.
+   *
+   * \param first The first message, or nothing useful if `ok` is false.
+   * \returns The handler to pass the reactor's callbacks to, starting with
+   *          `OnReadDone(ok)` for `first`.
+   */
+  virtual SpeechStreamHandler* Open(
+      SpeechServerReactor* reactor, grpc::CallbackServerContext* context,
+      sdifi::speech::v1alpha::StreamingRecognizeRequest first) = 0;
+
+  /// The route this backend serves, which labels its metrics.
+  virtual const std::string& name() const = 0;
+};
 
 template <GoogleApiCompatibleTypes BackendTypes>
-class SpeechServiceImpl final
-    : public sdifi::speech::v1alpha::SpeechService::CallbackService {
+class SpeechBackendImpl final : public SpeechBackend {
  public:
-  explicit SpeechServiceImpl(
-      const std::shared_ptr<grpc::Channel>& speech_server_channel,
-      std::shared_ptr<sw::redis::Redis> redis_client,
+  /// Each stream to the backend goes over the least busy channel in
+  /// `backend`.
+  explicit SpeechBackendImpl(
+      std::string name, std::shared_ptr<BackendChannelPool> backend,
+      SpeechServiceResources resources,
       std::map<std::string, std::string> extra_headers = {})
-      : stub_{BackendTypes::Speech::NewStub(speech_server_channel)},
-        redis_client_{std::move(redis_client)},
-        extra_headers_{std::move(extra_headers)} {}
-  // TODO(rkjaran): Make redis optional? Or add a generic callback interface for
-  //   results?
+      : name_{std::move(name)},
+        backend_{std::move(backend)},
+        resources_{std::move(resources)},
+        extra_headers_{std::move(extra_headers)} {
+    for (std::size_t i = 0; i < backend_->size(); ++i) {
+      stubs_.push_back(BackendTypes::Speech::NewStub(backend_->channel(i)));
+    }
+    if (resources_.warm_streams.max_per_profile > 0) {
+      warm_streams_ = std::make_shared<WarmStreamPool>(
+          resources_.warm_streams, resources_.timers,
+          [this](const std::string& profile) {
+            return OpenWarmStream(profile);
+          },
+          name_);
+    }
+  }
+
+  /// Warm streams keep the backend channels alive, but stop using us.
+  ~SpeechBackendImpl() override {
+    if (warm_streams_ != nullptr) {
+      warm_streams_->Shutdown();
+    }
+  }
 
-  grpc::ServerBidiReactor<sdifi::speech::v1alpha::StreamingRecognizeRequest,
-                          sdifi::speech::v1alpha::StreamingRecognizeResponse>*
-  StreamingRecognize(grpc::CallbackServerContext* context) override;
+  SpeechStreamHandler* Open(
+      SpeechServerReactor* reactor, grpc::CallbackServerContext* context,
+      sdifi::speech::v1alpha::StreamingRecognizeRequest first) override;
+
+  const std::string& name() const override { return name_; }
 
  private:
-  std::unique_ptr<typename BackendTypes::Speech::Stub> stub_;
-  std::shared_ptr<sw::redis::Redis> redis_client_;
+  /// A warm stream sending `profile`, the serialized backend config.
+  WarmStreamPool::Stream* OpenWarmStream(const std::string& profile);
+
+  const std::string name_;
+  const std::shared_ptr<BackendChannelPool> backend_;
+  /// One for each channel in `backend_`.
+  std::vector<std::unique_ptr<typename BackendTypes::Speech::Stub>> stubs_;
+  const SpeechServiceResources resources_;
   const std::map<std::string, std::string> extra_headers_;
+  /// Null unless enabled. Shared with its streams, which may outlive us.
+  std::shared_ptr<WarmStreamPool> warm_streams_;
 };
 
 }  // namespace axy
@@ -0,0 +1,129 @@
+#include "src/axy/speech-websocket.h"
+
+#include <fmt/core.h>
+#include <google/protobuf/util/json_util.h>
+#include <grpcpp/client_context.h>
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "src/axy/audio.h"
+#include "src/axy/logging.h"
+#include "src/axy/metrics.h"
+#include "src/axy/priority.h"
+#include "src/axy/websocket.h"
+
+namespace axy {
+
+namespace {
+
+using sdifi::speech::v1alpha::StreamingRecognizeRequest;
+using sdifi::speech::v1alpha::StreamingRecognizeResponse;
+
+/// Private use close codes, 4000 plus the gRPC status code.
+constexpr std::uint16_t kGrpcStatusCloseCodeBase = 4000;
+
+Gauge& ActiveSockets() {
+  static Gauge& gauge = MetricsRegistry::Global().GetGauge(
+      "axy_websocket_streams", "Speech streams over WebSocket in progress.");
+  return gauge;
+}
+
+bool ParseJsonRequest(const std::string& json, StreamingRecognizeRequest* req) {
+  return google::protobuf::util::JsonStringToMessage(json, req).ok();
+}
+
+}  // namespace
+
+SpeechWebSocketBridge::SpeechWebSocketBridge(
+    const std::shared_ptr<grpc::Channel>& channel)
+    : stub_{sdifi::speech::v1alpha::SpeechService::NewStub(channel)} {}
+
+void SpeechWebSocketBridge::Serve(const HttpRequest& http_req, int fd) {
+  auto socket = WebSocket::Accept(fd, http_req);
+  if (socket == nullptr) {
+    return;
+  }
+
+  auto first = socket->Read();
+  if (!first) {
+    return;
+  }
+  StreamingRecognizeRequest config_req;
+  if (first->opcode != WebSocket::Opcode::kText ||
+      !ParseJsonRequest(first->payload, &config_req) ||
+      !config_req.has_streaming_config()) {
+    socket->Close(WebSocket::kInvalidPayload,
+                  "First message has to be a JSON StreamingRecognizeRequest "
+                  "with streaming_config");
+    return;
+  }
+  const auto conversation_id = config_req.streaming_config().conversation();
+
+  ActiveSockets().Add(1);
+  grpc::ClientContext context;
+  if (const auto priority = http_req.QueryParam("priority")) {
+    context.AddMetadata(std::string{kPriorityMetadataKey}, *priority);
+  }
+  if (const auto channels = http_req.QueryParam("channels")) {
+    context.AddMetadata(std::string{kAudioChannelsMetadataKey}, *channels);
+  }
+  auto stream = stub_->StreamingRecognize(&context);
+
+  std::jthread responses{[&]() {
+    StreamingRecognizeResponse res;
+    std::string json;
+    while (stream->Read(&res)) {
+      json.clear();
+      google::protobuf::util::MessageToJsonString(res, &json);
+      if (!socket->Send(WebSocket::Opcode::kText, json)) {
+        AXY_CONV_LOG_DEBUG(conversation_id, "{}: WebSocket gone.",
+                           conversation_id);
+        context.TryCancel();
+        return;
+      }
+    }
+  }};
+
+  bool ok = stream->Write(config_req);
+  while (ok) {
+    auto message = socket->Read();
+    if (!message) {
+      // The client closed the socket before ending the audio.
+      context.TryCancel();
+      break;
+    }
+
+    StreamingRecognizeRequest req;
+    if (message->opcode == WebSocket::Opcode::kBinary) {
+      if (message->payload.empty()) {
+        break;
+      }
+      req.set_audio_content(std::move(message->payload));
+    } else if (!ParseJsonRequest(message->payload, &req)) {
+      socket->Close(WebSocket::kInvalidPayload,
+                    "Text messages have to be JSON StreamingRecognizeRequests");
+      context.TryCancel();
+      break;
+    }
+    ok = stream->Write(req);
+  }
+  stream->WritesDone();
+  responses.join();
+
+  const auto status = stream->Finish();
+  if (status.ok()) {
+    socket->Close(WebSocket::kNormalClosure);
+  } else {
+    AXY_CONV_LOG_DEBUG(conversation_id, "{}: WebSocket stream failed: {}",
+                       conversation_id, status.error_message());
+    socket->Close(static_cast<std::uint16_t>(kGrpcStatusCloseCodeBase +
+                                             status.error_code()),
+                  status.error_message());
+  }
+  ActiveSockets().Add(-1);
+}
+
+}  // namespace axy
@@ -0,0 +1,50 @@
+#ifndef AXY_SRC_AXY_SPEECH_WEBSOCKET_H_
+#define AXY_SRC_AXY_SPEECH_WEBSOCKET_H_
+
+#include <grpcpp/channel.h>
+#include <sdifi/speech/v1alpha/speech.grpc.pb.h>
+
+#include <memory>
+#include <string_view>
+
+#include "src/axy/http-server.h"
+
+namespace axy {
+
+/** Serves `SpeechService.StreamingRecognize` to browsers over WebSocket.
+ *
+ * Each WebSocket becomes one `StreamingRecognize` call on `channel`, which is
+ * an in-process channel to our own gRPC server. So WebSocket streams get the
+ * same admission, backend handling and events as gRPC streams.
+ *
+ * The protocol on the socket:
+ *
+ * - The first message is a text message with the JSON encoding of a
+ *   `StreamingRecognizeRequest` with `streaming_config`.
+ * - Binary messages are raw audio, sent as `audio_content`. Text messages
+ *   after the first are JSON `StreamingRecognizeRequest`s.
+ * - An empty binary message ends the audio. Closing the socket cancels the
+ *   stream.
+ * - Responses are sent as JSON text messages. When the call is done the
+ *   server closes the socket with code 1000 on success, and 4000 plus the
+ *   gRPC status code with the status message as reason otherwise.
+ *
+ * The priority class can be picked with the `priority` query parameter, and
+ * multi-channel audio announced with `channels`.
+ */
+class SpeechWebSocketBridge {
+ public:
+  static constexpr std::string_view kPath = "/v1alpha/speech:stream";
+
+  explicit SpeechWebSocketBridge(const std::shared_ptr<grpc::Channel>& channel);
+
+  /// An `HttpServer::UpgradeHandler`, blocks until the stream is done.
+  void Serve(const HttpRequest& req, int fd);
+
+ private:
+  std::unique_ptr<sdifi::speech::v1alpha::SpeechService::Stub> stub_;
+};
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_SPEECH_WEBSOCKET_H_
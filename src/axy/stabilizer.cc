@@ -0,0 +1,104 @@
+#include "src/axy/stabilizer.h"
+
+#include <utility>
+
+namespace axy {
+
+namespace {
+
+Counter& ProvisionalFinals(const std::string& outcome) {
+  return MetricsRegistry::Global().GetCounter(
+      "axy_provisional_finals_total",
+      "Provisional finals by whether the backend's final had the same "
+      "transcript.",
+      {{"outcome", outcome}});
+}
+
+}  // namespace
+
+TranscriptStabilizer::TranscriptStabilizer(std::shared_ptr<TimerWheel> timers,
+                                           std::chrono::milliseconds window,
+                                           StableCallback on_stable)
+    : timers_{std::move(timers)},
+      window_{window},
+      on_stable_{std::move(on_stable)},
+      lead_{&MetricsRegistry::Global().GetHistogram(
+          "axy_provisional_final_lead_seconds",
+          "How much earlier than the backend's final a confirmed "
+          "provisional final was sent.")},
+      confirmed_{&ProvisionalFinals("confirmed")},
+      corrected_{&ProvisionalFinals("corrected")} {}
+
+TranscriptStabilizer::~TranscriptStabilizer() { Stop(); }
+
+bool TranscriptStabilizer::Partial(const std::string& transcript) {
+  TimerWheel::TimerId stale_timer = 0;
+  {
+    std::lock_guard<std::mutex> lock{mtx_};
+    if (stopped_ || transcript == partial_) {
+      return !provisional_ || transcript != *provisional_;
+    }
+    partial_ = transcript;
+    const auto generation = ++generation_;
+    if (provisional_) {
+      // Only one provisional final per utterance, the backend's final
+      // settles anything that came after it.
+      return true;
+    }
+    stale_timer = std::exchange(
+        timer_, timers_->Schedule(window_, [this, generation] {
+          OnTimer(generation);
+        }));
+  }
+  // Outside the lock, since this waits for the timer if it's running.
+  timers_->Cancel(stale_timer);
+  return true;
+}
+
+TranscriptStabilizer::FinalOutcome TranscriptStabilizer::Final(
+    const std::string& transcript) {
+  std::lock_guard<std::mutex> lock{mtx_};
+  ++generation_;
+  partial_.clear();
+  const auto provisional = std::exchange(provisional_, std::nullopt);
+  if (!provisional) {
+    return FinalOutcome::kNew;
+  }
+  if (transcript == *provisional) {
+    confirmed_->Increment();
+    lead_->Observe(Clock::now() - provisional_at_);
+    return FinalOutcome::kConfirmed;
+  }
+  corrected_->Increment();
+  return FinalOutcome::kCorrected;
+}
+
+void TranscriptStabilizer::Stop() {
+  TimerWheel::TimerId timer;
+  {
+    std::lock_guard<std::mutex> lock{mtx_};
+    if (stopped_) {
+      return;
+    }
+    stopped_ = true;
+    timer = timer_;
+  }
+  timers_->Cancel(timer);
+}
+
+void TranscriptStabilizer::OnTimer(std::uint64_t generation) {
+  std::string transcript;
+  {
+    std::lock_guard<std::mutex> lock{mtx_};
+    if (stopped_ || generation != generation_ || provisional_ ||
+        partial_.empty()) {
+      return;
+    }
+    provisional_ = partial_;
+    provisional_at_ = Clock::now();
+    transcript = partial_;
+  }
+  on_stable_(transcript);
+}
+
+}  // namespace axy
@@ -0,0 +1,90 @@
+#ifndef AXY_SRC_AXY_STABILIZER_H_
+#define AXY_SRC_AXY_STABILIZER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include "src/axy/metrics.h"
+#include "src/axy/timer-wheel.h"
+
+namespace axy {
+
+/** Treats an interim transcript as final once it has stopped changing.
+ *
+ * Backends only mark a result final after their endpointer is sure the
+ * utterance is over, which is often well after the transcript settled. When
+ * an interim transcript stays the same for `window`, `on_stable` is called
+ * with it on the timer thread, at most once per utterance.
+ *
+ * The backend's own final is reconciled with it: it either confirms the
+ * provisional one, if it's the same transcript, or corrects it. How far ahead
+ * of the backend confirmed provisional finals were is exported as
+ * `axy_provisional_final_lead_seconds`.
+ *
+ * `Partial()`, `Final()` and `Stop()` must not be called concurrently, e.g.
+ * only from a reactor's callbacks.
+ */
+class TranscriptStabilizer {
+ public:
+  using StableCallback = std::function<void(const std::string& transcript)>;
+
+  enum class FinalOutcome {
+    /// There was no provisional final.
+    kNew,
+    /// Same as the provisional final.
+    kConfirmed,
+    /// Differs from the provisional final.
+    kCorrected,
+  };
+
+  TranscriptStabilizer(std::shared_ptr<TimerWheel> timers,
+                       std::chrono::milliseconds window,
+                       StableCallback on_stable);
+  ~TranscriptStabilizer();
+
+  TranscriptStabilizer(const TranscriptStabilizer&) = delete;
+  TranscriptStabilizer& operator=(const TranscriptStabilizer&) = delete;
+
+  /// An interim result. \returns false if it should be dropped, because it
+  /// repeats the provisional final.
+  bool Partial(const std::string& transcript);
+
+  /// The backend's final result, which ends the utterance.
+  FinalOutcome Final(const std::string& transcript);
+
+  /// `on_stable` is neither running nor will it run once this returns.
+  void Stop();
+
+ private:
+  using Clock = TimerWheel::Clock;
+
+  void OnTimer(std::uint64_t generation);
+
+  const std::shared_ptr<TimerWheel> timers_;
+  const std::chrono::milliseconds window_;
+  const StableCallback on_stable_;
+
+  std::mutex mtx_;
+  bool stopped_ = false;
+  std::string partial_;
+  /// Bumped on every change to `partial_`, so a timer for an older partial
+  /// does nothing.
+  std::uint64_t generation_ = 0;
+  TimerWheel::TimerId timer_ = 0;
+  /// The provisional final of the current utterance, if we sent one.
+  std::optional<std::string> provisional_;
+  Clock::time_point provisional_at_;
+
+  Histogram* lead_;
+  Counter* confirmed_;
+  Counter* corrected_;
+};
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_STABILIZER_H_
@@ -0,0 +1,223 @@
+#include "src/axy/supervisor.h"
+
+#include <fmt/chrono.h>
+#include <fmt/core.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <charconv>
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "src/axy/logging.h"
+#include "src/axy/threading.h"
+
+extern char** environ;
+
+namespace axy {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr const char* kWorkerIndexVariable = "AXY_WORKER_INDEX";
+
+struct Worker {
+  std::size_t index;
+  Clock::time_point started_at;
+};
+
+pid_t SpawnWorker(char* argv[], std::size_t index) {
+  std::vector<std::string> env_strings;
+  for (char** var = environ; *var != nullptr; ++var) {
+    if (!std::string_view{*var}.starts_with(
+            fmt::format("{}=", kWorkerIndexVariable))) {
+      env_strings.emplace_back(*var);
+    }
+  }
+  env_strings.push_back(fmt::format("{}={}", kWorkerIndexVariable, index));
+  std::vector<char*> env;
+  for (auto& var : env_strings) {
+    env.push_back(var.data());
+  }
+  env.push_back(nullptr);
+
+  // The supervisor blocks the signals it waits for, workers get them back.
+  posix_spawnattr_t attr;
+  ::posix_spawnattr_init(&attr);
+  sigset_t signals;
+  ::sigemptyset(&signals);
+  ::posix_spawnattr_setsigmask(&attr, &signals);
+  ::posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+  pid_t pid = -1;
+  const int err =
+      ::posix_spawn(&pid, "/proc/self/exe", nullptr, &attr, argv, env.data());
+  ::posix_spawnattr_destroy(&attr);
+  if (err != 0) {
+    throw std::system_error{err, std::generic_category(),
+                            fmt::format("could not start worker {}", index)};
+  }
+  AXY_LOG_INFO("Started worker {} with PID {}.", index, pid);
+  return pid;
+}
+
+std::string DescribeExit(int status) {
+  if (WIFSIGNALED(status)) {
+    return fmt::format("killed by signal {}", WTERMSIG(status));
+  }
+  return fmt::format("exited with status {}", WEXITSTATUS(status));
+}
+
+/// `address` with its port increased by `offset`.
+std::string WithPortOffset(const std::string& address, std::size_t offset) {
+  const auto colon = address.rfind(':');
+  int port = 0;
+  if (colon == std::string::npos ||
+      std::from_chars(address.data() + colon + 1,
+                      address.data() + address.size(), port)
+              .ec != std::errc{}) {
+    throw std::invalid_argument{
+        fmt::format("address '{}' is missing a port", address)};
+  }
+  return fmt::format("{}:{}", address.substr(0, colon), port + offset);
+}
+
+}  // namespace
+
+int RunSupervisor(char* argv[], const SupervisorOptions& opts) {
+  sigset_t signals;
+  ::sigemptyset(&signals);
+  ::sigaddset(&signals, SIGINT);
+  ::sigaddset(&signals, SIGTERM);
+  ::sigaddset(&signals, SIGCHLD);
+  ::pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  std::map<pid_t, Worker> workers;
+  for (std::size_t i = 0; i < opts.workers; ++i) {
+    workers[SpawnWorker(argv, i)] = {.index = i, .started_at = Clock::now()};
+  }
+
+  bool stopping = false;
+  int exit_status = EXIT_SUCCESS;
+  const auto stop_all = [&](int signal) {
+    stopping = true;
+    for (const auto& [pid, worker] : workers) {
+      ::kill(pid, signal);
+    }
+  };
+
+  while (!workers.empty()) {
+    int signal = 0;
+    ::sigwait(&signals, &signal);
+    if (signal == SIGINT || signal == SIGTERM) {
+      AXY_LOG_INFO("Stopping {} workers.", workers.size());
+      stop_all(signal);
+      continue;
+    }
+
+    int status = 0;
+    pid_t pid;
+    while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0) {
+      const auto it = workers.find(pid);
+      if (it == workers.end()) {
+        continue;
+      }
+      const auto worker = it->second;
+      workers.erase(it);
+
+      const bool clean = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+      if (stopping) {
+        AXY_LOG_INFO("Worker {} {}.", worker.index, DescribeExit(status));
+        if (!clean) {
+          exit_status = EXIT_FAILURE;
+        }
+      } else if (Clock::now() - worker.started_at < opts.min_uptime) {
+        AXY_LOG_ERROR("Worker {} {} right after starting, stopping all.",
+                      worker.index, DescribeExit(status));
+        exit_status = EXIT_FAILURE;
+        stop_all(SIGTERM);
+      } else {
+        AXY_LOG_ERROR("Worker {} {}, restarting it in {}.", worker.index,
+                      DescribeExit(status), opts.restart_delay);
+        std::this_thread::sleep_for(opts.restart_delay);
+        workers[SpawnWorker(argv, worker.index)] = {
+            .index = worker.index, .started_at = Clock::now()};
+      }
+    }
+  }
+
+  AXY_LOG_INFO("All workers stopped.");
+  return exit_status;
+}
+
+std::optional<std::size_t> WorkerIndex() {
+  const char* value = std::getenv(kWorkerIndexVariable);
+  if (value == nullptr) {
+    return std::nullopt;
+  }
+  std::size_t index = 0;
+  const std::string_view str{value};
+  if (std::from_chars(str.data(), str.data() + str.size(), index).ec !=
+      std::errc{}) {
+    return std::nullopt;
+  }
+  return index;
+}
+
+Server::Options ConfigureWorker(std::size_t index, bool numa_pin,
+                                Server::Options opts) {
+  // Don't outlive the supervisor, e.g. if it gets SIGKILL.
+  ::prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+  opts.reuse_port = true;
+  if (!opts.admin_address.empty()) {
+    opts.admin_address = WithPortOffset(opts.admin_address, index);
+  }
+  if (!opts.unix_socket_path.empty()) {
+    opts.unix_socket_path = fmt::format("{}.{}", opts.unix_socket_path, index);
+  }
+
+  if (numa_pin) {
+    const auto nodes = NumaNodes();
+    if (nodes.empty()) {
+      AXY_LOG_WARN("Worker {}: no NUMA topology found, not pinning.", index);
+    } else {
+      const auto& node = nodes[index % nodes.size()];
+      // Everything the worker starts from here inherits the node's CPUs,
+      // not just the gRPC and Redis threads, unless those are given.
+      if (opts.grpc_cpus.empty() && opts.redis_cpus.empty()) {
+        try {
+          PinCurrentThread(node.cpus);
+        } catch (const std::system_error& e) {
+          AXY_LOG_WARN("Worker {}: {}", index, e.what());
+        }
+      }
+      try {
+        PreferMemoryNode(node.id);
+      } catch (const std::system_error& e) {
+        AXY_LOG_WARN("Worker {}: {}", index, e.what());
+      }
+      if (opts.grpc_cpus.empty()) {
+        opts.grpc_cpus = node.cpus;
+      }
+      if (opts.redis_cpus.empty()) {
+        opts.redis_cpus = node.cpus;
+      }
+      AXY_LOG_INFO("Worker {} on NUMA node {} with CPUs {}.", index, node.id,
+                   node.cpus.ToString());
+    }
+  }
+  return opts;
+}
+
+}  // namespace axy
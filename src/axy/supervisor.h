@@ -0,0 +1,49 @@
+#ifndef AXY_SRC_AXY_SUPERVISOR_H_
+#define AXY_SRC_AXY_SUPERVISOR_H_
+
+#include <chrono>
+#include <cstddef>
+#include <optional>
+
+#include "src/axy/server.h"
+
+namespace axy {
+
+struct SupervisorOptions {
+  std::size_t workers = 1;
+  /// Workers that exit on their own are restarted after this delay, unless
+  /// they exited within `min_uptime` of starting, in which case everything is
+  /// shut down since restarting probably won't help.
+  std::chrono::seconds restart_delay{1};
+  std::chrono::seconds min_uptime{10};
+};
+
+/** Run `opts.workers` copies of this executable with the same arguments and
+ * wait for them to exit.
+ *
+ * Workers are started with fork and exec, so they don't inherit any gRPC or
+ * logging threads, and learn their index from `WorkerIndex()`. SIGINT and
+ * SIGTERM are forwarded to every worker, which then shut down gracefully.
+ *
+ * \returns The exit status for the supervisor.
+ * \throws std::system_error if a worker can't be started.
+ */
+int RunSupervisor(char* argv[], const SupervisorOptions& opts);
+
+/// Index of this process if it was started by `RunSupervisor`.
+std::optional<std::size_t> WorkerIndex();
+
+/** Prepare this process to run as worker `index` and adjust `opts` for it.
+ *
+ * Workers share the gRPC and WebSocket addresses with `SO_REUSEPORT`, while
+ * the admin server port is offset by `index` and the Unix socket path gets
+ * `.index` appended. With `numa_pin`, workers are spread round robin over
+ * NUMA nodes and pinned to the CPUs and memory of theirs, unless CPUs were
+ * given explicitly.
+ */
+Server::Options ConfigureWorker(std::size_t index, bool numa_pin,
+                                Server::Options opts);
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_SUPERVISOR_H_
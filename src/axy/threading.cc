@@ -0,0 +1,171 @@
+#include "src/axy/threading.h"
+
+#include <fmt/core.h>
+#include <fmt/ranges.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "src/axy/logging.h"
+
+namespace axy {
+
+namespace {
+
+int ParseCpu(std::string_view str, std::string_view spec) {
+  int cpu = -1;
+  const auto [ptr, ec] = std::from_chars(str.begin(), str.end(), cpu);
+  if (ec != std::errc{} || ptr != str.end() || cpu < 0 || cpu >= CPU_SETSIZE) {
+    throw std::invalid_argument{
+        fmt::format("invalid CPU '{}' in CPU list '{}'", str, spec)};
+  }
+  return cpu;
+}
+
+}  // namespace
+
+CpuSet CpuSet::Parse(std::string_view spec) {
+  CpuSet set;
+  while (!spec.empty()) {
+    const auto comma = spec.find(',');
+    const auto range = spec.substr(0, comma);
+    spec = comma == std::string_view::npos ? "" : spec.substr(comma + 1);
+    if (range.empty()) {
+      continue;
+    }
+
+    const auto dash = range.find('-');
+    const int first = ParseCpu(range.substr(0, dash), range);
+    const int last = dash == std::string_view::npos
+                         ? first
+                         : ParseCpu(range.substr(dash + 1), range);
+    if (last < first) {
+      throw std::invalid_argument{
+          fmt::format("invalid CPU range '{}'", range)};
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      set.cpus_.push_back(cpu);
+    }
+  }
+
+  std::sort(set.cpus_.begin(), set.cpus_.end());
+  set.cpus_.erase(std::unique(set.cpus_.begin(), set.cpus_.end()),
+                  set.cpus_.end());
+  return set;
+}
+
+std::string CpuSet::ToString() const {
+  if (cpus_.empty()) {
+    return "any";
+  }
+
+  std::vector<std::string> ranges;
+  for (std::size_t i = 0; i < cpus_.size();) {
+    std::size_t j = i;
+    while (j + 1 < cpus_.size() && cpus_[j + 1] == cpus_[j] + 1) {
+      ++j;
+    }
+    ranges.push_back(i == j ? fmt::format("{}", cpus_[i])
+                            : fmt::format("{}-{}", cpus_[i], cpus_[j]));
+    i = j + 1;
+  }
+  return fmt::format("{}", fmt::join(ranges, ","));
+}
+
+void PinCurrentThread(const CpuSet& cpus) {
+  if (cpus.empty()) {
+    return;
+  }
+
+  cpu_set_t native;
+  CPU_ZERO(&native);
+  for (int cpu : cpus.cpus()) {
+    CPU_SET(cpu, &native);
+  }
+
+  if (int err = pthread_setaffinity_np(pthread_self(), sizeof(native), &native);
+      err != 0) {
+    throw std::system_error{err, std::generic_category(),
+                            fmt::format("could not pin thread to CPUs {}",
+                                        cpus.ToString())};
+  }
+}
+
+CpuSet CurrentThreadCpus() {
+  cpu_set_t native;
+  CPU_ZERO(&native);
+  if (int err = pthread_getaffinity_np(pthread_self(), sizeof(native), &native);
+      err != 0) {
+    throw std::system_error{err, std::generic_category(),
+                            "could not get the CPUs of this thread"};
+  }
+  std::string spec;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &native)) {
+      spec += fmt::format("{},", cpu);
+    }
+  }
+  return CpuSet::Parse(spec);
+}
+
+ScopedThreadPin::ScopedThreadPin(const CpuSet& cpus) {
+  if (!cpus.empty()) {
+    previous_ = CurrentThreadCpus();
+    PinCurrentThread(cpus);
+  }
+}
+
+ScopedThreadPin::~ScopedThreadPin() {
+  try {
+    PinCurrentThread(previous_);
+  } catch (const std::system_error& e) {
+    AXY_LOG_WARN("Could not restore the thread's CPU affinity: {}", e.what());
+  }
+}
+
+std::vector<NumaNode> NumaNodes() {
+  const auto read_list = [](const std::string& path) {
+    std::ifstream file{path};
+    std::string spec;
+    std::getline(file, spec);
+    // Node and CPU lists have the same format.
+    return CpuSet::Parse(spec);
+  };
+
+  std::vector<NumaNode> nodes;
+  const auto ids = read_list("/sys/devices/system/node/has_cpu");
+  for (int id : ids.cpus()) {
+    nodes.push_back(
+        {.id = id,
+         .cpus = read_list(fmt::format(
+             "/sys/devices/system/node/node{}/cpulist", id))});
+  }
+  return nodes;
+}
+
+void PreferMemoryNode(int node) {
+  constexpr int kBitsPerMask = 8 * sizeof(unsigned long);
+  std::vector<unsigned long> mask(node / kBitsPerMask + 1);
+  mask[node / kBitsPerMask] |= 1UL << (node % kBitsPerMask);
+  // glibc has no wrapper and libnuma isn't worth a dependency for this.
+  if (::syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask.data(),
+                mask.size() * kBitsPerMask + 1) != 0) {
+    throw std::system_error{
+        errno, std::generic_category(),
+        fmt::format("could not prefer memory on NUMA node {}", node)};
+  }
+}
+
+}  // namespace axy
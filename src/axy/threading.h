@@ -0,0 +1,76 @@
+#ifndef AXY_SRC_AXY_THREADING_H_
+#define AXY_SRC_AXY_THREADING_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace axy {
+
+/// A set of CPUs a thread may run on. An empty set means "any CPU".
+class CpuSet {
+ public:
+  CpuSet() = default;
+
+  /** Parse a CPU list in the same format as `taskset -c`, e.g. "0-3,8,10-11".
+   *
+   * \throws std::invalid_argument if `spec` is malformed.
+   */
+  static CpuSet Parse(std::string_view spec);
+
+  bool empty() const { return cpus_.empty(); }
+  std::size_t size() const { return cpus_.size(); }
+  const std::vector<int>& cpus() const { return cpus_; }
+
+  /// Format as a CPU list, or "any" if empty.
+  std::string ToString() const;
+
+ private:
+  std::vector<int> cpus_;
+};
+
+/** Restrict the calling thread to `cpus`. Threads created afterwards from the
+ * calling thread inherit the affinity. Does nothing if `cpus` is empty.
+ *
+ * \throws std::system_error if the affinity couldn't be set.
+ */
+void PinCurrentThread(const CpuSet& cpus);
+
+/// The CPUs the calling thread may run on.
+CpuSet CurrentThreadCpus();
+
+/** Pins the calling thread to `cpus` for its lifetime and restores the
+ * previous affinity afterwards, so only the threads created meanwhile keep
+ * `cpus`. Does nothing if `cpus` is empty.
+ */
+class ScopedThreadPin {
+ public:
+  explicit ScopedThreadPin(const CpuSet& cpus);
+  ~ScopedThreadPin();
+
+  ScopedThreadPin(const ScopedThreadPin&) = delete;
+  ScopedThreadPin& operator=(const ScopedThreadPin&) = delete;
+
+ private:
+  CpuSet previous_;
+};
+
+struct NumaNode {
+  int id;
+  CpuSet cpus;
+};
+
+/// NUMA nodes that have CPUs. Empty if the kernel doesn't expose the
+/// topology.
+std::vector<NumaNode> NumaNodes();
+
+/** Prefer allocating memory for the calling process on NUMA node `node`,
+ * falling back to other nodes when it's full.
+ *
+ * \throws std::system_error if the memory policy couldn't be set.
+ */
+void PreferMemoryNode(int node);
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_THREADING_H_
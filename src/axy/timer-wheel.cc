@@ -0,0 +1,101 @@
+#include "src/axy/timer-wheel.h"
+
+#include <algorithm>
+#include <exception>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+#include "src/axy/logging.h"
+
+namespace axy {
+
+TimerWheel::TimerWheel(Clock::duration tick, std::size_t slots)
+    : tick_{tick}, slots_(slots) {
+  if (tick <= Clock::duration::zero() || slots == 0) {
+    throw std::invalid_argument{
+        "A timer wheel needs a positive tick and at least one slot."};
+  }
+  thread_ = std::jthread{[this](std::stop_token stop) { Run(stop); }};
+}
+
+TimerWheel::~TimerWheel() {
+  thread_.request_stop();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+TimerWheel::TimerId TimerWheel::Schedule(Clock::duration delay,
+                                         Callback callback) {
+  // Round up, so timers never fire early.
+  const auto ticks = static_cast<std::uint64_t>(
+      std::max<Clock::rep>((delay + tick_ - Clock::duration{1}) / tick_, 1));
+
+  std::lock_guard<std::mutex> lock{mtx_};
+  const auto id = next_id_++;
+  const auto due_tick = current_tick_ + ticks;
+  auto& timers = slots_[due_tick % slots_.size()];
+  timers.push_back(
+      {.id = id, .due_tick = due_tick, .callback = std::move(callback)});
+  timers_.emplace(id, std::make_pair(&timers, std::prev(timers.end())));
+  return id;
+}
+
+bool TimerWheel::Cancel(TimerId id) {
+  if (id == 0) {
+    return false;
+  }
+  std::unique_lock<std::mutex> lock{mtx_};
+  if (const auto it = timers_.find(id); it != timers_.end()) {
+    const auto [slot, timer] = it->second;
+    slot->erase(timer);
+    timers_.erase(it);
+    return true;
+  }
+  if (std::this_thread::get_id() != thread_.get_id()) {
+    callback_done_.wait(lock, [this, id] { return running_ != id; });
+  }
+  return false;
+}
+
+void TimerWheel::Run(std::stop_token stop) {
+  auto next_tick = Clock::now() + tick_;
+  std::unique_lock<std::mutex> lock{mtx_};
+  while (!stop.stop_requested()) {
+    lock.unlock();
+    std::this_thread::sleep_until(next_tick);
+    next_tick += tick_;
+    lock.lock();
+
+    ++current_tick_;
+    auto& slot = slots_[current_tick_ % slots_.size()];
+    // Take out the due timers in one pass. They stay cancellable until their
+    // callbacks run, since the lock is released for each one.
+    for (auto it = slot.begin(); it != slot.end();) {
+      const auto timer = it++;
+      if (timer->due_tick <= current_tick_) {
+        due_.splice(due_.end(), slot, timer);
+        timers_[timer->id].first = &due_;
+      }
+    }
+    while (!due_.empty()) {
+      auto callback = std::move(due_.front().callback);
+      running_ = due_.front().id;
+      timers_.erase(running_);
+      due_.pop_front();
+
+      lock.unlock();
+      try {
+        callback();
+      } catch (const std::exception& e) {
+        AXY_LOG_ERROR("Timer callback failed: {}", e.what());
+      }
+      lock.lock();
+      running_ = 0;
+      callback_done_.notify_all();
+    }
+  }
+}
+
+}  // namespace axy
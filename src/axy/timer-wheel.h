@@ -0,0 +1,84 @@
+#ifndef AXY_SRC_AXY_TIMER_WHEEL_H_
+#define AXY_SRC_AXY_TIMER_WHEEL_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace axy {
+
+/** A hashed timer wheel, for many coarse timers that are mostly cancelled or
+ * rescheduled before they fire.
+ *
+ * Scheduling and cancelling are O(1). Timers fire on the wheel's own thread,
+ * up to one tick late, so callbacks must be quick and must not block.
+ */
+class TimerWheel {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using Callback = std::function<void()>;
+  using TimerId = std::uint64_t;
+
+  /// Timers with a delay of more than `tick * slots` go around the wheel more
+  /// than once, which only costs a comparison per round.
+  explicit TimerWheel(Clock::duration tick = std::chrono::milliseconds{100},
+                      std::size_t slots = 512);
+  ~TimerWheel();
+
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  /// Call `callback` on the wheel thread after at least `delay`. Callbacks
+  /// may schedule new timers.
+  TimerId Schedule(Clock::duration delay, Callback callback);
+
+  /** Cancel the timer `id`.
+   *
+   * Once this returns, the callback is neither running nor will it run,
+   * except when called from the callback itself.
+   *
+   * \returns false if the timer already fired or never existed. IDs are
+   *          never 0, so 0 can stand for no timer.
+   */
+  bool Cancel(TimerId id);
+
+  Clock::duration tick() const { return tick_; }
+
+ private:
+  struct Timer {
+    TimerId id;
+    std::uint64_t due_tick;
+    Callback callback;
+  };
+  using Slot = std::list<Timer>;
+
+  void Run(std::stop_token stop);
+
+  const Clock::duration tick_;
+
+  std::mutex mtx_;
+  std::condition_variable callback_done_;
+  std::vector<Slot> slots_;
+  /// Timers taken out of the current slot to fire, until their callbacks run.
+  Slot due_;
+  /// Where each timer is, in `slots_` or `due_`.
+  std::unordered_map<TimerId, std::pair<Slot*, Slot::iterator>> timers_;
+  std::uint64_t current_tick_ = 0;
+  TimerId next_id_ = 1;
+  /// The timer whose callback is running, 0 if none.
+  TimerId running_ = 0;
+
+  std::jthread thread_;
+};
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_TIMER_WHEEL_H_
@@ -0,0 +1,257 @@
+#include "src/axy/tracing.h"
+
+#include <cpr/cpr.h>
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "src/axy/event-store.h"
+#include "src/axy/logging.h"
+#include "src/axy/metrics.h"
+
+namespace axy {
+
+namespace {
+
+std::string_view EventName(StreamTrace::Event event) {
+  switch (event) {
+    using Event = StreamTrace::Event;
+    case Event::kClientFrameReceived:
+      return "client.frame_received";
+    case Event::kBackendWriteDone:
+      return "backend.write_done";
+    case Event::kBackendResponseReceived:
+      return "backend.response_received";
+    case Event::kClientWriteDone:
+      return "client.write_done";
+    case Event::kEventPublished:
+      return "event.published";
+    case Event::kRedisXaddDone:
+      return "redis.xadd_done";
+  }
+  return "unknown";
+}
+
+/// OTLP/JSON wants 64 bit integers as strings.
+std::string UnixNanos(std::chrono::system_clock::time_point t) {
+  return std::to_string(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch())
+          .count());
+}
+
+std::string RandomHexId(std::size_t num_bytes) {
+  thread_local std::mt19937_64 rng{std::random_device{}()};
+  std::string id;
+  while (id.size() < num_bytes * 2) {
+    id += fmt::format("{:016x}", rng());
+  }
+  id.resize(num_bytes * 2);
+  return id;
+}
+
+nlohmann::json StringAttribute(std::string_view key, std::string_view value) {
+  return {{"key", key}, {"value", {{"stringValue", value}}}};
+}
+
+Counter& DroppedTraces() {
+  static Counter& counter = MetricsRegistry::Global().GetCounter(
+      "axy_traces_dropped_total",
+      "Finished traces dropped because the export queue was full.");
+  return counter;
+}
+
+}  // namespace
+
+StreamTrace::StreamTrace(std::shared_ptr<Tracer> tracer,
+                         std::string conversation_id, std::size_t max_events)
+    : tracer_{std::move(tracer)},
+      conversation_id_{std::move(conversation_id)},
+      started_{std::chrono::system_clock::now()},
+      started_steady_{std::chrono::steady_clock::now()},
+      events_(max_events) {}
+
+StreamTrace::~StreamTrace() {
+  const auto ended_steady = std::chrono::steady_clock::now();
+  const auto num_events = std::min(num_events_.load(), events_.size());
+
+  Tracer::FinishedSpan span{
+      .conversation_id = conversation_id_,
+      .attributes = std::move(attributes_),
+      .started = started_,
+      .ended = started_ + std::chrono::duration_cast<
+                              std::chrono::system_clock::duration>(
+                              ended_steady - started_steady_),
+      .events = {},
+      .dropped_events = num_events_.load() - num_events,
+      .status_code = status_code_.load(),
+  };
+  span.events.reserve(num_events);
+  for (std::size_t i = 0; i < num_events; ++i) {
+    span.events.emplace_back(
+        started_ + std::chrono::duration_cast<
+                       std::chrono::system_clock::duration>(events_[i].offset),
+        events_[i].event);
+  }
+  // Events from different threads may have been recorded out of order
+  std::sort(span.events.begin(), span.events.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  tracer_->Enqueue(std::move(span));
+}
+
+void StreamTrace::SetAttribute(std::string key, std::string value) {
+  attributes_.emplace_back(std::move(key), std::move(value));
+}
+
+std::shared_ptr<Tracer> Tracer::Create(Options opts) {
+  if (opts.sample_ratio <= 0.0 ||
+      (opts.otlp_file.empty() && opts.otlp_endpoint.empty())) {
+    return nullptr;
+  }
+  return std::shared_ptr<Tracer>{new Tracer{std::move(opts)}};
+}
+
+Tracer::Tracer(Options opts) : opts_{std::move(opts)} {
+  if (!opts_.otlp_file.empty()) {
+    otlp_file_.open(opts_.otlp_file, std::ios::app);
+    if (!otlp_file_) {
+      throw std::runtime_error{fmt::format(
+          "Could not open trace file '{}' for writing.", opts_.otlp_file)};
+    }
+  }
+  export_thread_ =
+      std::jthread{[this](std::stop_token stop) { ExportLoop(stop); }};
+  AXY_LOG_INFO("Tracing {:.2f}% of conversations to {}.",
+               opts_.sample_ratio * 100,
+               opts_.otlp_file.empty() ? opts_.otlp_endpoint : opts_.otlp_file);
+}
+
+Tracer::~Tracer() = default;
+
+std::shared_ptr<StreamTrace> Tracer::StartStream(std::string conversation_id) {
+  if (!IsSampled(conversation_id)) {
+    return nullptr;
+  }
+  return std::make_shared<StreamTrace>(shared_from_this(),
+                                       std::move(conversation_id),
+                                       opts_.max_events_per_stream);
+}
+
+bool Tracer::IsSampled(std::string_view conversation_id) const {
+  if (opts_.sample_ratio >= 1.0) {
+    return true;
+  }
+  constexpr std::uint64_t kBuckets = 1'000'000;
+  // Stable, so every node samples the same conversations.
+  const auto bucket = StableHash(conversation_id) % kBuckets;
+  return static_cast<double>(bucket) < opts_.sample_ratio * kBuckets;
+}
+
+void Tracer::Enqueue(FinishedSpan span) {
+  {
+    std::lock_guard<std::mutex> lock{queue_mtx_};
+    if (queue_.size() >= opts_.max_queued_traces) {
+      DroppedTraces().Increment();
+      return;
+    }
+    queue_.push_back(std::move(span));
+  }
+  queue_cv_.notify_one();
+}
+
+void Tracer::ExportLoop(std::stop_token stop) {
+  std::vector<FinishedSpan> batch;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock{queue_mtx_};
+      queue_cv_.wait_for(lock, stop, std::chrono::seconds{1},
+                         [this]() { return !queue_.empty(); });
+      std::move(queue_.begin(), queue_.end(), std::back_inserter(batch));
+      queue_.clear();
+    }
+
+    if (!batch.empty()) {
+      try {
+        Export(batch);
+      } catch (const std::exception& e) {
+        AXY_LOG_WARN("Failed to export {} traces: {}", batch.size(),
+                     e.what());
+      }
+      batch.clear();
+    } else if (stop.stop_requested()) {
+      return;
+    }
+  }
+}
+
+void Tracer::Export(const std::vector<FinishedSpan>& spans) {
+  auto json_spans = nlohmann::json::array();
+  for (const auto& span : spans) {
+    auto attributes = nlohmann::json::array(
+        {StringAttribute("sdifi.conversation.id", span.conversation_id)});
+    for (const auto& [key, value] : span.attributes) {
+      attributes.push_back(StringAttribute(key, value));
+    }
+
+    auto events = nlohmann::json::array();
+    for (const auto& [t, event] : span.events) {
+      events.push_back({{"timeUnixNano", UnixNanos(t)},
+                        {"name", EventName(event)}});
+    }
+
+    json_spans.push_back({
+        {"traceId", RandomHexId(16)},
+        {"spanId", RandomHexId(8)},
+        {"name", "sdifi.speech.v1alpha.SpeechService/StreamingRecognize"},
+        {"kind", 2},  // SPAN_KIND_SERVER
+        {"startTimeUnixNano", UnixNanos(span.started)},
+        {"endTimeUnixNano", UnixNanos(span.ended)},
+        {"attributes", std::move(attributes)},
+        {"events", std::move(events)},
+        {"droppedEventsCount", span.dropped_events},
+        {"status", span.status_code == 0
+                       ? nlohmann::json{{"code", 1}}  // STATUS_CODE_OK
+                       : nlohmann::json{{"code", 2},  // STATUS_CODE_ERROR
+                                        {"message",
+                                         fmt::format("gRPC status code {}",
+                                                     span.status_code)}}},
+    });
+  }
+
+  const nlohmann::json request = {
+      {"resourceSpans",
+       {{{"resource",
+          {{"attributes", {StringAttribute("service.name",
+                                           opts_.service_name)}}}},
+         {"scopeSpans",
+          {{{"scope", {{"name", "axy"}}}, {"spans", json_spans}}}}}}}};
+
+  const auto body = request.dump();
+  if (otlp_file_.is_open()) {
+    otlp_file_ << body << '\n';
+    otlp_file_.flush();
+  }
+  if (!opts_.otlp_endpoint.empty()) {
+    auto res = cpr::Post(cpr::Url{opts_.otlp_endpoint}, cpr::Body{body},
+                         cpr::Header{{"Content-Type", "application/json"}},
+                         cpr::Timeout{std::chrono::milliseconds{5000}});
+    if (res.status_code != 200) {
+      AXY_LOG_WARN("OTLP collector at {} answered {}: {}", opts_.otlp_endpoint,
+                   res.status_code,
+                   res.error.message.empty() ? res.text : res.error.message);
+    }
+  }
+}
+
+}  // namespace axy
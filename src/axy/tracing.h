@@ -0,0 +1,144 @@
+#ifndef AXY_SRC_AXY_TRACING_H_
+#define AXY_SRC_AXY_TRACING_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace axy {
+
+class Tracer;
+
+/** Timeline of a single speech stream, exported as one OpenTelemetry span
+ * with an event per timestamp.
+ *
+ * Record() is safe to call concurrently from the server and backend reactors
+ * and costs a clock read and an atomic increment. The span is exported when
+ * the last reference to the trace is dropped.
+ */
+class StreamTrace {
+ public:
+  enum class Event : std::uint8_t {
+    kClientFrameReceived,
+    kBackendWriteDone,
+    kBackendResponseReceived,
+    kClientWriteDone,
+    kEventPublished,
+    kRedisXaddDone,
+  };
+
+  StreamTrace(std::shared_ptr<Tracer> tracer, std::string conversation_id,
+              std::size_t max_events);
+  ~StreamTrace();
+
+  StreamTrace(const StreamTrace&) = delete;
+  StreamTrace& operator=(const StreamTrace&) = delete;
+
+  void Record(Event event) noexcept {
+    const auto idx = num_events_.fetch_add(1, std::memory_order_relaxed);
+    if (idx < events_.size()) {
+      events_[idx] = {
+          .offset = std::chrono::steady_clock::now() - started_steady_,
+          .event = event};
+    }
+  }
+
+  /// Add a string attribute to the span. Not thread safe, so call this before
+  /// sharing the trace.
+  void SetAttribute(std::string key, std::string value);
+
+  void SetStatusCode(int code) noexcept {
+    status_code_.store(code, std::memory_order_relaxed);
+  }
+
+ private:
+  friend class Tracer;
+
+  struct Entry {
+    std::chrono::steady_clock::duration offset;
+    Event event;
+  };
+
+  std::shared_ptr<Tracer> tracer_;
+  const std::string conversation_id_;
+  std::vector<std::pair<std::string, std::string>> attributes_;
+  const std::chrono::system_clock::time_point started_;
+  const std::chrono::steady_clock::time_point started_steady_;
+  std::vector<Entry> events_;
+  std::atomic<std::size_t> num_events_ = 0;
+  std::atomic<int> status_code_ = 0;
+};
+
+/// Samples speech streams and exports their timelines as OTLP/JSON, either to
+/// a file (one `ExportTraceServiceRequest` per line) or to an OTLP/HTTP
+/// collector.
+class Tracer : public std::enable_shared_from_this<Tracer> {
+ public:
+  struct Options {
+    /// Fraction of conversations to trace. Sampling is by conversation ID, so
+    /// all nodes make the same decision for a conversation.
+    double sample_ratio = 0.0;
+    /// File to append OTLP/JSON trace requests to.
+    std::string otlp_file;
+    /// OTLP/HTTP traces endpoint, e.g. "http://localhost:4318/v1/traces".
+    std::string otlp_endpoint;
+    /// Events beyond this are dropped and counted.
+    std::size_t max_events_per_stream = 4096;
+    /// Finished traces waiting for export beyond this are dropped.
+    std::size_t max_queued_traces = 1024;
+    std::string service_name = "axy";
+  };
+
+  /// Returns nullptr if tracing is disabled by `opts`.
+  static std::shared_ptr<Tracer> Create(Options opts);
+
+  ~Tracer();
+
+  /// Returns a new trace if `conversation_id` is sampled, otherwise nullptr.
+  std::shared_ptr<StreamTrace> StartStream(std::string conversation_id);
+
+ private:
+  friend class StreamTrace;
+
+  struct FinishedSpan {
+    std::string conversation_id;
+    std::vector<std::pair<std::string, std::string>> attributes;
+    std::chrono::system_clock::time_point started;
+    std::chrono::system_clock::time_point ended;
+    std::vector<std::pair<std::chrono::system_clock::time_point,
+                          StreamTrace::Event>>
+        events;
+    std::size_t dropped_events;
+    int status_code;
+  };
+
+  explicit Tracer(Options opts);
+
+  bool IsSampled(std::string_view conversation_id) const;
+  void Enqueue(FinishedSpan span);
+  void ExportLoop(std::stop_token stop);
+  void Export(const std::vector<FinishedSpan>& spans);
+
+  const Options opts_;
+
+  std::mutex queue_mtx_;
+  std::condition_variable_any queue_cv_;
+  std::deque<FinishedSpan> queue_;
+
+  std::ofstream otlp_file_;
+  std::jthread export_thread_;
+};
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_TRACING_H_
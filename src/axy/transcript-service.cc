@@ -0,0 +1,335 @@
+#include "src/axy/transcript-service.h"
+
+#include <grpcpp/server_context.h>
+#include <grpcpp/support/server_callback.h>
+#include <grpcpp/support/status.h>
+#include <sdifi/events/v1alpha/event.pb.h>
+#include <sw/redis++/redis++.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "src/axy/event-codec.h"
+#include "src/axy/logging.h"
+
+namespace axy {
+
+namespace {
+
+using axy::events::v1alpha::ConversationTranscript;
+using axy::events::v1alpha::TranscriptSegment;
+
+/// Events read from Redis per XRANGE when rebuilding a transcript.
+constexpr long long kRedisPageSize = 1000;
+/// Calls waiting for a reader thread beyond this are rejected, rather than
+/// piling up while Redis is slow.
+constexpr std::size_t kMaxQueuedReads = 1000;
+
+bool SameChannel(const TranscriptSegment& segment,
+                 std::optional<std::size_t> channel) {
+  return segment.has_channel() ? channel && segment.channel() == *channel
+                               : !channel;
+}
+
+void SetChannel(TranscriptSegment& segment,
+                std::optional<std::size_t> channel) {
+  if (channel) {
+    segment.set_channel(static_cast<std::uint32_t>(*channel));
+  }
+}
+
+void JoinFinals(ConversationTranscript& transcript) {
+  std::string joined;
+  for (const auto& final : transcript.finals()) {
+    if (!joined.empty()) {
+      joined += ' ';
+    }
+    joined += final.transcript();
+  }
+  transcript.set_transcript(std::move(joined));
+}
+
+}  // namespace
+
+TranscriptSnapshots::TranscriptSnapshots(std::size_t max_conversations)
+    : max_conversations_{max_conversations},
+      conversations_{&MetricsRegistry::Global().GetGauge(
+          "axy_transcript_snapshots",
+          "Conversations whose transcript is kept in memory.")} {
+  if (max_conversations == 0) {
+    throw std::invalid_argument{
+        "Transcript snapshots need room for at least one conversation."};
+  }
+}
+
+void TranscriptSnapshots::Publish(const ConversationEvent& event) {
+  std::lock_guard<std::mutex> lock{mtx_};
+  auto& snapshot = TouchLocked(event.conversation_id);
+  ++snapshot.events;
+  Apply(event, snapshot.transcript);
+}
+
+void TranscriptSnapshots::Lost(const std::string& conversation_id) {
+  std::lock_guard<std::mutex> lock{mtx_};
+  // The Redis sink may drop an event before it gets here.
+  TouchLocked(conversation_id).incomplete = true;
+}
+
+TranscriptSnapshots::Snapshot& TranscriptSnapshots::TouchLocked(
+    const std::string& conversation_id) {
+  auto [it, inserted] = snapshots_.try_emplace(conversation_id);
+  auto& snapshot = it->second;
+  if (inserted) {
+    snapshot.transcript.set_conversation_id(conversation_id);
+    lru_.push_front(conversation_id);
+    snapshot.lru = lru_.begin();
+    if (snapshots_.size() > max_conversations_) {
+      snapshots_.erase(lru_.back());
+      lru_.pop_back();
+    }
+    conversations_->Set(static_cast<double>(snapshots_.size()));
+  } else {
+    lru_.splice(lru_.begin(), lru_, snapshot.lru);
+  }
+  return snapshot;
+}
+
+bool TranscriptSnapshots::NeedsVerify(const std::string& conversation_id) {
+  std::lock_guard<std::mutex> lock{mtx_};
+  const auto it = snapshots_.find(conversation_id);
+  return it != snapshots_.end() && !it->second.verified &&
+         !it->second.incomplete;
+}
+
+void TranscriptSnapshots::Verify(const std::string& conversation_id,
+                                 std::size_t stored_events) {
+  std::lock_guard<std::mutex> lock{mtx_};
+  const auto it = snapshots_.find(conversation_id);
+  if (it == snapshots_.end()) {
+    return;
+  }
+  auto& snapshot = it->second;
+  if (stored_events == snapshot.events) {
+    snapshot.verified = true;
+  } else if (stored_events > snapshot.events) {
+    snapshot.incomplete = true;
+  }
+}
+
+std::optional<ConversationTranscript> TranscriptSnapshots::Get(
+    const std::string& conversation_id) {
+  std::lock_guard<std::mutex> lock{mtx_};
+  const auto it = snapshots_.find(conversation_id);
+  if (it == snapshots_.end() || !it->second.verified ||
+      it->second.incomplete) {
+    return std::nullopt;
+  }
+  return it->second.transcript;
+}
+
+void TranscriptSnapshots::Apply(const ConversationEvent& event,
+                                ConversationTranscript& transcript) {
+  if (event.event == nullptr) {
+    return;
+  }
+  auto& partials = *transcript.mutable_partials();
+  const auto partial = std::find_if(
+      partials.begin(), partials.end(),
+      [&](const auto& segment) { return SameChannel(segment, event.channel); });
+
+  if (event.event->has_speech_partial()) {
+    const auto& text = event.event->speech_partial().transcript();
+    if (text.empty()) {
+      // E.g. only an end of utterance.
+      return;
+    }
+    if (partial != partials.end()) {
+      partial->set_transcript(text);
+    } else {
+      auto* added = partials.Add();
+      added->set_transcript(text);
+      SetChannel(*added, event.channel);
+    }
+  } else if (event.event->has_speech_final()) {
+    const auto& text = event.event->speech_final().transcript();
+    if (partial != partials.end()) {
+      partials.erase(partial);
+    }
+
+    auto& finals = *transcript.mutable_finals();
+    if (event.correction) {
+      for (auto it = finals.rbegin(); it != finals.rend(); ++it) {
+        if (SameChannel(*it, event.channel)) {
+          if (it->provisional()) {
+            it->set_transcript(text);
+            it->set_provisional(false);
+            JoinFinals(transcript);
+            transcript.set_last_event_id(event.id.ToString());
+            return;
+          }
+          break;
+        }
+      }
+    }
+
+    auto* added = finals.Add();
+    added->set_transcript(text);
+    SetChannel(*added, event.channel);
+    added->set_provisional(event.provisional);
+    auto& joined = *transcript.mutable_transcript();
+    if (!joined.empty()) {
+      joined += ' ';
+    }
+    joined += text;
+  } else {
+    return;
+  }
+  transcript.set_last_event_id(event.id.ToString());
+}
+
+TranscriptServiceImpl::TranscriptServiceImpl(
+    std::shared_ptr<TranscriptSnapshots> snapshots,
+    std::shared_ptr<EventStore> events, std::size_t num_threads, CpuSet cpus)
+    : snapshots_{std::move(snapshots)},
+      events_{std::move(events)},
+      cpus_{std::move(cpus)},
+      from_memory_{&MetricsRegistry::Global().GetCounter(
+          "axy_transcript_requests_total",
+          "GetTranscript calls by where the transcript came from.",
+          {{"source", "memory"}})},
+      from_redis_{&MetricsRegistry::Global().GetCounter(
+          "axy_transcript_requests_total",
+          "GetTranscript calls by where the transcript came from.",
+          {{"source", "redis"}})} {
+  if (num_threads == 0) {
+    throw std::invalid_argument{"Transcripts need at least one thread."};
+  }
+  for (std::size_t i = 0; i < num_threads; ++i) {
+    readers_.emplace_back([this](std::stop_token stop) { ReadLoop(stop); });
+  }
+}
+
+void TranscriptServiceImpl::ReadLoop(std::stop_token stop) {
+  try {
+    PinCurrentThread(cpus_);
+  } catch (const std::system_error& e) {
+    AXY_LOG_WARN("{}", e.what());
+  }
+
+  while (true) {
+    std::function<void()> read;
+    {
+      std::unique_lock<std::mutex> lock{queue_mtx_};
+      queue_cv_.wait(lock, stop, [this] { return !queue_.empty(); });
+      if (queue_.empty()) {
+        // Stopped, and every queued call has been answered.
+        return;
+      }
+      read = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    read();
+  }
+}
+
+grpc::ServerUnaryReactor* TranscriptServiceImpl::GetTranscript(
+    grpc::CallbackServerContext* context,
+    const axy::events::v1alpha::GetTranscriptRequest* request,
+    ConversationTranscript* response) {
+  auto* reactor = context->DefaultReactor();
+  if (request->conversation_id().empty()) {
+    reactor->Finish({grpc::StatusCode::INVALID_ARGUMENT,
+                     "Field `conversation_id` cannot be empty"});
+    return reactor;
+  }
+
+  // Redis reads are blocking, so don't tie up a gRPC thread with them.
+  {
+    std::lock_guard<std::mutex> lock{queue_mtx_};
+    if (queue_.size() >= kMaxQueuedReads) {
+      reactor->Finish({grpc::StatusCode::RESOURCE_EXHAUSTED,
+                       "Too many concurrent transcript reads"});
+      return reactor;
+    }
+    queue_.emplace_back([this, request, response, reactor]() {
+      reactor->Finish(Read(request->conversation_id(), *response));
+    });
+  }
+  queue_cv_.notify_one();
+  return reactor;
+}
+
+grpc::Status TranscriptServiceImpl::Read(const std::string& conversation_id,
+                                         ConversationTranscript& response) {
+  if (snapshots_ != nullptr) {
+    if (snapshots_->NeedsVerify(conversation_id)) {
+      try {
+        const auto stored =
+            events_->WithClient(conversation_id, [&](auto& redis) {
+              return redis.xlen(EventStore::StreamKey(conversation_id));
+            });
+        snapshots_->Verify(conversation_id, static_cast<std::size_t>(stored));
+      } catch (const sw::redis::Error& e) {
+        AXY_LOG_WARN("{}: could not read events from Redis: {}",
+                     conversation_id, e.what());
+        return {grpc::StatusCode::UNAVAILABLE, "Could not read events"};
+      }
+    }
+    if (auto snapshot = snapshots_->Get(conversation_id)) {
+      from_memory_->Increment();
+      response = std::move(*snapshot);
+      return grpc::Status::OK;
+    }
+  }
+
+  from_redis_->Increment();
+  return ReadFromRedis(conversation_id, response);
+}
+
+grpc::Status TranscriptServiceImpl::ReadFromRedis(
+    const std::string& conversation_id, ConversationTranscript& response) {
+  response.set_conversation_id(conversation_id);
+  const auto stream_key = EventStore::StreamKey(conversation_id);
+  // Reading from the start, deltas always come after what they refer to.
+  EventDecoder decoder{conversation_id};
+  std::string start = "-";
+  try {
+    while (true) {
+      std::vector<StreamItem> items;
+      events_->WithClient(conversation_id, [&](auto& redis) {
+        redis.xrange(stream_key, start, "+", kRedisPageSize,
+                     std::back_inserter(items));
+      });
+
+      for (const auto& [id, attrs] : items) {
+        // Pages after the first start with the last item of the one before.
+        if (id == start || !attrs) {
+          continue;
+        }
+        if (const auto parsed = decoder.Decode(id, *attrs)) {
+          TranscriptSnapshots::Apply(*parsed, response);
+        }
+      }
+
+      if (items.size() < static_cast<std::size_t>(kRedisPageSize)) {
+        break;
+      }
+      start = items.back().first;
+    }
+  } catch (const sw::redis::Error& e) {
+    AXY_LOG_WARN("{}: could not read events from Redis: {}", conversation_id,
+                 e.what());
+    return {grpc::StatusCode::UNAVAILABLE, "Could not read events"};
+  }
+  return grpc::Status::OK;
+}
+
+}  // namespace axy
@@ -0,0 +1,147 @@
+#ifndef AXY_SRC_AXY_TRANSCRIPT_SERVICE_H_
+#define AXY_SRC_AXY_TRANSCRIPT_SERVICE_H_
+
+#include <axy/events/v1alpha/transcript.grpc.pb.h>
+#include <axy/events/v1alpha/transcript.pb.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "src/axy/event-sink.h"
+#include "src/axy/event-store.h"
+#include "src/axy/metrics.h"
+#include "src/axy/threading.h"
+
+namespace axy {
+
+using TranscriptService = axy::events::v1alpha::Transcripts::CallbackService;
+
+/** Transcripts of the conversations streamed by this instance, kept up to
+ * date as their events are published.
+ *
+ * Only the `max_conversations` most recently updated conversations are kept,
+ * the others have to be rebuilt from Redis. So do conversations with events
+ * the Redis sink couldn't write (see `Lost`), and ones that were streamed
+ * elsewhere or before their snapshot was made, which `Verify` compares with
+ * Redis until they match. A conversation streamed by another instance at the
+ * same time goes unnoticed after that.
+ */
+class TranscriptSnapshots final : public EventSink {
+ public:
+  /// \throws std::invalid_argument if `max_conversations` is 0.
+  explicit TranscriptSnapshots(std::size_t max_conversations);
+
+  void Publish(const ConversationEvent& event) override;
+
+  /// Mark the snapshot of `conversation_id` as incomplete, because one of
+  /// its events was dropped instead of written to Redis.
+  void Lost(const std::string& conversation_id);
+
+  /// Whether there is a snapshot of `conversation_id` that has yet to be
+  /// compared with Redis by `Verify`.
+  bool NeedsVerify(const std::string& conversation_id);
+
+  /// Compare the snapshot of `conversation_id` with the `stored_events` in
+  /// Redis. Fewer may be ones still being written, so it's compared again
+  /// next time, more were written by someone else.
+  void Verify(const std::string& conversation_id, std::size_t stored_events);
+
+  /// \returns the transcript so far, or nothing if this instance doesn't
+  /// have the conversation or its snapshot isn't known to be complete.
+  std::optional<axy::events::v1alpha::ConversationTranscript> Get(
+      const std::string& conversation_id);
+
+  /// Add `event` to `transcript`. Events other than partials and finals are
+  /// ignored.
+  static void Apply(const ConversationEvent& event,
+                    axy::events::v1alpha::ConversationTranscript& transcript);
+
+ private:
+  struct Snapshot {
+    axy::events::v1alpha::ConversationTranscript transcript;
+    /// Events published since the snapshot was made, including those that
+    /// didn't change the transcript.
+    std::size_t events = 0;
+    /// Redis had the same events when last compared.
+    bool verified = false;
+    /// Redis has events the snapshot doesn't or is missing some of its own.
+    bool incomplete = false;
+    /// Position in `lru_`.
+    std::list<std::string>::iterator lru;
+  };
+
+  /// The snapshot of `conversation_id`, made the most recently updated and
+  /// added if there is none. Needs `mtx_`.
+  Snapshot& TouchLocked(const std::string& conversation_id);
+
+  const std::size_t max_conversations_;
+
+  std::mutex mtx_;
+  std::unordered_map<std::string, Snapshot> snapshots_;
+  /// Conversation IDs, most recently updated first.
+  std::list<std::string> lru_;
+
+  Gauge* conversations_;
+};
+
+/** Serves `GetTranscript` from `snapshots`, falling back to reading the
+ * conversation's events from `events`. `snapshots` may be null, then every
+ * transcript is read from Redis.
+ *
+ * Calls are answered by `num_threads` threads pinned to `cpus`, because
+ * Redis reads block. Calls beyond those waiting for a thread are rejected
+ * with `RESOURCE_EXHAUSTED`.
+ */
+class TranscriptServiceImpl final : public TranscriptService {
+ public:
+  /// \throws std::invalid_argument if `num_threads` is 0.
+  TranscriptServiceImpl(std::shared_ptr<TranscriptSnapshots> snapshots,
+                        std::shared_ptr<EventStore> events,
+                        std::size_t num_threads, CpuSet cpus = {});
+
+  grpc::ServerUnaryReactor* GetTranscript(
+      grpc::CallbackServerContext* context,
+      const axy::events::v1alpha::GetTranscriptRequest* request,
+      axy::events::v1alpha::ConversationTranscript* response) override;
+
+ private:
+  void ReadLoop(std::stop_token stop);
+
+  /// From the snapshot if it is complete, otherwise from Redis. Blocks.
+  grpc::Status Read(const std::string& conversation_id,
+                    axy::events::v1alpha::ConversationTranscript& response);
+
+  grpc::Status ReadFromRedis(
+      const std::string& conversation_id,
+      axy::events::v1alpha::ConversationTranscript& response);
+
+  const std::shared_ptr<TranscriptSnapshots> snapshots_;
+  const std::shared_ptr<EventStore> events_;
+
+  const CpuSet cpus_;
+
+  Counter* from_memory_;
+  Counter* from_redis_;
+
+  std::mutex queue_mtx_;
+  std::condition_variable_any queue_cv_;
+  /// Calls waiting for a reader thread.
+  std::deque<std::function<void()>> queue_;
+  /// Last, so they have answered the queued calls before the rest goes away.
+  std::vector<std::jthread> readers_;
+};
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_TRANSCRIPT_SERVICE_H_
@@ -0,0 +1,226 @@
+#include "src/axy/warm-stream-pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+namespace axy {
+
+namespace {
+
+/// Weight of the latest sweep in the smoothed arrival rate and of the latest
+/// stream in the smoothed open latency.
+constexpr double kSmoothing = 0.3;
+
+}  // namespace
+
+WarmStreamPool::WarmStreamPool(Options opts, std::shared_ptr<TimerWheel> timers,
+                               Opener open, const std::string& route)
+    : opts_{opts},
+      timers_{std::move(timers)},
+      open_{std::move(open)},
+      sweep_interval_{opts.max_idle / 2},
+      ready_streams_{&MetricsRegistry::Global().GetGauge(
+          "axy_warm_streams",
+          "Backend streams opened ahead of time and ready to be taken.",
+          {{"route", route}})},
+      hits_{&MetricsRegistry::Global().GetCounter(
+          "axy_warm_stream_takes_total",
+          "Speech streams by whether they got a warm backend stream.",
+          {{"route", route}, {"result", "hit"}})},
+      misses_{&MetricsRegistry::Global().GetCounter(
+          "axy_warm_stream_takes_total",
+          "Speech streams by whether they got a warm backend stream.",
+          {{"route", route}, {"result", "miss"}})},
+      recycled_{&MetricsRegistry::Global().GetCounter(
+          "axy_warm_streams_recycled_total",
+          "Warm backend streams closed because they idled for too long.",
+          {{"route", route}})} {
+  ScheduleSweep();
+}
+
+WarmStreamPool::~WarmStreamPool() { Shutdown(); }
+
+void WarmStreamPool::Shutdown() {
+  std::unordered_map<Stream*, Entry> streams;
+  TimerWheel::TimerId timer;
+  {
+    std::lock_guard<std::mutex> lock{mtx_};
+    if (stopped_) {
+      return;
+    }
+    stopped_ = true;
+    timer = sweep_timer_;
+    streams.swap(streams_);
+    profiles_.clear();
+  }
+  timers_->Cancel(timer);
+  for (auto& [stream, entry] : streams) {
+    stream->Close();
+  }
+  ready_streams_->Set(0);
+}
+
+WarmStreamPool::Stream* WarmStreamPool::Take(const std::string& profile) {
+  Stream* taken = nullptr;
+  std::size_t missing = 0;
+  {
+    std::lock_guard<std::mutex> lock{mtx_};
+    if (stopped_) {
+      return nullptr;
+    }
+    auto& p = profiles_[profile];
+    ++p.arrivals;
+    if (!p.ready.empty()) {
+      taken = p.ready.back();
+      p.ready.pop_back();
+      streams_.erase(taken);
+      ready_streams_->Add(-1);
+    }
+    missing = Missing(p);
+  }
+  (taken != nullptr ? hits_ : misses_)->Increment();
+  Open(profile, missing);
+  return taken;
+}
+
+void WarmStreamPool::Ready(Stream* stream) {
+  std::lock_guard<std::mutex> lock{mtx_};
+  const auto it = streams_.find(stream);
+  if (it == streams_.end() || it->second.ready) {
+    return;
+  }
+  auto& entry = it->second;
+  const auto now = Clock::now();
+  open_latency_ = std::chrono::duration_cast<Clock::duration>(
+      kSmoothing * (now - entry.since) + (1 - kSmoothing) * open_latency_);
+  entry.ready = true;
+  entry.since = now;
+  auto& profile = profiles_[entry.profile];
+  --profile.opening;
+  profile.ready.push_back(stream);
+  ready_streams_->Add(1);
+}
+
+bool WarmStreamPool::Lost(Stream* stream) {
+  std::lock_guard<std::mutex> lock{mtx_};
+  const auto it = streams_.find(stream);
+  if (it == streams_.end()) {
+    return false;
+  }
+  auto& profile = profiles_[it->second.profile];
+  if (it->second.ready) {
+    std::erase(profile.ready, stream);
+    ready_streams_->Add(-1);
+  } else {
+    --profile.opening;
+  }
+  streams_.erase(it);
+  // Replaced on the next sweep, so a backend that's down isn't hammered.
+  return true;
+}
+
+void WarmStreamPool::Open(const std::string& profile, std::size_t count) {
+  for (std::size_t i = 0; i < count; ++i) {
+    {
+      std::lock_guard<std::mutex> lock{mtx_};
+      if (stopped_) {
+        return;
+      }
+      ++profiles_[profile].opening;
+    }
+    auto* stream = open_(profile);
+    {
+      std::lock_guard<std::mutex> lock{mtx_};
+      if (stopped_) {
+        // Started first, since only started streams can be closed.
+        stream->Start();
+        stream->Close();
+        return;
+      }
+      streams_.emplace(stream,
+                       Entry{.profile = profile, .since = Clock::now()});
+    }
+    stream->Start();
+  }
+}
+
+std::size_t WarmStreamPool::Missing(Profile& profile) {
+  const auto have = profile.ready.size() + profile.opening;
+  return profile.target > have ? profile.target - have : 0;
+}
+
+void WarmStreamPool::Sweep() {
+  const auto now = Clock::now();
+  const auto interval =
+      std::chrono::duration<double>(sweep_interval_).count();
+  const auto max_idle = std::chrono::duration<double>(opts_.max_idle).count();
+  // Streams ready before this would reach `max_idle` before the next sweep.
+  const auto recycle_before = now - (opts_.max_idle - sweep_interval_);
+
+  std::vector<Stream*> to_close;
+  std::vector<std::pair<std::string, std::size_t>> to_open;
+  {
+    std::lock_guard<std::mutex> lock{mtx_};
+    if (stopped_) {
+      return;
+    }
+    const auto open_latency =
+        std::chrono::duration<double>(open_latency_).count();
+    for (auto it = profiles_.begin(); it != profiles_.end();) {
+      auto& [key, profile] = *it;
+      profile.rate = kSmoothing * static_cast<double>(profile.arrivals) /
+                         interval +
+                     (1 - kSmoothing) * profile.rate;
+      profile.arrivals = 0;
+      profile.target =
+          profile.rate * max_idle < 0.5
+              ? 0
+              : std::clamp<std::size_t>(
+                    static_cast<std::size_t>(
+                        std::ceil(2 * profile.rate * open_latency)),
+                    1, opts_.max_per_profile);
+
+      auto& ready = profile.ready;
+      while (!ready.empty() &&
+             (ready.size() > profile.target ||
+              streams_.at(ready.front()).since < recycle_before)) {
+        if (ready.size() <= profile.target) {
+          recycled_->Increment();
+        }
+        to_close.push_back(ready.front());
+        streams_.erase(ready.front());
+        ready.pop_front();
+        ready_streams_->Add(-1);
+      }
+
+      if (const auto missing = Missing(profile); missing > 0) {
+        to_open.emplace_back(key, missing);
+      }
+      if (profile.target == 0 && ready.empty() && profile.opening == 0) {
+        it = profiles_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  for (auto* stream : to_close) {
+    stream->Close();
+  }
+  for (const auto& [profile, count] : to_open) {
+    Open(profile, count);
+  }
+  ScheduleSweep();
+}
+
+void WarmStreamPool::ScheduleSweep() {
+  std::lock_guard<std::mutex> lock{mtx_};
+  if (stopped_) {
+    return;
+  }
+  sweep_timer_ = timers_->Schedule(sweep_interval_, [this] { Sweep(); });
+}
+
+}  // namespace axy
@@ -0,0 +1,135 @@
+#ifndef AXY_SRC_AXY_WARM_STREAM_POOL_H_
+#define AXY_SRC_AXY_WARM_STREAM_POOL_H_
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "src/axy/metrics.h"
+#include "src/axy/timer-wheel.h"
+
+namespace axy {
+
+/** Backend streams opened and configured ahead of the speech streams that
+ * take them.
+ *
+ * The backend only sets up a decoder once a stream has sent its config, so
+ * opening a backend stream when a speech stream arrives puts a round trip and
+ * the decoder setup in front of its first partial. Streams are kept per
+ * profile, which is the config they were opened with, and a speech stream
+ * takes one opened with the same config.
+ *
+ * A profile keeps about twice as many streams as arrive while a replacement
+ * is being opened, up to `max_per_profile`. Profiles whose streams would
+ * mostly idle out before being taken keep none. Streams are closed and
+ * replaced before they have been idle for `max_idle`, so the backend doesn't
+ * time them out.
+ *
+ * Exported as `axy_warm_streams{route}`, `axy_warm_stream_takes_total{route,
+ * result}` and `axy_warm_streams_recycled_total{route}`.
+ */
+class WarmStreamPool {
+ public:
+  struct Options {
+    /// Most streams kept per profile, 0 disables the pool.
+    std::size_t max_per_profile = 0;
+    /// Shorter than the backend waits for audio on a fresh stream.
+    std::chrono::milliseconds max_idle{5000};
+  };
+
+  /// A backend stream, which belongs to the pool until it's taken.
+  class Stream {
+   public:
+    virtual ~Stream() = default;
+
+    /// Open the stream and send it its config. The stream then reports back
+    /// with `Ready` or `Lost`.
+    virtual void Start() = 0;
+    /// Close the stream, which won't be taken, and let it delete itself.
+    virtual void Close() = 0;
+  };
+
+  /// Creates a stream for `profile`, without starting it.
+  using Opener = std::function<Stream*(const std::string& profile)>;
+
+  /// `route` labels the pool's metrics.
+  WarmStreamPool(Options opts, std::shared_ptr<TimerWheel> timers,
+                 Opener open, const std::string& route);
+  ~WarmStreamPool();
+
+  WarmStreamPool(const WarmStreamPool&) = delete;
+  WarmStreamPool& operator=(const WarmStreamPool&) = delete;
+
+  /// A ready stream of `profile`, or null. Counts towards the arrival rate of
+  /// `profile` either way.
+  Stream* Take(const std::string& profile);
+
+  /// `stream` has sent its config and can be taken.
+  void Ready(Stream* stream);
+  /** `stream` broke before it was taken.
+   *
+   * \returns false if the pool had already given up the stream, because it
+   *          was taken or closed.
+   */
+  bool Lost(Stream* stream);
+
+  /// Close the streams in the pool and stop calling the opener, which may go
+  /// away after this returns. Streams taken before are unaffected.
+  void Shutdown();
+
+ private:
+  using Clock = TimerWheel::Clock;
+
+  struct Profile {
+    /// Newest last, since the oldest are the first to be recycled.
+    std::deque<Stream*> ready;
+    std::size_t opening = 0;
+    std::size_t arrivals = 0;
+    /// Arrivals per second, smoothed over sweeps.
+    double rate = 0;
+    std::size_t target = 0;
+  };
+
+  struct Entry {
+    std::string profile;
+    Clock::time_point since;
+    bool ready = false;
+  };
+
+  /// Open `count` streams for `profile`, without holding `mtx_`.
+  void Open(const std::string& profile, std::size_t count);
+  /// Streams `profile` should open to reach its target. Needs `mtx_`.
+  std::size_t Missing(Profile& profile);
+  /// Update the targets, recycle old streams and top up the profiles.
+  void Sweep();
+  void ScheduleSweep();
+
+  const Options opts_;
+  const std::shared_ptr<TimerWheel> timers_;
+  const Opener open_;
+  /// Half of `max_idle`, so streams are recycled before they reach it.
+  const Clock::duration sweep_interval_;
+
+  std::mutex mtx_;
+  std::map<std::string, Profile> profiles_;
+  std::unordered_map<Stream*, Entry> streams_;
+  /// Time from starting a stream until it's ready, smoothed.
+  Clock::duration open_latency_ = std::chrono::milliseconds{100};
+  TimerWheel::TimerId sweep_timer_ = 0;
+  bool stopped_ = false;
+
+  Gauge* ready_streams_;
+  Counter* hits_;
+  Counter* misses_;
+  Counter* recycled_;
+};
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_WARM_STREAM_POOL_H_
@@ -0,0 +1,335 @@
+#include "src/axy/websocket.h"
+
+#include <fmt/core.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <utility>
+
+#include "src/axy/logging.h"
+
+namespace axy {
+
+namespace {
+
+constexpr std::string_view kHandshakeGuid =
+    "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+/// Payloads of control frames are limited to 125 bytes and the close code
+/// takes 2 of them.
+constexpr std::size_t kMaxCloseReasonBytes = 123;
+
+std::uint32_t RotateLeft(std::uint32_t value, int bits) {
+  return (value << bits) | (value >> (32 - bits));
+}
+
+/// SHA-1 is only used for the handshake, where it's not a security measure.
+std::array<unsigned char, 20> Sha1(std::string_view data) {
+  std::uint32_t h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476,
+                        0xc3d2e1f0};
+
+  std::string padded{data};
+  padded.push_back(static_cast<char>(0x80));
+  while (padded.size() % 64 != 56) {
+    padded.push_back('\0');
+  }
+  const std::uint64_t bit_length = static_cast<std::uint64_t>(data.size()) * 8;
+  for (int shift = 56; shift >= 0; shift -= 8) {
+    padded.push_back(static_cast<char>(bit_length >> shift));
+  }
+
+  for (std::size_t chunk = 0; chunk < padded.size(); chunk += 64) {
+    std::uint32_t w[80];
+    for (int i = 0; i < 16; ++i) {
+      const auto* p =
+          reinterpret_cast<const unsigned char*>(&padded[chunk + 4 * i]);
+      w[i] = (std::uint32_t{p[0]} << 24) | (std::uint32_t{p[1]} << 16) |
+             (std::uint32_t{p[2]} << 8) | std::uint32_t{p[3]};
+    }
+    for (int i = 16; i < 80; ++i) {
+      w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    auto a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; ++i) {
+      std::uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5a827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ed9eba1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8f1bbcdc;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xca62c1d6;
+      }
+      const auto temp = RotateLeft(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = RotateLeft(b, 30);
+      b = a;
+      a = temp;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+
+  std::array<unsigned char, 20> digest;
+  for (int i = 0; i < 20; ++i) {
+    digest[i] = static_cast<unsigned char>(h[i / 4] >> (24 - 8 * (i % 4)));
+  }
+  return digest;
+}
+
+std::string Base64Encode(const unsigned char* data, std::size_t size) {
+  constexpr std::string_view kAlphabet =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  out.reserve((size + 2) / 3 * 4);
+  for (std::size_t i = 0; i < size; i += 3) {
+    std::uint32_t triple = std::uint32_t{data[i]} << 16;
+    if (i + 1 < size) {
+      triple |= std::uint32_t{data[i + 1]} << 8;
+    }
+    if (i + 2 < size) {
+      triple |= data[i + 2];
+    }
+    out.push_back(kAlphabet[(triple >> 18) & 0x3f]);
+    out.push_back(kAlphabet[(triple >> 12) & 0x3f]);
+    out.push_back(i + 1 < size ? kAlphabet[(triple >> 6) & 0x3f] : '=');
+    out.push_back(i + 2 < size ? kAlphabet[triple & 0x3f] : '=');
+  }
+  return out;
+}
+
+/// Whether the comma separated header value `list` contains `token`,
+/// ignoring case.
+bool HeaderHasToken(std::string_view list, std::string_view token) {
+  while (!list.empty()) {
+    const auto comma = list.find(',');
+    auto item = list.substr(0, comma);
+    list = comma == std::string_view::npos ? "" : list.substr(comma + 1);
+    while (!item.empty() && item.front() == ' ') {
+      item.remove_prefix(1);
+    }
+    while (!item.empty() && item.back() == ' ') {
+      item.remove_suffix(1);
+    }
+    if (std::equal(item.begin(), item.end(), token.begin(), token.end(),
+                   [](char a, char b) {
+                     return std::tolower(static_cast<unsigned char>(a)) ==
+                            std::tolower(static_cast<unsigned char>(b));
+                   })) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool IsControl(WebSocket::Opcode opcode) {
+  return static_cast<std::uint8_t>(opcode) & 0x8;
+}
+
+}  // namespace
+
+std::string WebSocketAcceptKey(std::string_view key) {
+  std::string input{key};
+  input += kHandshakeGuid;
+  const auto digest = Sha1(input);
+  return Base64Encode(digest.data(), digest.size());
+}
+
+std::unique_ptr<WebSocket> WebSocket::Accept(int fd, const HttpRequest& req,
+                                             std::size_t max_message_bytes) {
+  const auto header = [&req](const char* name) -> std::string_view {
+    const auto it = req.headers.find(name);
+    return it == req.headers.end() ? std::string_view{}
+                                   : std::string_view{it->second};
+  };
+
+  if (req.method != "GET" || !HeaderHasToken(header("upgrade"), "websocket") ||
+      !HeaderHasToken(header("connection"), "upgrade")) {
+    WriteHttpResponse(fd, {.status = 426,
+                           .headers = {{"Upgrade", "websocket"}},
+                           .body = "WebSocket upgrade required\n"});
+    return nullptr;
+  }
+  if (header("sec-websocket-version") != "13" ||
+      header("sec-websocket-key").empty()) {
+    WriteHttpResponse(fd, {.status = 400,
+                           .headers = {{"Sec-WebSocket-Version", "13"}},
+                           .body = "Unsupported WebSocket handshake\n"});
+    return nullptr;
+  }
+
+  const auto response = fmt::format(
+      "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+      "Connection: Upgrade\r\nSec-WebSocket-Accept: {}\r\n\r\n",
+      WebSocketAcceptKey(header("sec-websocket-key")));
+  if (!WriteAll(fd, response)) {
+    return nullptr;
+  }
+  return std::unique_ptr<WebSocket>{new WebSocket{fd, max_message_bytes}};
+}
+
+bool WebSocket::ReadExactly(std::size_t count, std::string* out) {
+  char chunk[16 * 1024];
+  while (buffer_.size() < count) {
+    const auto n = ::recv(fd_, chunk, sizeof(chunk), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    buffer_.append(chunk, n);
+  }
+  out->assign(buffer_, 0, count);
+  buffer_.erase(0, count);
+  return true;
+}
+
+std::optional<WebSocket::Message> WebSocket::Read() {
+  std::optional<Message> message;
+  std::string bytes;
+  while (true) {
+    if (!ReadExactly(2, &bytes)) {
+      return std::nullopt;
+    }
+    const bool fin = bytes[0] & 0x80;
+    const auto opcode = static_cast<Opcode>(bytes[0] & 0x0f);
+    const bool masked = bytes[1] & 0x80;
+    std::uint64_t length = bytes[1] & 0x7f;
+
+    if (!masked || (bytes[0] & 0x70) != 0) {
+      Close(kProtocolError, "Client frames must be masked and unextended");
+      return std::nullopt;
+    }
+    if (length >= 126) {
+      const std::size_t extended = length == 126 ? 2 : 8;
+      if (!ReadExactly(extended, &bytes)) {
+        return std::nullopt;
+      }
+      length = 0;
+      for (const char byte : bytes) {
+        length = (length << 8) | static_cast<unsigned char>(byte);
+      }
+    }
+    if (IsControl(opcode) && (!fin || length > 125)) {
+      Close(kProtocolError, "Invalid control frame");
+      return std::nullopt;
+    }
+    const auto message_size = message ? message->payload.size() : 0;
+    if (length > max_message_bytes_ - message_size) {
+      Close(kMessageTooBig, "Message too big");
+      return std::nullopt;
+    }
+
+    std::string mask;
+    if (!ReadExactly(4, &mask) || !ReadExactly(length, &bytes)) {
+      return std::nullopt;
+    }
+    for (std::size_t i = 0; i < bytes.size(); ++i) {
+      bytes[i] ^= mask[i % 4];
+    }
+
+    switch (opcode) {
+      case Opcode::kPing: {
+        std::lock_guard<std::mutex> lock{write_mtx_};
+        if (!close_sent_ && !SendFrameLocked(Opcode::kPong, bytes)) {
+          return std::nullopt;
+        }
+        continue;
+      }
+      case Opcode::kPong:
+        continue;
+      case Opcode::kClose: {
+        std::uint16_t code = kNormalClosure;
+        if (bytes.size() >= 2) {
+          code = static_cast<std::uint16_t>(
+              (static_cast<unsigned char>(bytes[0]) << 8) |
+              static_cast<unsigned char>(bytes[1]));
+        }
+        Close(code);
+        return std::nullopt;
+      }
+      case Opcode::kContinuation:
+        if (!message) {
+          Close(kProtocolError, "Unexpected continuation frame");
+          return std::nullopt;
+        }
+        message->payload += bytes;
+        break;
+      case Opcode::kText:
+      case Opcode::kBinary:
+        if (message) {
+          Close(kProtocolError, "Expected a continuation frame");
+          return std::nullopt;
+        }
+        message = Message{.opcode = opcode, .payload = std::move(bytes)};
+        bytes.clear();
+        break;
+      default:
+        Close(kProtocolError, "Unknown opcode");
+        return std::nullopt;
+    }
+
+    if (fin) {
+      return message;
+    }
+  }
+}
+
+bool WebSocket::Send(Opcode opcode, std::string_view payload) {
+  std::lock_guard<std::mutex> lock{write_mtx_};
+  return !close_sent_ && SendFrameLocked(opcode, payload);
+}
+
+void WebSocket::Close(std::uint16_t code, std::string_view reason) {
+  std::string payload;
+  payload.push_back(static_cast<char>(code >> 8));
+  payload.push_back(static_cast<char>(code & 0xff));
+  payload += reason.substr(0, kMaxCloseReasonBytes);
+
+  std::lock_guard<std::mutex> lock{write_mtx_};
+  if (close_sent_) {
+    return;
+  }
+  close_sent_ = true;
+  if (!SendFrameLocked(Opcode::kClose, payload)) {
+    AXY_LOG_DEBUG("Could not send WebSocket close frame.");
+  }
+}
+
+bool WebSocket::SendFrameLocked(Opcode opcode, std::string_view payload) {
+  // Server frames are never masked. Header and payload go out in one write,
+  // since the payloads we send are small.
+  std::string frame;
+  frame.reserve(payload.size() + 10);
+  frame.push_back(static_cast<char>(0x80 | static_cast<std::uint8_t>(opcode)));
+  if (payload.size() < 126) {
+    frame.push_back(static_cast<char>(payload.size()));
+  } else if (payload.size() <= 0xffff) {
+    frame.push_back(126);
+    frame.push_back(static_cast<char>(payload.size() >> 8));
+    frame.push_back(static_cast<char>(payload.size() & 0xff));
+  } else {
+    frame.push_back(127);
+    for (int shift = 56; shift >= 0; shift -= 8) {
+      frame.push_back(static_cast<char>(
+          static_cast<std::uint64_t>(payload.size()) >> shift));
+    }
+  }
+  frame += payload;
+  return WriteAll(fd_, frame);
+}
+
+}  // namespace axy
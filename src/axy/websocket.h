@@ -0,0 +1,93 @@
+#ifndef AXY_SRC_AXY_WEBSOCKET_H_
+#define AXY_SRC_AXY_WEBSOCKET_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "src/axy/http-server.h"
+
+namespace axy {
+
+/** Server side of a WebSocket connection (RFC 6455) on a blocking socket.
+ *
+ * Messages are read by one thread, while any thread may send. Pings are
+ * answered while reading and fragmented messages are reassembled.
+ */
+class WebSocket {
+ public:
+  enum class Opcode : std::uint8_t {
+    kContinuation = 0x0,
+    kText = 0x1,
+    kBinary = 0x2,
+    kClose = 0x8,
+    kPing = 0x9,
+    kPong = 0xa,
+  };
+
+  /// Close status codes from RFC 6455, section 7.4.1.
+  enum CloseCode : std::uint16_t {
+    kNormalClosure = 1000,
+    kGoingAway = 1001,
+    kProtocolError = 1002,
+    kInvalidPayload = 1007,
+    kMessageTooBig = 1009,
+    kInternalError = 1011,
+  };
+
+  struct Message {
+    Opcode opcode;
+    std::string payload;
+  };
+
+  /** Complete the opening handshake for `req` on `fd`.
+   *
+   * \returns The connection, or null if `req` isn't a WebSocket upgrade, in
+   *          which case an error response has been sent.
+   */
+  static std::unique_ptr<WebSocket> Accept(
+      int fd, const HttpRequest& req,
+      std::size_t max_message_bytes = 1024 * 1024);
+
+  WebSocket(const WebSocket&) = delete;
+  WebSocket& operator=(const WebSocket&) = delete;
+
+  /// Read the next text or binary message. Returns `std::nullopt` once the
+  /// peer has closed the connection, or on errors, after which the caller
+  /// should stop using it.
+  std::optional<Message> Read();
+
+  /// Send a single frame message. Returns false if the connection is gone or
+  /// already closed.
+  bool Send(Opcode opcode, std::string_view payload);
+
+  /// Send a close frame, unless one has been sent already. `reason` is cut
+  /// to fit in a control frame.
+  void Close(std::uint16_t code, std::string_view reason = "");
+
+ private:
+  WebSocket(int fd, std::size_t max_message_bytes)
+      : fd_{fd}, max_message_bytes_{max_message_bytes} {}
+
+  bool ReadExactly(std::size_t count, std::string* out);
+  bool SendFrameLocked(Opcode opcode, std::string_view payload);
+
+  const int fd_;
+  const std::size_t max_message_bytes_;
+  /// Bytes received but not parsed yet.
+  std::string buffer_;
+
+  std::mutex write_mtx_;
+  bool close_sent_ = false;  // Guarded by write_mtx_
+};
+
+/// The `Sec-WebSocket-Accept` value for a `Sec-WebSocket-Key`.
+std::string WebSocketAcceptKey(std::string_view key);
+
+}  // namespace axy
+
+#endif  // AXY_SRC_AXY_WEBSOCKET_H_